@@ -31,8 +31,14 @@
 #include <kernel/mutex.h>
 #include <kernel/semaphore.h>
 #include <kernel/event.h>
+#include <lib/io.h>
+#include <lib/slab.h>
 #include <platform.h>
 
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
+
 const size_t BUFSIZE = (1024*1024);
 const uint ITER = 1024;
 
@@ -153,6 +159,167 @@ __NO_INLINE static void bench_memcpy(void)
     free(buf);
 }
 
+#define STRING_BENCH_MIN 8
+#define STRING_BENCH_MAX (1024 * 1024)
+#define STRING_BENCH_BYTES (4 * 1024 * 1024)
+
+enum string_bench_op {
+    STRING_BENCH_MEMCPY,
+    STRING_BENCH_MEMMOVE,
+    STRING_BENCH_MEMSET,
+    STRING_BENCH_MEMCMP,
+    STRING_BENCH_STRLEN,
+    STRING_BENCH_STRNLEN,
+    STRING_BENCH_STRCHR,
+    STRING_BENCH_MEMCHR,
+    STRING_BENCH_STRCMP,
+};
+
+static const char *string_bench_name[] = {
+    [STRING_BENCH_MEMCPY] = "memcpy",
+    [STRING_BENCH_MEMMOVE] = "memmove",
+    [STRING_BENCH_MEMSET] = "memset",
+    [STRING_BENCH_MEMCMP] = "memcmp",
+    [STRING_BENCH_STRLEN] = "strlen",
+    [STRING_BENCH_STRNLEN] = "strnlen",
+    [STRING_BENCH_STRCHR] = "strchr",
+    [STRING_BENCH_MEMCHR] = "memchr",
+    [STRING_BENCH_STRCMP] = "strcmp",
+};
+
+static volatile uintptr_t string_bench_sink;
+
+/*
+ * Run op over size bytes until about STRING_BENCH_BYTES have been touched.
+ * dst and src point into separate buffers, except for memmove which moves
+ * the buffer down over itself. The string ops see size - 1 characters and
+ * a terminator, and the searches do not find what they look for.
+ */
+__NO_INLINE static void bench_string_op(enum string_bench_op op, uint8_t *dst,
+                                        uint8_t *src, size_t size,
+                                        const char *align)
+{
+    uint iter = MAX(STRING_BENCH_BYTES / size, 1);
+    bool str = op >= STRING_BENCH_STRLEN;
+    uintptr_t sink = 0;
+
+    if (str) {
+        src[size - 1] = '\0';
+        dst[size - 1] = '\0';
+    }
+
+    lk_time_ns_t t = current_time_ns();
+    for (uint i = 0; i < iter; i++) {
+        switch (op) {
+        case STRING_BENCH_MEMCPY:
+            memcpy(dst, src, size);
+            break;
+        case STRING_BENCH_MEMMOVE:
+            memmove(dst, dst + 64, size);
+            break;
+        case STRING_BENCH_MEMSET:
+            memset(dst, 0, size);
+            break;
+        case STRING_BENCH_MEMCMP:
+            sink += memcmp(dst, src, size);
+            break;
+        case STRING_BENCH_STRLEN:
+            sink += strlen((char *)src);
+            break;
+        case STRING_BENCH_STRNLEN:
+            sink += strnlen((char *)src, size);
+            break;
+        case STRING_BENCH_STRCHR:
+            sink += (uintptr_t)strchr((char *)src, '\n');
+            break;
+        case STRING_BENCH_MEMCHR:
+            sink += (uintptr_t)memchr(src, '\n', size);
+            break;
+        case STRING_BENCH_STRCMP:
+            sink += strcmp((char *)dst, (char *)src);
+            break;
+        }
+    }
+    t = current_time_ns() - t;
+    string_bench_sink = sink;
+
+    if (str) {
+        src[size - 1] = 0x55;
+        dst[size - 1] = 0x55;
+    }
+
+    printf("%-8s %-10s %8zu bytes: %6llu ns/call, %6llu MB/s\n",
+           string_bench_name[op], align, size, t / iter,
+           (uint64_t)size * iter * 1000 / MAX(t, 1));
+}
+
+/* sweep the string routines over sizes with aligned and misaligned buffers */
+__NO_INLINE static void bench_string_ops(void)
+{
+    /* room for the misalignment and for memmove's overlapping source */
+    size_t bufsize = STRING_BENCH_MAX + 128;
+    uint8_t *dst = memalign(64, bufsize);
+    uint8_t *src = memalign(64, bufsize);
+
+    if (!dst || !src) {
+        printf("failed to allocate buffers\n");
+        goto done;
+    }
+    memset(src, 0x55, bufsize);
+
+    for (uint op = 0; op < countof(string_bench_name); op++) {
+        /* memcmp and strcmp have to walk the whole buffer to be measured */
+        if (op == STRING_BENCH_MEMCMP) {
+            memcpy(dst, src, bufsize);
+        }
+        for (size_t size = STRING_BENCH_MIN; size <= STRING_BENCH_MAX;
+             size *= 2) {
+            bench_string_op(op, dst, src, size, "aligned");
+            bench_string_op(op, dst + 3, src + 1, size, "misaligned");
+        }
+    }
+
+done:
+    free(dst);
+    free(src);
+}
+
+/* small enough that the lines fit in an async console ring */
+#define PRINTF_BENCH_LINES 32
+
+__NO_INLINE static void bench_printf_latency_mode(const char *mode)
+{
+    lk_time_ns_t total = 0;
+    lk_time_ns_t max = 0;
+
+    for (uint i = 0; i < PRINTF_BENCH_LINES; i++) {
+        lk_time_ns_t t = current_time_ns();
+        printf("printf latency test (%s) line %2u of %u, padded to a typical log line\n",
+               mode, i + 1, PRINTF_BENCH_LINES);
+        t = current_time_ns() - t;
+        total += t;
+        max = MAX(max, t);
+    }
+    printf("%s console: %llu ns average, %llu ns max per printf\n", mode,
+           total / PRINTF_BENCH_LINES, max);
+}
+
+/* how long the printing thread is held up, with and without the async path */
+__NO_INLINE static void bench_printf_latency(void)
+{
+#if CONSOLE_ASYNC
+    bool async = console_get_async();
+
+    console_set_async(false);
+    bench_printf_latency_mode("sync");
+    console_set_async(true);
+    bench_printf_latency_mode("async");
+    console_set_async(async);
+#else
+    bench_printf_latency_mode("sync");
+#endif
+}
+
 #if ARCH_ARM
 __NO_INLINE static void arm_bench_cset_stm(void)
 {
@@ -247,11 +414,180 @@ __NO_INLINE static void bench_sincos(void)
 
 #endif // WITH_LIB_LIBM
 
+#if WITH_KERNEL_VM
+__NO_INLINE static void bench_vmm_free_region(void)
+{
+    for (size_t size = PAGE_SIZE; size <= 64 * 1024 * 1024; size *= 4) {
+        void *ptr;
+        status_t err = vmm_alloc(vmm_get_kernel_aspace(), "bench", size, &ptr,
+                                 0, 0, ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+        if (err) {
+            printf("failed to allocate %zu bytes: %d\n", size, err);
+            return;
+        }
+
+        lk_time_ns_t t = current_time_ns();
+        vmm_free_region(vmm_get_kernel_aspace(), (vaddr_t)ptr);
+        t = current_time_ns() - t;
+
+        printf("took %llu ns to vmm_free_region a region of size %zu\n",
+               t, size);
+    }
+}
+#endif
+
+#define MALLOC_BENCH_ITER 100000
+#define MALLOC_BENCH_SLOTS 16
+
+static int bench_malloc_thread(void *arg)
+{
+    void *ptr[MALLOC_BENCH_SLOTS] = { 0 };
+
+    /* keep a few blocks live so the frees don't just undo the last malloc */
+    for (uint i = 0; i < MALLOC_BENCH_ITER; i++) {
+        uint slot = i % MALLOC_BENCH_SLOTS;
+        free(ptr[slot]);
+        ptr[slot] = malloc(16 + (i % 8) * 16);
+        if (!ptr[slot]) {
+            return ERR_NO_MEMORY;
+        }
+    }
+    for (uint i = 0; i < MALLOC_BENCH_SLOTS; i++) {
+        free(ptr[i]);
+    }
+    return 0;
+}
+
+#define REALLOC_BENCH_MAX (64 * 1024)
+#define REALLOC_BENCH_STEP 64
+
+/* grow a buffer the way an append-only log or dynamic array does */
+__NO_INLINE static void bench_realloc_growth(void)
+{
+    char *buf = NULL;
+    uint moves = 0;
+
+    lk_time_ns_t t = current_time_ns();
+    for (size_t size = REALLOC_BENCH_STEP; size <= REALLOC_BENCH_MAX;
+         size += REALLOC_BENCH_STEP) {
+        char *new_buf = realloc(buf, size);
+        if (!new_buf) {
+            printf("realloc of %zu bytes failed\n", size);
+            free(buf);
+            return;
+        }
+        if (new_buf != buf) {
+            moves++;
+        }
+        buf = new_buf;
+        buf[size - 1] = (char)size;
+    }
+    t = current_time_ns() - t;
+    free(buf);
+
+    printf("grew a buffer to %u bytes in %u byte steps in %llu us, %u moves\n",
+           REALLOC_BENCH_MAX, REALLOC_BENCH_STEP, t / 1000, moves);
+}
+
+#define SLAB_BENCH_CACHES 8
+
+static struct kmem_cache *bench_slab_cache[SLAB_BENCH_CACHES];
+
+/* same pattern as bench_malloc_thread with a cache for each size */
+static int bench_slab_thread(void *arg)
+{
+    void *ptr[MALLOC_BENCH_SLOTS] = { 0 };
+    uint cache[MALLOC_BENCH_SLOTS] = { 0 };
+
+    for (uint i = 0; i < MALLOC_BENCH_ITER; i++) {
+        uint slot = i % MALLOC_BENCH_SLOTS;
+        if (ptr[slot]) {
+            kmem_cache_free(bench_slab_cache[cache[slot]], ptr[slot]);
+        }
+        cache[slot] = i % SLAB_BENCH_CACHES;
+        ptr[slot] = kmem_cache_alloc(bench_slab_cache[cache[slot]]);
+        if (!ptr[slot]) {
+            return ERR_NO_MEMORY;
+        }
+    }
+    for (uint i = 0; i < MALLOC_BENCH_SLOTS; i++) {
+        if (ptr[i]) {
+            kmem_cache_free(bench_slab_cache[cache[i]], ptr[i]);
+        }
+    }
+    return 0;
+}
+
+__NO_INLINE static void bench_alloc_threads(const char *name,
+                                            thread_start_routine entry)
+{
+    thread_t *threads[SMP_MAX_CPUS];
+
+    for (uint count = 1; count <= SMP_MAX_CPUS; count *= 2) {
+        int ret = 0;
+        uint started;
+        lk_time_ns_t t = current_time_ns();
+        for (started = 0; started < count; started++) {
+            threads[started] = thread_create(name, entry, NULL,
+                                             DEFAULT_PRIORITY,
+                                             DEFAULT_STACK_SIZE);
+            if (!threads[started]) {
+                ret = ERR_NO_MEMORY;
+                break;
+            }
+            thread_resume(threads[started]);
+        }
+        for (uint i = 0; i < started; i++) {
+            int retcode;
+            thread_join(threads[i], &retcode, INFINITE_TIME);
+            ret = ret ?: retcode;
+        }
+        t = current_time_ns() - t;
+
+        if (ret) {
+            printf("%s failed: %d\n", name, ret);
+            return;
+        }
+        printf("%s: %u threads did %u alloc/free pairs each in %llu us, %llu pairs/ms\n",
+               name, count, MALLOC_BENCH_ITER, t / 1000,
+               (uint64_t)count * MALLOC_BENCH_ITER * 1000000 / MAX(t, 1));
+    }
+}
+
+__NO_INLINE static void bench_slab_threads(void)
+{
+    for (uint i = 0; i < SLAB_BENCH_CACHES; i++) {
+        bench_slab_cache[i] = kmem_cache_create("slab bench", 16 + i * 16, 0,
+                                                NULL);
+        if (!bench_slab_cache[i]) {
+            printf("failed to create slab bench caches\n");
+            goto done;
+        }
+    }
+
+    bench_alloc_threads("slab bench", bench_slab_thread);
+
+done:
+    for (uint i = 0; i < SLAB_BENCH_CACHES; i++) {
+        if (bench_slab_cache[i]) {
+            kmem_cache_trim(bench_slab_cache[i]);
+            kmem_cache_destroy(bench_slab_cache[i]);
+            bench_slab_cache[i] = NULL;
+        }
+    }
+}
+
 void benchmarks(void)
 {
     bench_set_overhead();
     bench_memset();
     bench_memcpy();
+    bench_string_ops();
+    bench_printf_latency();
+
+    bench_alloc_threads("malloc bench", bench_malloc_thread);
+    bench_slab_threads();
+    bench_realloc_growth();
 
     bench_cset_uint8_t();
     bench_cset_uint16_t();
@@ -269,5 +605,8 @@ void benchmarks(void)
 #if WITH_LIB_LIBM
     bench_sincos();
 #endif
+#if WITH_KERNEL_VM
+    bench_vmm_free_region();
+#endif
 }
 
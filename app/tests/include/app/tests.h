@@ -28,8 +28,10 @@
 int cbuf_tests(int argc, const cmd_args *argv);
 int fibo(int argc, const cmd_args *argv);
 int port_tests(void);
+int slab_tests(void);
 int spinner(int argc, const cmd_args *argv);
 int thread_tests(void);
+int vmm_tests(void);
 void benchmarks(void);
 void clock_tests(void);
 void printf_tests(void);
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <err.h>
+#include <lib/console.h>
+#include <new.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace {
+
+constexpr int kIterations = 32;
+
+struct alignas(32) Align32 {
+    uint8_t data[20];
+};
+
+struct alignas(64) Align64 {
+    uint8_t data[48];
+};
+
+struct alignas(256) Align256 {
+    uint32_t value;
+};
+
+struct alignas(4096) AlignPage {
+    uint8_t data[100];
+};
+
+bool is_aligned(const void *p, size_t align) {
+    return ((uintptr_t)p & (align - 1)) == 0;
+}
+
+template <typename T>
+int check_alignment(const char *name) {
+    constexpr size_t align = alignof(T);
+
+    for (int i = 0; i < kIterations; i++) {
+        T *obj = new T;
+        T *array = new T[3];
+        T *nothrow_obj = new (std::nothrow) T;
+        void *raw = ::operator new(sizeof(T) + i, std::align_val_t(align));
+
+        int ret = NO_ERROR;
+        if (!obj || !array || !nothrow_obj || !raw) {
+            printf("%s: allocation failed\n", name);
+            ret = ERR_NO_MEMORY;
+        } else if (!is_aligned(obj, align) || !is_aligned(array, align) ||
+                   !is_aligned(nothrow_obj, align) || !is_aligned(raw, align)) {
+            printf("%s: %p %p %p %p not aligned to %zu\n", name, obj, array,
+                   nothrow_obj, raw, align);
+            ret = ERR_GENERIC;
+        }
+
+        delete obj;
+        delete[] array;
+        delete nothrow_obj;
+        ::operator delete(raw, sizeof(T) + i, std::align_val_t(align));
+        if (ret) {
+            return ret;
+        }
+    }
+    printf("%s: aligned to %zu\n", name, align);
+    return NO_ERROR;
+}
+
+int check_sized_delete() {
+    for (size_t size = 1; size <= 4096; size *= 2) {
+        void *p = ::operator new(size);
+        void *q = ::operator new[](size, std::nothrow);
+        if (!p || !q) {
+            printf("allocating %zu bytes failed\n", size);
+            ::operator delete(p, size);
+            ::operator delete[](q, size);
+            return ERR_NO_MEMORY;
+        }
+        if (!is_aligned(p, sizeof(void *)) || !is_aligned(q, sizeof(void *))) {
+            printf("%p or %p not pointer aligned\n", p, q);
+            return ERR_GENERIC;
+        }
+        ::operator delete(p, size);
+        ::operator delete[](q, size);
+    }
+    return NO_ERROR;
+}
+
+int check_nothrow_failure() {
+    /* no heap can hold this, so every nothrow form has to return nullptr */
+    constexpr size_t size = SIZE_MAX - 16;
+
+    void *p = ::operator new(size, std::nothrow);
+    void *q = ::operator new[](size, std::nothrow);
+    void *r = ::operator new(size, std::align_val_t(64), std::nothrow);
+    void *s = ::operator new[](size, std::align_val_t(4096), std::nothrow);
+    if (p || q || r || s) {
+        printf("allocating %zu bytes returned %p %p %p %p\n", size, p, q, r,
+               s);
+        return ERR_GENERIC;
+    }
+    return NO_ERROR;
+}
+
+int new_tests(int argc, const cmd_args *argv) {
+    int ret = check_alignment<Align32>("alignas(32)");
+    if (!ret) {
+        ret = check_alignment<Align64>("alignas(64)");
+    }
+    if (!ret) {
+        ret = check_alignment<Align256>("alignas(256)");
+    }
+    if (!ret) {
+        ret = check_alignment<AlignPage>("alignas(4096)");
+    }
+    if (!ret) {
+        ret = check_sized_delete();
+    }
+    if (!ret) {
+        ret = check_nothrow_failure();
+    }
+
+    printf("new tests %s\n", ret ? "FAILED" : "passed");
+    return ret;
+}
+
+}  // namespace
+
+STATIC_COMMAND_START
+STATIC_COMMAND("new_tests", "test aligned and sized operator new/delete",
+               &new_tests)
+STATIC_COMMAND_END(new_tests);
@@ -24,12 +24,15 @@
 #include <debug.h>
 #include <err.h>
 #include <rand.h>
+#include <stdlib.h>
 #include <string.h>
 #include <trace.h>
 
 #include <kernel/event.h>
 #include <kernel/port.h>
 #include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <lib/cbuf.h>
 
 #include <platform.h>
 
@@ -330,8 +333,12 @@ int two_threads_basic(void)
     port_packet_t packet_out = {{0xaf, 0x77, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05}};
 
     port_result_t pr;
+    uint64_t messages = 0;
+    lk_time_ns_t t = current_time_ns();
     for (int ix = 0; ix != passes; ++ix) {
         const size_t count = 1 + ((unsigned int)rand() % 3);
+        // each packet out is echoed by both workers.
+        messages += count * 3;
 
         for (size_t jx = 0; jx != count; ++jx) {
             st = port_write(w_port, &packet_out, 1);
@@ -358,6 +365,10 @@ int two_threads_basic(void)
             }
         }
     }
+    t = current_time_ns() - t;
+
+    printf("two_threads_basic: %llu messages in %llu us, %llu messages/s\n",
+           messages, t / 1000, messages * 1000000000ULL / MAX(t, 1));
 
     thread_sleep(100);
 
@@ -729,6 +740,719 @@ int group_waiting(void)
     return 0;
 }
 
+#define BIG_GROUP_COUNT 256
+
+static port_t big_group_w[BIG_GROUP_COUNT];
+static port_t big_group_r[BIG_GROUP_COUNT];
+
+// makes BIG_GROUP_COUNT port pairs, each read port with its index as the
+// context, and a group of all the read ports.
+static status_t make_big_group(port_t *group)
+{
+    for (uint ix = 0; ix != BIG_GROUP_COUNT; ++ix) {
+        char name[PORT_NAME_LEN];
+        snprintf(name, sizeof(name), "bg%u", ix);
+        status_t st = make_port_pair(name, (void *)(uintptr_t)ix,
+                                     &big_group_w[ix], &big_group_r[ix]);
+        if (st < 0)
+            return st;
+    }
+    return port_group(big_group_r, BIG_GROUP_COUNT, group);
+}
+
+static void destroy_big_group(port_t group)
+{
+    port_close(group);
+    for (uint ix = 0; ix != BIG_GROUP_COUNT; ++ix) {
+        port_close(big_group_r[ix]);
+        port_close(big_group_w[ix]);
+        port_destroy(big_group_w[ix]);
+    }
+}
+
+/* Fills every port of a 256 port group and checks that the group serves
+ * them round-robin: each port once per round, in the order they became
+ * ready.
+ */
+int group_fairness(void)
+{
+    port_t pg;
+    if (make_big_group(&pg) < 0)
+        return __LINE__;
+
+    const uint rounds = 4;
+    port_packet_t pk = {{0}};
+    for (uint ix = 0; ix != BIG_GROUP_COUNT; ++ix) {
+        for (uint jx = 0; jx != rounds; ++jx) {
+            if (port_write(big_group_w[ix], &pk, 1) < 0)
+                return __LINE__;
+        }
+    }
+
+    port_result_t pr;
+    for (uint jx = 0; jx != rounds; ++jx) {
+        for (uint ix = 0; ix != BIG_GROUP_COUNT; ++ix) {
+            if (port_read(pg, 0, &pr) < 0)
+                return __LINE__;
+            if ((uintptr_t)pr.ctx != ix) {
+                printf("round %u: expected port %u, got %u\n",
+                       jx, ix, (uint)(uintptr_t)pr.ctx);
+                return __LINE__;
+            }
+        }
+    }
+
+    if (port_read(pg, 0, &pr) != ERR_TIMED_OUT)
+        return __LINE__;
+
+    destroy_big_group(pg);
+    printf("group_fairness : ok\n");
+    return 0;
+}
+
+static event_t big_group_ack;
+
+static int big_group_writer(void *arg)
+{
+    uint iterations = (uint)(uintptr_t)arg;
+
+    for (uint ix = 0; ix != iterations; ++ix) {
+        // the last ports are the worst case for a linear scan.
+        uint port = BIG_GROUP_COUNT - 1 - (ix % 16);
+        port_packet_t pk;
+        lk_time_ns_t now = current_time_ns();
+        memcpy(pk.value, &now, sizeof(now));
+        if (port_write(big_group_w[port], &pk, 1) < 0)
+            return __LINE__;
+        event_wait(&big_group_ack);
+    }
+    return 0;
+}
+
+/* Measures how long a reader blocked on a 256 port group takes to see a
+ * packet written to one of its members.
+ */
+int group_latency(void)
+{
+    port_t pg;
+    if (make_big_group(&pg) < 0)
+        return __LINE__;
+
+    const uint iterations = 1000;
+    event_init(&big_group_ack, false, EVENT_FLAG_AUTOUNSIGNAL);
+    thread_t *t1 = thread_create("bg writer", &big_group_writer,
+                                 (void *)(uintptr_t)iterations,
+                                 DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(t1);
+
+    lk_time_ns_t total = 0;
+    lk_time_ns_t worst = 0;
+    port_result_t pr;
+    for (uint ix = 0; ix != iterations; ++ix) {
+        status_t st = port_read(pg, 1000, &pr);
+        lk_time_ns_t now = current_time_ns();
+        if (st < 0) {
+            printf("could not read group, status = %d\n", st);
+            return __LINE__;
+        }
+        lk_time_ns_t sent;
+        memcpy(&sent, pr.packet.value, sizeof(sent));
+        total += now - sent;
+        worst = MAX(worst, now - sent);
+        event_signal(&big_group_ack, true);
+    }
+
+    int retcode = -1;
+    thread_join(t1, &retcode, INFINITE_TIME);
+    event_destroy(&big_group_ack);
+    destroy_big_group(pg);
+    if (retcode) {
+        printf("child thread exited with %d\n", retcode);
+        return __LINE__;
+    }
+
+    printf("group_latency: %u ports, average %llu ns, worst %llu ns\n",
+           BIG_GROUP_COUNT, total / iterations, worst);
+    return 0;
+}
+
+#define CREATE_RACE_THREADS 4
+
+static port_t create_race_ports[CREATE_RACE_THREADS];
+static event_t create_race_go;
+
+static int create_race_thread(void *arg)
+{
+    uint ix = (uint)(uintptr_t)arg;
+    event_wait(&create_race_go);
+    return port_create("race", PORT_MODE_UNICAST, &create_race_ports[ix]);
+}
+
+/* Several threads create the same port at once. Exactly one of them has to
+ * create it and the others all have to get that same port back.
+ */
+int create_race(void)
+{
+    thread_t *threads[CREATE_RACE_THREADS];
+
+    for (uint pass = 0; pass != 16; ++pass) {
+        event_init(&create_race_go, false, 0);
+        for (uint ix = 0; ix != CREATE_RACE_THREADS; ++ix) {
+            threads[ix] = thread_create("race", &create_race_thread,
+                                        (void *)(uintptr_t)ix,
+                                        DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+            thread_resume(threads[ix]);
+        }
+        event_signal(&create_race_go, true);
+
+        uint created = 0;
+        for (uint ix = 0; ix != CREATE_RACE_THREADS; ++ix) {
+            int retcode = -1;
+            thread_join(threads[ix], &retcode, INFINITE_TIME);
+            if (retcode == NO_ERROR) {
+                created++;
+            } else if (retcode != ERR_ALREADY_EXISTS) {
+                printf("unexpected create status %d\n", retcode);
+                return __LINE__;
+            }
+            if (create_race_ports[ix] != create_race_ports[0])
+                return __LINE__;
+        }
+        event_destroy(&create_race_go);
+
+        if (created != 1) {
+            printf("port created %u times\n", created);
+            return __LINE__;
+        }
+
+        if (port_close(create_race_ports[0]) < 0)
+            return __LINE__;
+        if (port_destroy(create_race_ports[0]) < 0)
+            return __LINE__;
+    }
+
+    printf("create_race : ok\n");
+    return 0;
+}
+
+#define MANY_PORTS 2048
+
+/* Resolves names with thousands of ports alive, which should cost about
+ * the same as with a few.
+ */
+int many_ports(void)
+{
+    port_t *ports = calloc(MANY_PORTS, sizeof(port_t));
+    if (!ports)
+        return __LINE__;
+
+    int ret = 0;
+    uint created = 0;
+    for (uint count = 8; count <= MANY_PORTS; count *= 4) {
+        for (; created != count; ++created) {
+            char name[PORT_NAME_LEN];
+            snprintf(name, sizeof(name), "many%u", created);
+            if (port_create(name, PORT_MODE_BROADCAST, &ports[created]) < 0) {
+                ret = __LINE__;
+                goto done;
+            }
+        }
+
+        // open and close a broadcast reader on a few ports.
+        const uint lookups = 256;
+        lk_time_ns_t t = current_time_ns();
+        for (uint ix = 0; ix != lookups; ++ix) {
+            char name[PORT_NAME_LEN];
+            snprintf(name, sizeof(name), "many%u", (ix * 7919) % count);
+            port_t r_port;
+            if (port_open(name, NULL, &r_port) < 0) {
+                ret = __LINE__;
+                goto done;
+            }
+            port_close(r_port);
+        }
+        t = current_time_ns() - t;
+
+        printf("many_ports: %u ports, %llu ns per open/close\n",
+               count, t / lookups);
+    }
+
+done:
+    for (uint ix = 0; ix != created; ++ix) {
+        port_close(ports[ix]);
+        port_destroy(ports[ix]);
+    }
+    free(ports);
+    return ret;
+}
+
+#define PORT_BENCH_PACKETS 20000
+
+static int bench_writer_thread(void *arg)
+{
+    port_t w_port = (port_t)arg;
+    port_packet_t pk = {{0}};
+
+    for (uint32_t ix = 0; ix != PORT_BENCH_PACKETS; ++ix) {
+        memcpy(pk.value, &ix, sizeof(ix));
+        status_t st;
+        // a full buffer fails the whole write; let the reader catch up.
+        while ((st = port_write(w_port, &pk, 1)) == ERR_PARTIAL_WRITE)
+            thread_yield();
+        if (st < 0) {
+            printf("bench writer: could not write port, status = %d\n", st);
+            return __LINE__;
+        }
+    }
+    return 0;
+}
+
+static int bench_reader_thread(void *arg)
+{
+    port_t r_port = (port_t)arg;
+    port_result_t pr;
+
+    for (uint32_t ix = 0; ix != PORT_BENCH_PACKETS; ++ix) {
+        status_t st = port_read(r_port, INFINITE_TIME, &pr);
+        if (st < 0) {
+            printf("bench reader: could not read port, status = %d\n", st);
+            return __LINE__;
+        }
+        uint32_t seq;
+        memcpy(&seq, pr.packet.value, sizeof(seq));
+        if (seq != ix) {
+            printf("bench reader: expected packet %u, got %u\n", ix, seq);
+            return __LINE__;
+        }
+    }
+    return 0;
+}
+
+/* Runs 1, 2, 4 ... writer/reader pairs, each pair on its own port, and
+ * reports the aggregate packet rate. Pairs never share a port so the rate
+ * should scale with the number of cpus.
+ */
+int multi_pair_bench(void)
+{
+    port_t w_ports[SMP_MAX_CPUS];
+    port_t r_ports[SMP_MAX_CPUS];
+    thread_t *threads[SMP_MAX_CPUS * 2];
+
+    for (uint pairs = 1; pairs <= SMP_MAX_CPUS; pairs *= 2) {
+        for (uint ix = 0; ix != pairs; ++ix) {
+            char name[PORT_NAME_LEN];
+            snprintf(name, sizeof(name), "bench%u", ix);
+            status_t st = port_create(name, PORT_MODE_UNICAST | PORT_MODE_BIG_BUFFER,
+                                      &w_ports[ix]);
+            if (st < 0)
+                return __LINE__;
+            st = port_open(name, NULL, &r_ports[ix]);
+            if (st < 0)
+                return __LINE__;
+        }
+
+        lk_time_ns_t t = current_time_ns();
+        for (uint ix = 0; ix != pairs; ++ix) {
+            threads[ix * 2] = thread_create("port bench w", &bench_writer_thread,
+                                            w_ports[ix], DEFAULT_PRIORITY,
+                                            DEFAULT_STACK_SIZE);
+            threads[ix * 2 + 1] = thread_create("port bench r", &bench_reader_thread,
+                                                r_ports[ix], DEFAULT_PRIORITY,
+                                                DEFAULT_STACK_SIZE);
+            thread_resume(threads[ix * 2]);
+            thread_resume(threads[ix * 2 + 1]);
+        }
+
+        int ret = 0;
+        for (uint ix = 0; ix != pairs * 2; ++ix) {
+            int retcode;
+            thread_join(threads[ix], &retcode, INFINITE_TIME);
+            ret = ret ?: retcode;
+        }
+        t = current_time_ns() - t;
+
+        for (uint ix = 0; ix != pairs; ++ix) {
+            port_close(r_ports[ix]);
+            port_close(w_ports[ix]);
+            port_destroy(w_ports[ix]);
+        }
+
+        if (ret) {
+            printf("child thread exited with %d\n", ret);
+            return __LINE__;
+        }
+
+        printf("multi_pair_bench: %u pairs moved %u packets each in %llu us, %llu packets/ms\n",
+               pairs, PORT_BENCH_PACKETS, t / 1000,
+               (uint64_t)pairs * PORT_BENCH_PACKETS * 1000000 / MAX(t, 1));
+    }
+
+    return 0;
+}
+
+#define STREAM_BATCH 32
+
+static int stream_writer_thread(void *arg)
+{
+    port_t w_port = (port_t)arg;
+    port_packet_t pk[4];
+
+    for (uint32_t ix = 0; ix != PORT_BENCH_PACKETS; ix += countof(pk)) {
+        for (uint32_t jx = 0; jx != countof(pk); ++jx) {
+            uint32_t seq = ix + jx;
+            memcpy(pk[jx].value, &seq, sizeof(seq));
+        }
+        // blocks instead of failing when the reader falls behind.
+        status_t st = port_write_etc(w_port, pk, countof(pk), INFINITE_TIME);
+        if (st < 0) {
+            printf("stream writer: could not write port, status = %d\n", st);
+            return __LINE__;
+        }
+    }
+    return 0;
+}
+
+/* Streams packets through a large ring with a blocking writer and a reader
+ * that drains up to STREAM_BATCH packets per wakeup.
+ */
+int stream_batched(void)
+{
+    port_t w_port, r_port;
+    status_t st = port_create_etc("stream", PORT_MODE_UNICAST, 12, &w_port);
+    if (st != ERR_INVALID_ARGS)
+        return __LINE__;
+    st = port_create_etc("stream", PORT_MODE_BROADCAST, 256, &w_port);
+    if (st != ERR_INVALID_ARGS)
+        return __LINE__;
+    st = port_create_etc("stream", PORT_MODE_UNICAST, 256, &w_port);
+    if (st < 0)
+        return __LINE__;
+
+    // the writer starts before there is a reader, it has to wait for one.
+    thread_t *t1 = thread_create("stream w", &stream_writer_thread, w_port,
+                                 DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(t1);
+    thread_sleep(10);
+
+    lk_time_ns_t t = current_time_ns();
+    st = port_open("stream", NULL, &r_port);
+    if (st < 0)
+        return __LINE__;
+
+    port_result_t pr[STREAM_BATCH];
+    uint32_t next = 0;
+    uint batches = 0;
+    while (next != PORT_BENCH_PACKETS) {
+        ssize_t read = port_read_many(r_port, 1000, pr, countof(pr));
+        if (read <= 0) {
+            printf("could not read port, status = %d\n", (int)read);
+            return __LINE__;
+        }
+        for (ssize_t ix = 0; ix != read; ++ix) {
+            uint32_t seq;
+            memcpy(&seq, pr[ix].packet.value, sizeof(seq));
+            if (seq != next++) {
+                printf("expected packet %u, got %u\n", next - 1, seq);
+                return __LINE__;
+            }
+        }
+        batches++;
+    }
+    t = current_time_ns() - t;
+
+    int retcode = -1;
+    thread_join(t1, &retcode, INFINITE_TIME);
+    if (retcode) {
+        printf("child thread exited with %d\n", retcode);
+        return __LINE__;
+    }
+
+    printf("stream_batched: %u packets in %u reads, %llu us, %llu messages/s\n",
+           next, batches, t / 1000, (uint64_t)next * 1000000000ULL / MAX(t, 1));
+
+    // a write to a full ring times out, and succeeds once there is room.
+    port_packet_t pk[8] = {{{0}}};
+    for (uint ix = 0; ix != 256 / countof(pk); ++ix) {
+        st = port_write(w_port, pk, countof(pk));
+        if (st < 0)
+            return __LINE__;
+    }
+    st = port_write_etc(w_port, pk, 1, 10);
+    if (st != ERR_TIMED_OUT)
+        return __LINE__;
+
+    ssize_t read = port_read_many(r_port, 0, pr, countof(pr));
+    if (read != countof(pr))
+        return __LINE__;
+    st = port_write_etc(w_port, pk, countof(pk), 10);
+    if (st < 0)
+        return __LINE__;
+
+    st = port_close(r_port);
+    if (st < 0)
+        return __LINE__;
+    st = port_close(w_port);
+    if (st < 0)
+        return __LINE__;
+    st = port_destroy(w_port);
+    if (st < 0)
+        return __LINE__;
+
+    return 0;
+}
+
+static int blocked_writer_thread(void *arg)
+{
+    port_t w_port = (port_t)arg;
+    port_packet_t pk = {{0}};
+
+    status_t st = port_write_etc(w_port, &pk, 1, INFINITE_TIME);
+    return st == ERR_CANCELLED ? 0 : __LINE__;
+}
+
+/* Closes and destroys a write port while a writer is blocked on it, first
+ * with no readers so it waits on the write port itself, then with a full
+ * read port. The writer has to fail without touching the freed port.
+ */
+int destroy_blocked_writer(void)
+{
+    for (int with_reader = 0; with_reader != 2; ++with_reader) {
+        port_t w_port, r_port = NULL;
+        status_t st = port_create("blocked_w", PORT_MODE_UNICAST, &w_port);
+        if (st < 0)
+            return __LINE__;
+        if (with_reader) {
+            st = port_open("blocked_w", NULL, &r_port);
+            if (st < 0)
+                return __LINE__;
+        }
+
+        port_packet_t pk = {{0}};
+        do {
+            st = port_write(w_port, &pk, 1);
+        } while (st == NO_ERROR);
+
+        thread_t *t1 = thread_create("blocked w", &blocked_writer_thread,
+                                     w_port, DEFAULT_PRIORITY,
+                                     DEFAULT_STACK_SIZE);
+        if (!t1)
+            return __LINE__;
+        thread_resume(t1);
+        thread_sleep(10);
+
+        st = port_close(w_port);
+        if (st < 0)
+            return __LINE__;
+        st = port_destroy(w_port);
+        if (st < 0)
+            return __LINE__;
+
+        int retcode = -1;
+        thread_join(t1, &retcode, INFINITE_TIME);
+        if (retcode) {
+            printf("blocked writer exited with %d\n", retcode);
+            return __LINE__;
+        }
+
+        if (r_port) {
+            st = port_close(r_port);
+            if (st < 0)
+                return __LINE__;
+        }
+    }
+    return 0;
+}
+
+#if WITH_KERNEL_VM
+#define SLICE_BENCH_ITER 32
+#define SLICE_BENCH_CBUF_SIZE (64 * 1024)
+
+// echoes every slice it gets on "slice_fwd" back on "slice_back", mapping
+// it and touching both ends on the way like a real receiver would.
+static int slice_echo_thread(void *arg)
+{
+    port_t w_port = (port_t)arg;
+    port_t r_port;
+    status_t st = port_open("slice_fwd", NULL, &r_port);
+    if (st < 0)
+        return __LINE__;
+
+    vmm_aspace_t *aspace = vmm_get_kernel_aspace();
+    while (true) {
+        struct vmm_obj_slice slice;
+        vmm_obj_slice_init(&slice);
+        st = port_read_slice(r_port, INFINITE_TIME, &slice, NULL);
+        if (st == ERR_CANCELLED)
+            break;
+        if (st < 0)
+            return __LINE__;
+
+        void *ptr;
+        st = vmm_alloc_obj(aspace, "slice bench", slice.obj, slice.offset,
+                           slice.size, &ptr, 0, 0,
+                           ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+        if (st < 0)
+            return __LINE__;
+        volatile uint8_t *bytes = ptr;
+        bytes[slice.size - 1] = bytes[0];
+        vmm_free_region(aspace, (vaddr_t)ptr);
+
+        st = port_write_slice(w_port, &slice, INFINITE_TIME);
+        if (st < 0)
+            return __LINE__;
+    }
+
+    port_close(r_port);
+    return 0;
+}
+
+static lk_time_ns_t bench_slice_handoff(void *buf, size_t size)
+{
+    vmm_aspace_t *aspace = vmm_get_kernel_aspace();
+    lk_time_ns_t t = 0;
+    port_t fwd_w, back_w, back_r;
+    thread_t *echo = NULL;
+    struct vmm_obj_slice slice;
+    vmm_obj_slice_init(&slice);
+
+    if (port_create("slice_fwd", PORT_MODE_UNICAST | PORT_MODE_SLICE, &fwd_w) < 0)
+        return 0;
+    if (port_create("slice_back", PORT_MODE_UNICAST | PORT_MODE_SLICE, &back_w) < 0)
+        goto err_back;
+    if (port_open("slice_back", NULL, &back_r) < 0)
+        goto err_open;
+    if (vmm_get_obj(aspace, (vaddr_t)buf, size, &slice) < 0)
+        goto err_obj;
+
+    echo = thread_create("slice echo", &slice_echo_thread, back_w,
+                         DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(echo);
+
+    t = current_time_ns();
+    for (uint ix = 0; ix != SLICE_BENCH_ITER; ++ix) {
+        if (port_write_slice(fwd_w, &slice, INFINITE_TIME) < 0 ||
+                port_read_slice(back_r, INFINITE_TIME, &slice, NULL) < 0) {
+            t = 0;
+            break;
+        }
+    }
+    if (t)
+        t = current_time_ns() - t;
+
+err_obj:
+    port_close(back_r);
+err_open:
+    port_close(back_w);
+    port_destroy(back_w);
+err_back:
+    // destroying the forward port cancels the echo thread's read.
+    port_close(fwd_w);
+    port_destroy(fwd_w);
+    if (echo) {
+        int retcode;
+        thread_join(echo, &retcode, INFINITE_TIME);
+        if (retcode)
+            t = 0;
+    }
+    vmm_obj_slice_release(&slice);
+    return t;
+}
+
+struct cbuf_bench_args {
+    cbuf_t *cbuf;
+    const uint8_t *src;
+    size_t size;
+};
+
+static int cbuf_bench_writer(void *arg)
+{
+    struct cbuf_bench_args *args = arg;
+
+    for (uint ix = 0; ix != SLICE_BENCH_ITER * 2; ++ix) {
+        size_t done = 0;
+        while (done != args->size) {
+            size_t written = cbuf_write(args->cbuf, args->src + done,
+                                        args->size - done, true);
+            if (!written)
+                thread_yield();
+            done += written;
+        }
+    }
+    return 0;
+}
+
+static lk_time_ns_t bench_cbuf_copy(void *src, void *dst, size_t size)
+{
+    cbuf_t cbuf;
+    cbuf_initialize(&cbuf, SLICE_BENCH_CBUF_SIZE);
+    struct cbuf_bench_args args = { &cbuf, src, size };
+
+    // as many bytes as the slice bench moves, which makes a round trip.
+    lk_time_ns_t t = current_time_ns();
+    thread_t *writer = thread_create("cbuf bench", &cbuf_bench_writer, &args,
+                                     DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(writer);
+    for (uint ix = 0; ix != SLICE_BENCH_ITER * 2; ++ix) {
+        size_t done = 0;
+        while (done != size) {
+            done += cbuf_read(&cbuf, (uint8_t *)dst + done, size - done, true);
+        }
+    }
+    thread_join(writer, NULL, INFINITE_TIME);
+    t = current_time_ns() - t;
+
+    free(cbuf.buf);
+    return t;
+}
+
+/* Moves 64KB to 4MB payloads between two threads, once by handing off the
+ * pages through slice ports and once by copying them through a cbuf.
+ */
+int slice_bench(void)
+{
+    vmm_aspace_t *aspace = vmm_get_kernel_aspace();
+    const size_t max_size = 4 * 1024 * 1024;
+    void *src = NULL;
+    void *dst = NULL;
+    int ret = 0;
+
+    if (vmm_alloc(aspace, "slice bench src", max_size, &src, 0, 0,
+                  ARCH_MMU_FLAG_PERM_NO_EXECUTE) < 0 ||
+            vmm_alloc(aspace, "slice bench dst", max_size, &dst, 0, 0,
+                      ARCH_MMU_FLAG_PERM_NO_EXECUTE) < 0) {
+        printf("slice_bench: could not allocate buffers\n");
+        ret = __LINE__;
+        goto done;
+    }
+    memset(src, 0x5a, max_size);
+
+    for (size_t size = 64 * 1024; size <= max_size; size *= 4) {
+        lk_time_ns_t slice_t = bench_slice_handoff(src, size);
+        if (!slice_t) {
+            ret = __LINE__;
+            goto done;
+        }
+        lk_time_ns_t cbuf_t = bench_cbuf_copy(src, dst, size);
+        if (memcmp(src, dst, size)) {
+            ret = __LINE__;
+            goto done;
+        }
+
+        uint64_t bytes = (uint64_t)size * SLICE_BENCH_ITER * 2;
+        printf("slice_bench: %zu KB, slice %llu MB/s, cbuf copy %llu MB/s\n",
+               size / 1024, bytes * 1000 / MAX(slice_t, 1),
+               bytes * 1000 / MAX(cbuf_t, 1));
+    }
+
+done:
+    if (dst)
+        vmm_free_region(aspace, (vaddr_t)dst);
+    if (src)
+        vmm_free_region(aspace, (vaddr_t)src);
+    return ret;
+}
+#endif
+
 #define RUN_TEST(t)  result = t(); if (result) goto fail
 
 int port_tests(void)
@@ -742,6 +1466,17 @@ int port_tests(void)
         RUN_TEST(group_dynamic);
     }
 
+    RUN_TEST(create_race);
+    RUN_TEST(many_ports);
+    RUN_TEST(group_fairness);
+    RUN_TEST(group_latency);
+    RUN_TEST(stream_batched);
+    RUN_TEST(destroy_blocked_writer);
+#if WITH_KERNEL_VM
+    RUN_TEST(slice_bench);
+#endif
+    RUN_TEST(multi_pair_bench);
+
     printf("all tests passed\n");
     return 0;
 fail:
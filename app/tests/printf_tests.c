@@ -24,6 +24,32 @@
 #include <stdio.h>
 #include <string.h>
 #include <debug.h>
+#include <platform.h>
+
+#define PRINTF_SPEED_ITER 10000
+
+#define PRINTF_SPEED(name, fmt, ...) do { \
+        char __buf[128]; \
+        size_t __bytes = 0; \
+        lk_time_ns_t __t = current_time_ns(); \
+        for (uint __i = 0; __i < PRINTF_SPEED_ITER; __i++) \
+            __bytes += snprintf(__buf, sizeof(__buf), fmt, __VA_ARGS__); \
+        __t = current_time_ns() - __t; \
+        printf("%-10s %6llu ns/call, %8llu bytes/sec\n", name, \
+               __t / PRINTF_SPEED_ITER, (uint64_t)__bytes * 1000000000 / MAX(__t, 1)); \
+    } while (0)
+
+/* snprintf throughput for a few typical formats */
+static void printf_speed_tests(void)
+{
+    printf("printf speed:\n");
+    PRINTF_SPEED("literal", "%s", "a log line made of a single literal string\n");
+    PRINTF_SPEED("ints", "%d %d %d %d %d %d\n", 1, -12, 123, -1234, 12345678, -123456789);
+    PRINTF_SPEED("longlong", "%llu %lld\n", 12345678901234567ULL, -1234567890123LL);
+    PRINTF_SPEED("hex", "%08x %#lx %p\n", 0xabcdefU, 0x12345678UL, (void *)&printf_speed_tests);
+    PRINTF_SPEED("padded", "%-20s|%20s|%010d\n", "left", "right", 42);
+    PRINTF_SPEED("log", "thread %u: addr 0x%lx size %zu name %s\n", 17U, 0x80001000UL, (size_t)4096, "worker");
+}
 
 void printf_tests(void)
 {
@@ -116,6 +142,8 @@ void printf_tests(void)
     err = snprintf(buf, 15, "0123456789abcdef012345678");
     printf("snprintf returns %d\n", err);
     hexdump8(buf, sizeof(buf));
+
+    printf_speed_tests();
 }
 
 #include "float_test_vec.c"
@@ -16,6 +16,13 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/tests.c \
     $(LOCAL_DIR)/thread_tests.c \
     $(LOCAL_DIR)/port_tests.c \
+    $(LOCAL_DIR)/slab_tests.c \
+    $(LOCAL_DIR)/vmm_tests.c \
+
+ifeq ($(WITH_CPP_SUPPORT),true)
+MODULE_SRCS += \
+    $(LOCAL_DIR)/new_tests.cpp
+endif
 
 MODULE_ARM_OVERRIDE_SRCS := \
 
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <app/tests.h>
+#include <err.h>
+#include <kernel/thread.h>
+#include <lib/slab.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_TEST_MAGIC 0x736c6162 /* 'slab' */
+#define SLAB_TEST_OBJS 1000
+#define SLAB_STRESS_ITER 20000
+#define SLAB_STRESS_SLOTS 64
+
+struct slab_test_obj {
+    uint32_t magic;
+    uint32_t index;
+    uint64_t payload;
+};
+
+static void slab_test_ctor(void *obj)
+{
+    struct slab_test_obj *o = obj;
+    o->magic = SLAB_TEST_MAGIC;
+    o->index = 0;
+}
+
+static int slab_test_basic(void)
+{
+    struct slab_test_obj **objs;
+    struct kmem_cache *cache;
+    int ret = NO_ERROR;
+
+    cache = kmem_cache_create("slab_test", sizeof(struct slab_test_obj), 32,
+                              slab_test_ctor);
+    objs = calloc(SLAB_TEST_OBJS, sizeof(*objs));
+    if (!cache || !objs) {
+        printf("out of memory\n");
+        ret = ERR_NO_MEMORY;
+        goto err;
+    }
+
+    for (uint i = 0; i < SLAB_TEST_OBJS; i++) {
+        objs[i] = kmem_cache_alloc(cache);
+        if (!objs[i]) {
+            printf("kmem_cache_alloc failed at %u\n", i);
+            ret = ERR_NO_MEMORY;
+            goto err;
+        }
+        if ((uintptr_t)objs[i] % 32) {
+            printf("object %p is misaligned\n", objs[i]);
+            ret = ERR_GENERIC;
+            goto err;
+        }
+        if (objs[i]->magic != SLAB_TEST_MAGIC || objs[i]->index) {
+            printf("object %p was not constructed\n", objs[i]);
+            ret = ERR_GENERIC;
+            goto err;
+        }
+        objs[i]->index = i + 1;
+        objs[i]->payload = ~(uint64_t)i;
+    }
+
+    /* overlapping objects would have overwritten each other */
+    for (uint i = 0; i < SLAB_TEST_OBJS; i++) {
+        if (objs[i]->index != i + 1 || objs[i]->payload != ~(uint64_t)i) {
+            printf("object %p overlaps another object\n", objs[i]);
+            ret = ERR_GENERIC;
+            goto err;
+        }
+        /* return objects in constructed state */
+        objs[i]->index = 0;
+    }
+    printf("%u objects used %zu slabs\n", SLAB_TEST_OBJS, cache->slab_count);
+
+    for (uint i = 0; i < SLAB_TEST_OBJS; i++) {
+        kmem_cache_free(cache, objs[i]);
+        objs[i] = NULL;
+    }
+
+    /* the constructed state survives a trip through the free list */
+    for (uint i = 0; i < SLAB_TEST_OBJS; i++) {
+        objs[i] = kmem_cache_alloc(cache);
+        if (!objs[i] || objs[i]->magic != SLAB_TEST_MAGIC || objs[i]->index) {
+            printf("object %p lost its constructed state\n", objs[i]);
+            ret = ERR_GENERIC;
+            goto err;
+        }
+    }
+
+err:
+    if (cache) {
+        for (uint i = 0; objs && i < SLAB_TEST_OBJS; i++) {
+            kmem_cache_free(cache, objs[i]);
+        }
+        kmem_cache_trim(cache);
+        if (!ret && (cache->slab_count || cache->objs_out)) {
+            printf("trim left %zu slabs, %zu objects\n", cache->slab_count,
+                   cache->objs_out);
+            ret = ERR_GENERIC;
+        }
+        kmem_cache_destroy(cache);
+    }
+    free(objs);
+    return ret;
+}
+
+static int slab_test_heap_backed(void)
+{
+    struct kmem_cache *cache;
+    void *objs[8];
+    int ret = NO_ERROR;
+
+    /* objects this big don't fit enough per page and come from the heap */
+    cache = kmem_cache_create("slab_test_big", PAGE_SIZE / 2, 0, NULL);
+    if (!cache) {
+        return ERR_NO_MEMORY;
+    }
+
+    for (uint i = 0; i < countof(objs); i++) {
+        objs[i] = kmem_cache_zalloc(cache);
+        if (!objs[i]) {
+            ret = ERR_NO_MEMORY;
+            continue;
+        }
+        for (size_t j = 0; j < cache->size; j++) {
+            if (((uint8_t *)objs[i])[j]) {
+                printf("object %p is not zeroed\n", objs[i]);
+                ret = ERR_GENERIC;
+                break;
+            }
+        }
+        memset(objs[i], 0xa5, cache->size);
+    }
+    for (uint i = 0; i < countof(objs); i++) {
+        kmem_cache_free(cache, objs[i]);
+    }
+    kmem_cache_destroy(cache);
+    return ret;
+}
+
+static int slab_stress_thread(void *arg)
+{
+    struct kmem_cache *cache = arg;
+    uint64_t *slots[SLAB_STRESS_SLOTS] = { 0 };
+    uint64_t tag = (uintptr_t)get_current_thread() << 16;
+    int ret = NO_ERROR;
+
+    for (uint i = 0; i < SLAB_STRESS_ITER; i++) {
+        uint slot = (i * 7) % SLAB_STRESS_SLOTS;
+        if (slots[slot]) {
+            if (*slots[slot] != (tag | slot)) {
+                printf("object %p corrupted\n", slots[slot]);
+                ret = ERR_GENERIC;
+                break;
+            }
+            kmem_cache_free(cache, slots[slot]);
+        }
+        slots[slot] = kmem_cache_alloc(cache);
+        if (!slots[slot]) {
+            ret = ERR_NO_MEMORY;
+            break;
+        }
+        *slots[slot] = tag | slot;
+    }
+    for (uint i = 0; i < SLAB_STRESS_SLOTS; i++) {
+        kmem_cache_free(cache, slots[i]);
+    }
+    return ret;
+}
+
+static int slab_test_stress(void)
+{
+    thread_t *threads[SMP_MAX_CPUS];
+    struct kmem_cache *cache;
+    int ret = NO_ERROR;
+    uint started;
+
+    cache = kmem_cache_create("slab_stress", 48, 0, NULL);
+    if (!cache) {
+        return ERR_NO_MEMORY;
+    }
+
+    for (started = 0; started < SMP_MAX_CPUS; started++) {
+        threads[started] = thread_create("slab_stress", slab_stress_thread,
+                                         cache, DEFAULT_PRIORITY,
+                                         DEFAULT_STACK_SIZE);
+        if (!threads[started]) {
+            printf("failed to create thread\n");
+            ret = ERR_NO_MEMORY;
+            break;
+        }
+        thread_resume(threads[started]);
+    }
+    for (uint i = 0; i < started; i++) {
+        int retcode;
+        thread_join(threads[i], &retcode, INFINITE_TIME);
+        if (retcode) {
+            ret = retcode;
+        }
+    }
+
+    kmem_cache_trim(cache);
+    if (!ret && (cache->slab_count || cache->objs_out)) {
+        printf("trim left %zu slabs, %zu objects\n", cache->slab_count,
+               cache->objs_out);
+        ret = ERR_GENERIC;
+    }
+    kmem_cache_destroy(cache);
+    return ret;
+}
+
+int slab_tests(void)
+{
+    int ret;
+
+    printf("testing kmem caches\n");
+
+    ret = slab_test_basic();
+    if (!ret) {
+        ret = slab_test_heap_backed();
+    }
+    if (!ret) {
+        ret = slab_test_stress();
+    }
+
+    printf("slab tests %s\n", ret ? "FAILED" : "passed");
+    return ret;
+}
@@ -33,11 +33,15 @@ STATIC_COMMAND("printf_tests", "test printf", (console_cmd)&printf_tests)
 STATIC_COMMAND("printf_tests_float", "test printf with floating point", (console_cmd)&printf_tests_float)
 STATIC_COMMAND("thread_tests", "test the scheduler", (console_cmd)&thread_tests)
 STATIC_COMMAND("port_tests", "test the ports", (console_cmd)&port_tests)
+STATIC_COMMAND("slab_tests", "test the slab allocator", (console_cmd)&slab_tests)
 STATIC_COMMAND("clock_tests", "test clocks", (console_cmd)&clock_tests)
 STATIC_COMMAND("bench", "miscellaneous benchmarks", (console_cmd)&benchmarks)
 STATIC_COMMAND("fibo", "threaded fibonacci", (console_cmd)&fibo)
 STATIC_COMMAND("spinner", "create a spinning thread", (console_cmd)&spinner)
 STATIC_COMMAND("cbuf_tests", "test lib/cbuf", &cbuf_tests)
+#if WITH_KERNEL_VM
+STATIC_COMMAND("vmm_tests", "test concurrent use of the vmm", (console_cmd)&vmm_tests)
+#endif
 STATIC_COMMAND_END(tests);
 
 #endif
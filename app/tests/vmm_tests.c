@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <app/tests.h>
+#include <err.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm_obj.h>
+#include <platform.h>
+#include <stdio.h>
+
+#if WITH_KERNEL_VM
+
+#define VMM_STRESS_ITERATIONS 500
+#define VMM_STRESS_REGIONS 8
+
+/*
+ * Each thread maps and unmaps memory in an address space of its own, so with
+ * per-aspace locking the threads should not serialize on each other.
+ */
+static int vmm_stress_thread(void *arg)
+{
+    uint32_t pattern = (uintptr_t)arg;
+    void *ptrs[VMM_STRESS_REGIONS];
+    vmm_aspace_t *aspace;
+    status_t ret;
+
+    ret = vmm_create_aspace(&aspace, "vmm_stress", 0);
+    if (ret) {
+        printf("vmm_create_aspace failed: %d\n", ret);
+        return ret;
+    }
+    vmm_set_active_aspace(aspace);
+
+    for (uint iter = 0; iter < VMM_STRESS_ITERATIONS; iter++) {
+        for (uint i = 0; i < VMM_STRESS_REGIONS; i++) {
+            /* odd regions are lazy so the fault path runs concurrently too */
+            uint vmm_flags = (i & 1) ? VMM_FLAG_LAZY : 0;
+            ret = vmm_alloc(aspace, "vmm_stress", (i + 1) * PAGE_SIZE,
+                            &ptrs[i], 0, vmm_flags,
+                            ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+            if (ret) {
+                printf("vmm_alloc failed: %d\n", ret);
+                goto err;
+            }
+            *(volatile uint32_t *)ptrs[i] = pattern + i;
+        }
+        for (uint i = 0; i < VMM_STRESS_REGIONS; i++) {
+            if (*(volatile uint32_t *)ptrs[i] != pattern + i) {
+                printf("region %p corrupted\n", ptrs[i]);
+                ret = ERR_GENERIC;
+                goto err;
+            }
+            ret = vmm_free_region(aspace, (vaddr_t)ptrs[i]);
+            if (ret) {
+                printf("vmm_free_region failed: %d\n", ret);
+                goto err;
+            }
+        }
+    }
+
+err:
+    vmm_set_active_aspace(NULL);
+    vmm_free_aspace(aspace);
+    return ret;
+}
+
+static int vmm_stress_test(uint thread_count)
+{
+    thread_t *threads[SMP_MAX_CPUS];
+    int ret = NO_ERROR;
+    uint started;
+
+    lk_time_ns_t t = current_time_ns();
+    for (started = 0; started < thread_count; started++) {
+        threads[started] = thread_create("vmm_stress", vmm_stress_thread,
+                                         (void *)(uintptr_t)(started << 16),
+                                         DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        if (!threads[started]) {
+            printf("failed to create thread\n");
+            ret = ERR_NO_MEMORY;
+            break;
+        }
+        thread_resume(threads[started]);
+    }
+    for (uint i = 0; i < started; i++) {
+        int retcode;
+        thread_join(threads[i], &retcode, INFINITE_TIME);
+        if (retcode) {
+            ret = retcode;
+        }
+    }
+    t = current_time_ns() - t;
+    if (ret) {
+        return ret;
+    }
+
+    printf("%u threads did %u map/unmap pairs each in %llu us\n",
+           thread_count, VMM_STRESS_ITERATIONS * VMM_STRESS_REGIONS,
+           t / 1000);
+    return ret;
+}
+
+#define SHRINK_TEST_PAGES 8
+
+static void *shrink_test_pages[SHRINK_TEST_PAGES];
+static volatile uint shrink_test_held;
+
+static size_t shrink_test_shrink(struct vm_shrinker *shrinker, size_t count)
+{
+    size_t freed = 0;
+    while (shrink_test_held && freed < count) {
+        pmm_free_kpages(shrink_test_pages[--shrink_test_held], 1);
+        freed++;
+    }
+    return freed;
+}
+
+static struct vm_shrinker shrink_test_shrinker =
+    VM_SHRINKER_INITIAL_VALUE("shrink_test", shrink_test_shrink);
+
+static int shrink_test_fill(void)
+{
+    while (shrink_test_held < SHRINK_TEST_PAGES) {
+        void *page = pmm_alloc_kpages(1, NULL);
+        if (!page) {
+            printf("pmm_alloc_kpages failed\n");
+            return ERR_NO_MEMORY;
+        }
+        shrink_test_pages[shrink_test_held++] = page;
+    }
+    return NO_ERROR;
+}
+
+static int shrink_test(void)
+{
+    int ret;
+
+    vm_register_shrinker(&shrink_test_shrinker);
+
+    /* more than the other shrinkers can free, so ours gets called */
+    ret = shrink_test_fill();
+    if (!ret) {
+        size_t freed = vm_shrink(pmm_page_count());
+        if (freed < SHRINK_TEST_PAGES || shrink_test_held) {
+            printf("vm_shrink freed %zu pages, %u still held\n", freed,
+                   shrink_test_held);
+            ret = ERR_GENERIC;
+        }
+    }
+
+    /*
+     * Raise the low watermark above the free count, the next allocation
+     * should wake the shrinker thread. The high watermark can't be reached,
+     * so the thread keeps going until every shrinker is out of pages.
+     */
+    if (!ret) {
+        ret = shrink_test_fill();
+    }
+    if (!ret) {
+        size_t low, high;
+        vm_get_watermarks(&low, &high);
+        vm_set_watermarks(pmm_free_page_count() + 1, pmm_page_count());
+        void *page = pmm_alloc_kpages(1, NULL);
+        for (uint i = 0; i < 100 && shrink_test_held; i++) {
+            thread_sleep(10);
+        }
+        if (shrink_test_held) {
+            printf("shrinker thread did not run, %u pages still held\n",
+                   shrink_test_held);
+            ret = ERR_GENERIC;
+        }
+        pmm_free_kpages(page, 1);
+        vm_set_watermarks(low, high);
+    }
+
+    vm_unregister_shrinker(&shrink_test_shrinker);
+    shrink_test_shrink(&shrink_test_shrinker, SHRINK_TEST_PAGES);
+    return ret;
+}
+
+#define COW_TEST_PAGES 2
+#define COW_TEST_WORDS (COW_TEST_PAGES * PAGE_SIZE / sizeof(uint32_t))
+#define COW_TEST_PAGE_WORDS (PAGE_SIZE / sizeof(uint32_t))
+
+static int cow_test_check(const char *name, void *ptr, uint page,
+                          uint32_t expected)
+{
+    volatile uint32_t *p = (volatile uint32_t *)ptr + page * COW_TEST_PAGE_WORDS;
+
+    for (uint i = 0; i < COW_TEST_PAGE_WORDS; i++) {
+        if (p[i] != expected + i) {
+            printf("%s page %u word %u is 0x%x, expected 0x%x\n", name, page,
+                   i, p[i], expected + i);
+            return ERR_GENERIC;
+        }
+    }
+    return NO_ERROR;
+}
+
+static void cow_test_fill(void *ptr, uint page, uint32_t value)
+{
+    volatile uint32_t *p = (volatile uint32_t *)ptr + page * COW_TEST_PAGE_WORDS;
+
+    for (uint i = 0; i < COW_TEST_PAGE_WORDS; i++) {
+        p[i] = value + i;
+    }
+}
+
+/*
+ * Map a copy-on-write object twice and write through both mappings. The
+ * parent must never change and both mappings, plus any made later, must see
+ * the same private copies.
+ */
+static int cow_test(void)
+{
+    vmm_aspace_t *aspace = vmm_get_kernel_aspace();
+    struct vmm_obj *parent;
+    struct obj_ref parent_ref = OBJ_REF_INITIAL_VALUE(parent_ref);
+    struct vmm_obj *cow;
+    struct obj_ref cow_ref = OBJ_REF_INITIAL_VALUE(cow_ref);
+    void *parent_ptr = NULL;
+    void *a = NULL;
+    void *b = NULL;
+    void *c = NULL;
+    int ret;
+
+    ret = pmm_alloc(&parent, &parent_ref, COW_TEST_PAGES, 0, 0);
+    if (ret) {
+        printf("pmm_alloc failed: %d\n", ret);
+        return ret;
+    }
+    ret = vmm_alloc_obj(aspace, "cow_parent", parent, 0,
+                        COW_TEST_PAGES * PAGE_SIZE, &parent_ptr, 0, 0,
+                        ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (ret) {
+        printf("vmm_alloc_obj parent failed: %d\n", ret);
+        goto err_map_parent;
+    }
+    for (uint page = 0; page < COW_TEST_PAGES; page++) {
+        cow_test_fill(parent_ptr, page, 0x10000 * (page + 1));
+    }
+
+    ret = vmm_cow_obj_create(parent, 0, COW_TEST_PAGES * PAGE_SIZE, &cow,
+                             &cow_ref);
+    if (ret) {
+        printf("vmm_cow_obj_create failed: %d\n", ret);
+        goto err_cow_create;
+    }
+    ret = vmm_alloc_obj(aspace, "cow_a", cow, 0, COW_TEST_PAGES * PAGE_SIZE,
+                        &a, 0, 0, ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (ret) {
+        printf("vmm_alloc_obj a failed: %d\n", ret);
+        goto err;
+    }
+    ret = vmm_alloc_obj(aspace, "cow_b", cow, 0, COW_TEST_PAGES * PAGE_SIZE,
+                        &b, 0, VMM_FLAG_LAZY, ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (ret) {
+        printf("vmm_alloc_obj b failed: %d\n", ret);
+        goto err;
+    }
+
+    /* both mappings share the parent pages until written */
+    for (uint page = 0; page < COW_TEST_PAGES; page++) {
+        ret = cow_test_check("a", a, page, 0x10000 * (page + 1));
+        ret = ret ?: cow_test_check("b", b, page, 0x10000 * (page + 1));
+        if (ret) {
+            goto err;
+        }
+    }
+
+    /* page 0 is copied by a write through a, page 1 through b */
+    cow_test_fill(a, 0, 0xa0000);
+    cow_test_fill(b, 1, 0xb0000);
+
+    ret = cow_test_check("parent", parent_ptr, 0, 0x10000);
+    ret = ret ?: cow_test_check("parent", parent_ptr, 1, 0x20000);
+    ret = ret ?: cow_test_check("a", a, 0, 0xa0000);
+    ret = ret ?: cow_test_check("a", a, 1, 0xb0000);
+    ret = ret ?: cow_test_check("b", b, 0, 0xa0000);
+    ret = ret ?: cow_test_check("b", b, 1, 0xb0000);
+    if (ret) {
+        goto err;
+    }
+
+    /* writing a private page again must not copy it a second time */
+    cow_test_fill(b, 0, 0xc0000);
+    ret = cow_test_check("a", a, 0, 0xc0000);
+    ret = ret ?: cow_test_check("parent", parent_ptr, 0, 0x10000);
+    if (ret) {
+        goto err;
+    }
+
+    /* a new mapping sees the private copies too */
+    ret = vmm_alloc_obj(aspace, "cow_c", cow, 0, COW_TEST_PAGES * PAGE_SIZE,
+                        &c, 0, 0, ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (ret) {
+        printf("vmm_alloc_obj c failed: %d\n", ret);
+        goto err;
+    }
+    ret = cow_test_check("c", c, 0, 0xc0000);
+    ret = ret ?: cow_test_check("c", c, 1, 0xb0000);
+
+err:
+    if (c) {
+        vmm_free_region(aspace, (vaddr_t)c);
+    }
+    if (b) {
+        vmm_free_region(aspace, (vaddr_t)b);
+    }
+    if (a) {
+        vmm_free_region(aspace, (vaddr_t)a);
+    }
+    vmm_obj_del_ref(cow, &cow_ref);
+err_cow_create:
+    vmm_free_region(aspace, (vaddr_t)parent_ptr);
+err_map_parent:
+    vmm_obj_del_ref(parent, &parent_ref);
+    return ret;
+}
+
+int vmm_tests(void)
+{
+    int ret;
+
+    printf("testing concurrent map/unmap in independent address spaces\n");
+
+    ret = vmm_stress_test(1);
+    if (!ret && SMP_MAX_CPUS > 1) {
+        ret = vmm_stress_test(SMP_MAX_CPUS);
+    }
+
+    if (!ret) {
+        printf("testing shrinkers\n");
+        ret = shrink_test();
+    }
+
+    if (!ret) {
+        printf("testing copy-on-write mappings\n");
+        ret = cow_test();
+    }
+
+    printf("vmm tests %s\n", ret ? "FAILED" : "passed");
+    return ret;
+}
+
+#endif
@@ -253,6 +253,67 @@ static void dump_iframe(const struct arm64_iframe_long *iframe)
 #endif
 }
 
+#if WITH_KERNEL_VM
+/**
+ * arm64_handle_demand_page() - Try to resolve an abort by mapping a lazy or
+ *                              copy-on-write page
+ * @iframe:     Register state at the time of the abort.
+ * @ec:         Exception class of the abort.
+ * @iss:        Instruction specific syndrome of the abort.
+ * @from_lower: Whether the abort was taken from a lower exception level.
+ *
+ * Resolving the fault can block, so it is only attempted if the faulting
+ * code had interrupts enabled, and interrupts are enabled again meanwhile.
+ *
+ * Return: %true if the faulting instruction can be restarted.
+ */
+static bool arm64_handle_demand_page(struct arm64_iframe_long *iframe,
+                                     uint32_t ec, uint32_t iss,
+                                     bool from_lower) {
+    uint pf_flags = 0;
+    status_t ret;
+    uint32_t fsc_type = BITS(iss, 5, 0) & ~0x3U;
+
+    if (ec == 0b100100 || ec == 0b100101) {
+        /* WnR is also set for cache maintenance, which is fine here */
+        if (BIT(iss, 6)) {
+            pf_flags |= VMM_PF_FLAG_WRITE;
+        }
+    } else {
+        pf_flags |= VMM_PF_FLAG_INSTRUCTION;
+    }
+
+    /*
+     * Translation faults can be caused by a lazy mapping, write permission
+     * faults by a read-only copy-on-write mapping.
+     */
+    if (fsc_type != 0b000100 &&
+        !(fsc_type == 0b001100 && (pf_flags & VMM_PF_FLAG_WRITE))) {
+        return false;
+    }
+    if (from_lower) {
+        pf_flags |= VMM_PF_FLAG_USER;
+    }
+    /* PSTATE.I of the faulting code */
+    if (iframe->spsr & (1 << 7)) {
+        return false;
+    }
+
+    vaddr_t far = ARM64_READ_SYSREG(far_el1);
+    arch_enable_ints();
+    ret = vmm_handle_page_fault(far, pf_flags);
+    arch_disable_ints();
+
+    return ret == NO_ERROR;
+}
+#else
+static bool arm64_handle_demand_page(struct arm64_iframe_long *iframe,
+                                     uint32_t ec, uint32_t iss,
+                                     bool from_lower) {
+    return false;
+}
+#endif
+
 __WEAK void arm64_syscall(struct arm64_iframe_long *iframe, bool is_64bit)
 {
     panic("unhandled syscall vector\n");
@@ -372,6 +433,9 @@ void arm64_sync_exception(struct arm64_iframe_long *iframe, bool from_lower)
 #endif
         case 0b100000: /* instruction abort from lower level */
         case 0b100001: /* instruction abort from same level */
+            if (arm64_handle_demand_page(iframe, ec, iss, from_lower)) {
+                return;
+            }
             if (check_fault_handler_table(iframe)) {
                 return;
             }
@@ -381,6 +445,9 @@ void arm64_sync_exception(struct arm64_iframe_long *iframe, bool from_lower)
             break;
         case 0b100100: /* data abort from lower level */
         case 0b100101: { /* data abort from same level */
+            if (arm64_handle_demand_page(iframe, ec, iss, from_lower)) {
+                return;
+            }
             if (check_fault_handler_table(iframe)) {
                 return;
             }
@@ -345,10 +345,209 @@ static bool page_table_is_clear(pte_t *page_table, uint page_size_shift)
     return true;
 }
 
+/*
+ * Without FEAT_TLBIRANGE, invalidate the whole ASID (or all global entries)
+ * instead of issuing more than this many TLBI instructions, one per cleared
+ * page or block entry.
+ */
+#define ARM64_TLBI_MAX_PAGES (64)
+
+/* TLBI R*E1IS encodings, spelled out since they need an ARMv8.4 assembler */
+#define ARM64_TLBI_RVAE1IS(val) \
+    __asm__ volatile("sys #0, c8, c2, #1, %0" :: "r" (val))
+#define ARM64_TLBI_RVAAE1IS(val) \
+    __asm__ volatile("sys #0, c8, c2, #3, %0" :: "r" (val))
+
+/**
+ * struct arm64_tlbi_batch - Pending TLB invalidation for an unmap operation
+ * @asid:        ASID of the mappings, or MMU_ARM64_GLOBAL_ASID.
+ * @vaddr:       Start of the pending virtual address range.
+ * @size:        Size of the pending range in bytes, 0 if nothing is pending.
+ * @entry_size:  Size of each cleared entry, %PAGE_SIZE or a block size.
+ * @entries:     Number of cleared entries in the pending range.
+ * @free_tables: Page tables to free once the TLB no longer references them.
+ *
+ * arm64_mmu_unmap_pt() collects contiguous unmapped ranges here instead of
+ * invalidating each page as it is cleared. arm64_tlbi_batch_finish() issues
+ * the invalidation followed by a single DSB. A block entry only needs one
+ * TLBI, so the range only mixes entries of the same size.
+ */
+struct arm64_tlbi_batch {
+    uint asid;
+    vaddr_t vaddr;
+    size_t size;
+    size_t entry_size;
+    size_t entries;
+    struct list_node free_tables;
+};
+
+static void arm64_tlbi_batch_init(struct arm64_tlbi_batch *batch, uint asid)
+{
+    batch->asid = asid;
+    batch->vaddr = 0;
+    batch->size = 0;
+    batch->entry_size = 0;
+    batch->entries = 0;
+    list_initialize(&batch->free_tables);
+}
+
+/* Invalidate the TLB entry covering @va */
+static void arm64_tlbi_va(struct arm64_tlbi_batch *batch, vaddr_t va,
+                          uint64_t asid_bits)
+{
+    if (batch->asid == MMU_ARM64_GLOBAL_ASID) {
+        __asm__ volatile("tlbi vaae1is, %0" :: "r" (va >> 12));
+    } else {
+        __asm__ volatile("tlbi vae1is, %0" :: "r" (va >> 12 | asid_bits));
+    }
+}
+
+static bool arm64_has_tlbi_range(void)
+{
+    static int tlbi_range = -1;
+
+    if (tlbi_range < 0) {
+        /* ID_AA64ISAR0_EL1.TLB == 0b0010: TLBI outer shareable and range */
+        uint64_t isar0 = ARM64_READ_SYSREG(id_aa64isar0_el1);
+        tlbi_range = BITS_SHIFT(isar0, 59, 56) >= 2;
+    }
+    return tlbi_range;
+}
+
+/* Issue TLBIs for the pending range. Caller is responsible for the DSB. */
+static void arm64_tlbi_batch_flush(struct arm64_tlbi_batch *batch)
+{
+    vaddr_t va = batch->vaddr;
+    size_t pages = batch->size >> 12;
+    size_t entries = batch->entries;
+    uint64_t asid_bits = 0;
+
+    if (!pages) {
+        return;
+    }
+    batch->size = 0;
+    batch->entries = 0;
+
+    if (batch->asid != MMU_ARM64_GLOBAL_ASID) {
+        asid_bits = (uint64_t)batch->asid << 48;
+    }
+
+    if (PAGE_SIZE_SHIFT == 12 && arm64_has_tlbi_range()) {
+        /*
+         * Each range operation covers (num + 1) << (5 * scale + 1) pages.
+         * Peel off an odd page first, then clear the range bits from the
+         * bottom up, as the range can't be expressed otherwise.
+         */
+        uint scale = 0;
+        while (pages) {
+            if (scale > 3) {
+                /* Larger than what a range TLBI can encode */
+                goto flush_all;
+            }
+            if (pages & 1) {
+                arm64_tlbi_va(batch, va, asid_bits);
+                va += PAGE_SIZE;
+                pages--;
+                continue;
+            }
+            uint shift = 5 * scale + 1;
+            uint num = (pages >> shift) & 0x1f;
+            if (num) {
+                /* TG = 0b01 (4KB granule), TTL = 0 (any level) */
+                uint64_t arg = asid_bits | (1ULL << 46) |
+                               ((uint64_t)scale << 44) |
+                               ((uint64_t)(num - 1) << 39) |
+                               ((va >> 12) & BIT_MASK(37));
+                if (batch->asid == MMU_ARM64_GLOBAL_ASID) {
+                    ARM64_TLBI_RVAAE1IS(arg);
+                } else {
+                    ARM64_TLBI_RVAE1IS(arg);
+                }
+                va += ((vaddr_t)num << shift) << 12;
+                pages -= (size_t)num << shift;
+            }
+            scale++;
+        }
+        return;
+    }
+
+    /* one TLBI per entry, so a block costs the same as a page */
+    if (entries <= ARM64_TLBI_MAX_PAGES) {
+        while (entries--) {
+            arm64_tlbi_va(batch, va, asid_bits);
+            va = round_down(va, batch->entry_size) + batch->entry_size;
+        }
+        return;
+    }
+
+flush_all:
+    if (batch->asid == MMU_ARM64_GLOBAL_ASID) {
+        __asm__ volatile("tlbi vmalle1is");
+    } else {
+        __asm__ volatile("tlbi aside1is, %0" :: "r" (asid_bits));
+    }
+}
+
+/*
+ * Add a range cleared from one entry of @entry_size bytes to @batch,
+ * flushing the old range if not adjacent or made of different entries.
+ */
+static void arm64_tlbi_batch_add(struct arm64_tlbi_batch *batch,
+                                 vaddr_t vaddr, size_t size,
+                                 size_t entry_size)
+{
+    if (batch->size && batch->entry_size == entry_size &&
+            batch->vaddr + batch->size == vaddr) {
+        batch->size += size;
+        batch->entries++;
+        return;
+    }
+    arm64_tlbi_batch_flush(batch);
+    batch->vaddr = vaddr;
+    batch->size = size;
+    batch->entry_size = entry_size;
+    batch->entries = 1;
+}
+
+/* Free a page table after the TLB has stopped referencing it */
+static void arm64_tlbi_batch_free_table(struct arm64_tlbi_batch *batch,
+                                        void *vaddr, paddr_t paddr,
+                                        uint page_size_shift)
+{
+#ifndef EARLY_MMU
+    vm_page_t *page;
+
+    if ((1UL << page_size_shift) == PAGE_SIZE) {
+        /* defer, the page is not touched until arm64_tlbi_batch_finish */
+        page = paddr_to_vm_page(paddr);
+        if (!page)
+            panic("bad page table paddr 0x%lx\n", paddr);
+        list_add_tail(&batch->free_tables, &page->node);
+        return;
+    }
+#endif
+    arm64_tlbi_batch_flush(batch);
+    DSB;
+    free_page_table(vaddr, paddr, page_size_shift);
+}
+
+static void arm64_tlbi_batch_finish(struct arm64_tlbi_batch *batch)
+{
+    arm64_tlbi_batch_flush(batch);
+    DSB;
+    ISB;
+#ifndef EARLY_MMU
+    if (!list_is_empty(&batch->free_tables)) {
+        pmm_free(&batch->free_tables);
+    }
+#endif
+}
+
 static void arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
                                size_t size,
                                uint index_shift, uint page_size_shift,
-                               pte_t *page_table, uint asid)
+                               pte_t *page_table,
+                               struct arm64_tlbi_batch *batch)
 {
     pte_t *next_page_table;
     vaddr_t index;
@@ -378,22 +577,20 @@ static void arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
             arm64_mmu_unmap_pt(vaddr, vaddr_rem, chunk_size,
                                index_shift - (page_size_shift - 3),
                                page_size_shift,
-                               next_page_table, asid);
+                               next_page_table, batch);
             if (chunk_size == block_size ||
                     page_table_is_clear(next_page_table, page_size_shift)) {
                 LTRACEF("pte %p[0x%lx] = 0 (was page table)\n", page_table, index);
                 page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
                 __asm__ volatile("dmb ishst" ::: "memory");
-                free_page_table(next_page_table, page_table_paddr, page_size_shift);
+                arm64_tlbi_batch_free_table(batch, next_page_table,
+                                            page_table_paddr, page_size_shift);
             }
         } else if (pte) {
             LTRACEF("pte %p[0x%lx] = 0\n", page_table, index);
             page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
             CF;
-            if (asid == MMU_ARM64_GLOBAL_ASID)
-                ARM64_TLBI(vaae1is, vaddr >> 12);
-            else
-                ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
+            arm64_tlbi_batch_add(batch, vaddr, chunk_size, block_size);
         } else {
             LTRACEF("pte %p[0x%lx] already clear\n", page_table, index);
         }
@@ -425,6 +622,7 @@ static int arm64_mmu_map_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
     vaddr_t block_size;
     vaddr_t block_mask;
     pte_t pte;
+    struct arm64_tlbi_batch batch;
 
     LTRACEF("vaddr 0x%lx, vaddr_rel 0x%lx, paddr 0x%lx, size 0x%lx, attrs 0x%llx, index shift %d, page_size_shift %d, page_table %p\n",
             vaddr, vaddr_rel, paddr, size, attrs,
@@ -485,9 +683,10 @@ static int arm64_mmu_map_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
     return 0;
 
 err:
+    arm64_tlbi_batch_init(&batch, asid);
     arm64_mmu_unmap_pt(vaddr_in, vaddr_rel_in, size_in - size,
-                       index_shift, page_size_shift, page_table, asid);
-    DSB;
+                       index_shift, page_size_shift, page_table, &batch);
+    arm64_tlbi_batch_finish(&batch);
     return ERR_GENERIC;
 }
 
@@ -542,9 +741,12 @@ int arm64_mmu_unmap(vaddr_t vaddr, size_t size,
         return ERR_INVALID_ARGS;
     }
 
+    struct arm64_tlbi_batch batch;
+    arm64_tlbi_batch_init(&batch, asid);
     arm64_mmu_unmap_pt(vaddr, vaddr_rel, size,
-                       top_index_shift, page_size_shift, top_page_table, asid);
-    DSB;
+                       top_index_shift, page_size_shift, top_page_table,
+                       &batch);
+    arm64_tlbi_batch_finish(&batch);
     return 0;
 }
 
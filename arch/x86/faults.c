@@ -22,11 +22,15 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #include <debug.h>
+#include <err.h>
 #include <trace.h>
 #include <arch/x86.h>
 #include <arch/fpu.h>
 #include <kernel/thread.h>
 #include <platform.h>
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
 
 /* exceptions */
 #define INT_DIVIDE_0        0x00
@@ -116,6 +120,36 @@ void x86_pfe_handler(x86_iframe_t *frame)
     thread_t *current_thread;
     error_code = frame->err_code;
 
+#if WITH_KERNEL_VM
+    if (!(error_code & PFEX_P) || (error_code & PFEX_W)) {
+        /*
+         * not-present fault, try to populate a lazily mapped page, or
+         * write protection fault, try to copy a copy-on-write page
+         */
+        uint pf_flags = 0;
+        if (error_code & PFEX_W)
+            pf_flags |= VMM_PF_FLAG_WRITE;
+        if (error_code & PFEX_U)
+            pf_flags |= VMM_PF_FLAG_USER;
+        if (error_code & PFEX_I)
+            pf_flags |= VMM_PF_FLAG_INSTRUCTION;
+        /*
+         * resolving the fault can block, only try if the faulting code had
+         * interrupts enabled, and enable them again meanwhile
+         */
+        if (frame->flags & X86_FLAGS_IF) {
+            vaddr_t cr2 = x86_get_cr2();
+            status_t ret;
+
+            arch_enable_ints();
+            ret = vmm_handle_page_fault(cr2, pf_flags);
+            arch_disable_ints();
+            if (ret == NO_ERROR)
+                return;
+        }
+    }
+#endif
+
 #ifdef PAGE_FAULT_DEBUG_INFO
     addr_t v_addr, ssp, esp, ip, rip;
     v_addr = x86_get_cr2();
@@ -146,6 +146,7 @@ typedef tss_32_t tss_t;
 typedef tss_64_t tss_t;
 #endif
 
+#define X86_FLAGS_IF            0x00000200 /* interrupts enabled */
 #define X86_CR0_PE              0x00000001 /* protected mode enable */
 #define X86_CR0_MP              0x00000002 /* monitor coprocessor */
 #define X86_CR0_EM              0x00000004 /* emulation */
@@ -83,6 +83,8 @@ GLOBAL_SHARED_CFLAGS := --std=c17 -Wstrict-prototypes -Wwrite-strings
 GLOBAL_SHARED_CPPFLAGS := --std=c++17 -fno-exceptions -fno-rtti -fno-threadsafe-statics
 # c99 array designators are not part of C++, but they are convenient and help avoid errors.
 GLOBAL_SHARED_CPPFLAGS += -Wno-c99-designator
+# clang does not pass the object size to operator delete unless asked to.
+GLOBAL_SHARED_CPPFLAGS += -fsized-deallocation
 #GLOBAL_CPPFLAGS += -Weffc++
 GLOBAL_SHARED_ASMFLAGS := -DASSEMBLY
 GLOBAL_LDFLAGS :=
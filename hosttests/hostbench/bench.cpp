@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+/*
+ * Host benchmark runner. Each benchmark is calibrated until one run takes at
+ * least --min-time-ms, then run --repeat times and the median is reported.
+ *
+ * Usage: host_bench [--json] [--filter substring] [--min-time-ms n]
+ *                   [--repeat n]
+ */
+
+struct bench_entry {
+    const char* name;
+    bench_func_t func;
+    size_t arg;
+};
+
+struct bench_result {
+    const bench_entry* entry;
+    uint64_t iterations;
+    double ns_per_op;
+    size_t bytes_per_op;
+};
+
+static std::vector<bench_entry>& bench_entries() {
+    static std::vector<bench_entry> entries;
+    return entries;
+}
+
+bench_registration::bench_registration(const char* name,
+                                       bench_func_t func,
+                                       std::initializer_list<size_t> args) {
+    for (size_t arg : args) {
+        bench_entries().push_back({name, func, arg});
+    }
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_start(struct bench_state* state) {
+    state->start_ns = now_ns();
+}
+
+void bench_stop(struct bench_state* state) {
+    state->stop_ns = now_ns();
+}
+
+static uint64_t run_once(const bench_entry& entry,
+                         uint64_t iterations,
+                         size_t* bytes_per_op) {
+    struct bench_state state = {};
+    state.iterations = iterations;
+    state.arg = entry.arg;
+    entry.func(&state);
+    if (!state.stop_ns || state.stop_ns < state.start_ns) {
+        fprintf(stderr, "%s did not call bench_start and bench_stop\n",
+                entry.name);
+        exit(1);
+    }
+    *bytes_per_op = state.bytes_per_op;
+    return std::max<uint64_t>(state.stop_ns - state.start_ns, 1);
+}
+
+static bench_result run_bench(const bench_entry& entry,
+                              uint64_t min_time_ns,
+                              int repeat) {
+    bench_result result = {&entry, 1, 0, 0};
+    uint64_t elapsed;
+
+    /* grow the iteration count until a run is long enough to time */
+    while ((elapsed = run_once(entry, result.iterations,
+                               &result.bytes_per_op)) < min_time_ns) {
+        uint64_t scale = min_time_ns * 3 / 2 / elapsed;
+        result.iterations *= std::min<uint64_t>(std::max<uint64_t>(scale, 2),
+                                                100);
+    }
+
+    std::vector<double> runs;
+    for (int i = 0; i < repeat; i++) {
+        elapsed = run_once(entry, result.iterations, &result.bytes_per_op);
+        runs.push_back((double)elapsed / result.iterations);
+    }
+    std::sort(runs.begin(), runs.end());
+    result.ns_per_op = runs[runs.size() / 2];
+    return result;
+}
+
+static double mb_per_s(const bench_result& result) {
+    return result.bytes_per_op * 1000.0 / result.ns_per_op;
+}
+
+static void print_table(const std::vector<bench_result>& results) {
+    printf("%-32s %8s %14s %12s %10s\n", "benchmark", "arg", "iterations",
+           "ns/op", "MB/s");
+    for (const bench_result& result : results) {
+        printf("%-32s %8zu %14llu %12.2f", result.entry->name,
+               result.entry->arg, (unsigned long long)result.iterations,
+               result.ns_per_op);
+        if (result.bytes_per_op) {
+            printf(" %10.1f", mb_per_s(result));
+        }
+        printf("\n");
+    }
+}
+
+static void print_json(const std::vector<bench_result>& results) {
+    printf("{\n  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result& result = results[i];
+        printf("%s\n    {\"name\": \"%s\", \"arg\": %zu, \"iterations\": %llu, "
+               "\"ns_per_op\": %.3f",
+               i ? "," : "", result.entry->name, result.entry->arg,
+               (unsigned long long)result.iterations, result.ns_per_op);
+        if (result.bytes_per_op) {
+            printf(", \"bytes_per_op\": %zu, \"mb_per_s\": %.1f",
+                   result.bytes_per_op, mb_per_s(result));
+        }
+        printf("}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    const char* filter = NULL;
+    uint64_t min_time_ms = 10;
+    int repeat = 3;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            min_time_ms = strtoull(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            repeat = std::max(atoi(argv[++i]), 1);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--json] [--filter substring] "
+                    "[--min-time-ms n] [--repeat n]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    /* registration order depends on link order, report in name order */
+    std::vector<bench_entry>& entries = bench_entries();
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const bench_entry& a, const bench_entry& b) {
+                         return strcmp(a.name, b.name) < 0;
+                     });
+
+    std::vector<bench_result> results;
+    for (const bench_entry& entry : entries) {
+        if (filter && !strstr(entry.name, filter)) {
+            continue;
+        }
+        results.push_back(run_bench(entry, min_time_ms * 1000000, repeat));
+    }
+
+    if (json) {
+        print_json(results);
+    } else {
+        print_table(results);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <initializer_list>
+
+/**
+ * struct bench_state - State passed to a benchmark.
+ * @iterations:     Number of times to run the operation being measured.
+ * @arg:            Argument the benchmark was registered with, e.g. a size.
+ * @bytes_per_op:   Set by the benchmark to report throughput as well.
+ * @start_ns:       Set by bench_start().
+ * @stop_ns:        Set by bench_stop().
+ *
+ * A benchmark does its setup, calls bench_start(), runs its operation
+ * @iterations times, calls bench_stop() and cleans up. Only the time between
+ * bench_start() and bench_stop() is measured.
+ */
+struct bench_state {
+    uint64_t iterations;
+    size_t arg;
+    size_t bytes_per_op;
+    uint64_t start_ns;
+    uint64_t stop_ns;
+};
+
+typedef void (*bench_func_t)(struct bench_state* state);
+
+void bench_start(struct bench_state* state);
+void bench_stop(struct bench_state* state);
+
+struct bench_registration {
+    bench_registration(const char* name,
+                       bench_func_t func,
+                       std::initializer_list<size_t> args = {0});
+};
+
+/* keep the compiler from discarding a value that is otherwise unused */
+template <typename T>
+static inline void bench_keep(const T& value) {
+    __asm__ volatile("" : : "r,m"(value) : "memory");
+}
+
+/*
+ * BENCH - define a benchmark named group.name. Pass a braced list of
+ * arguments to run it once for each, e.g. BENCH(string, strlen, {8, 64}).
+ */
+#define BENCH(group, name, ...)                                              \
+    static void bench_##group##_##name(struct bench_state* state);           \
+    static bench_registration bench_registration_##group##_##name(           \
+            #group "." #name, bench_##group##_##name, ##__VA_ARGS__);        \
+    static void bench_##group##_##name(struct bench_state* state)
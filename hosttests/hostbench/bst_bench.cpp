@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <lib/binary_search_tree.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "bench.h"
+
+struct bst_bench_item {
+    struct bst_node node;
+    uint32_t key;
+};
+
+static int bst_bench_compare(struct bst_node* a, struct bst_node* b) {
+    uint32_t ka = containerof(a, struct bst_bench_item, node)->key;
+    uint32_t kb = containerof(b, struct bst_bench_item, node)->key;
+    return kb > ka ? 1 : kb < ka ? -1 : 0;
+}
+
+/* arg items with distinct keys in random order */
+static std::vector<bst_bench_item> make_items(size_t count) {
+    std::vector<bst_bench_item> items(count);
+    srand(0);
+    for (size_t i = 0; i < count; i++) {
+        items[i].key = i;
+    }
+    for (size_t i = count - 1; i > 0; i--) {
+        std::swap(items[i].key, items[rand() % (i + 1)].key);
+    }
+    for (bst_bench_item& item : items) {
+        bst_node_initialize(&item.node);
+    }
+    return items;
+}
+
+static void fill_tree(struct bst_root* root,
+                      std::vector<bst_bench_item>& items) {
+    bst_root_initialize(root);
+    for (bst_bench_item& item : items) {
+        bst_insert(root, &item.node, bst_bench_compare);
+    }
+}
+
+/* delete an item from a tree of arg items and insert it again */
+BENCH(bst, delete_insert, {16, 1024, 65536}) {
+    struct bst_root root;
+    std::vector<bst_bench_item> items = make_items(state->arg);
+
+    fill_tree(&root, items);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        struct bst_node* node = &items[i % items.size()].node;
+        bst_delete(&root, node);
+        bst_node_initialize(node);
+        bst_insert(&root, node, bst_bench_compare);
+    }
+    bench_stop(state);
+}
+
+/* look up random keys in a tree of arg items */
+BENCH(bst, search, {16, 1024, 65536}) {
+    struct bst_root root;
+    std::vector<bst_bench_item> items = make_items(state->arg);
+    bst_bench_item key = {};
+
+    fill_tree(&root, items);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        key.key = items[i % items.size()].key;
+        bench_keep(bst_search(&root, &key.node, bst_bench_compare));
+    }
+    bench_stop(state);
+}
+
+/* walk a tree of arg items in order */
+BENCH(bst, for_every_entry, {1024}) {
+    struct bst_root root;
+    std::vector<bst_bench_item> items = make_items(state->arg);
+    bst_bench_item* entry;
+
+    fill_tree(&root, items);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        uint32_t sum = 0;
+        bst_for_every_entry(&root, entry, struct bst_bench_item, node) {
+            sum += entry->key;
+        }
+        bench_keep(sum);
+    }
+    bench_stop(state);
+}
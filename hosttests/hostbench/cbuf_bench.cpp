@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <lib/cbuf.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define CBUF_BENCH_SIZE 16384
+
+/* one cbuf_write and one cbuf_read of arg bytes, wrapping around the ring */
+BENCH(cbuf, write_read, {16, 256, 4096}) {
+    cbuf_t cbuf;
+    size_t len = state->arg;
+    char* buf = (char*)calloc(1, len);
+
+    cbuf_initialize(&cbuf, CBUF_BENCH_SIZE);
+    state->bytes_per_op = len;
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        bench_keep(cbuf_write(&cbuf, buf, len, false));
+        bench_keep(cbuf_read(&cbuf, buf, len, false));
+    }
+    bench_stop(state);
+    free(cbuf.buf);
+    free(buf);
+}
+
+/* cbuf_peek and a cbuf_read that skips the data, the zero copy pattern */
+BENCH(cbuf, peek_skip, {256}) {
+    cbuf_t cbuf;
+    size_t len = state->arg;
+    char* buf = (char*)calloc(1, len);
+    iovec_t regions[2];
+
+    cbuf_initialize(&cbuf, CBUF_BENCH_SIZE);
+    state->bytes_per_op = len;
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        cbuf_write(&cbuf, buf, len, false);
+        bench_keep(cbuf_peek(&cbuf, regions));
+        bench_keep(cbuf_read(&cbuf, NULL, len, false));
+    }
+    bench_stop(state);
+    free(cbuf.buf);
+    free(buf);
+}
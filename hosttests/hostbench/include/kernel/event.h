@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <debug.h>
+#include <stdbool.h>
+
+/*
+ * Single threaded stand-ins. A wait on an event that is not signaled would
+ * never return, so it is treated as a bug in the benchmark.
+ */
+typedef struct event {
+    bool signaled;
+} event_t;
+
+static inline void event_init(event_t *e, bool initial, unsigned flags) {
+    e->signaled = initial;
+}
+
+static inline int event_signal(event_t *e, bool reschedule) {
+    e->signaled = true;
+    return 0;
+}
+
+static inline int event_unsignal(event_t *e) {
+    e->signaled = false;
+    return 0;
+}
+
+static inline int event_wait(event_t *e) {
+    DEBUG_ASSERT(e->signaled);
+    return 0;
+}
+
+static inline void thread_preempt(void) {}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <lk/list.h>
+
+#include <vector>
+
+#include "bench.h"
+
+struct list_bench_item {
+    struct list_node node;
+    int value;
+};
+
+static void fill_list(struct list_node* list,
+                      std::vector<list_bench_item>& items) {
+    list_initialize(list);
+    for (list_bench_item& item : items) {
+        list_add_tail(list, &item.node);
+    }
+}
+
+/* add to the tail and remove from the head, the queue pattern */
+BENCH(list, add_tail_remove_head, {1}) {
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    list_bench_item item = {};
+
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        list_add_tail(&list, &item.node);
+        bench_keep(list_remove_head(&list));
+    }
+    bench_stop(state);
+}
+
+/* walk a list of arg entries */
+BENCH(list, for_every_entry, {16, 1024}) {
+    struct list_node list;
+    std::vector<list_bench_item> items(state->arg);
+    list_bench_item* entry;
+
+    fill_list(&list, items);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        int sum = 0;
+        list_for_every_entry(&list, entry, list_bench_item, node) {
+            sum += entry->value;
+        }
+        bench_keep(sum);
+    }
+    bench_stop(state);
+}
+
+/* list_length has to walk the list as well */
+BENCH(list, length, {16, 1024}) {
+    struct list_node list;
+    std::vector<list_bench_item> items(state->arg);
+
+    fill_list(&list, items);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        bench_keep(&list);
+        bench_keep(list_length(&list));
+    }
+    bench_stop(state);
+}
+
+/* delete an entry from the middle of a list and put it back */
+BENCH(list, delete_add, {1024}) {
+    struct list_node list;
+    std::vector<list_bench_item> items(state->arg);
+    struct list_node* node = &items[state->arg / 2].node;
+
+    fill_list(&list, items);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        struct list_node* next = node->next;
+        list_delete(node);
+        list_add_tail(next, node);
+    }
+    bench_stop(state);
+}
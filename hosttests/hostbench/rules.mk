@@ -0,0 +1,49 @@
+#
+# Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files
+# (the "Software"), to deal in the Software without restriction,
+# including without limitation the rights to use, copy, modify, merge,
+# publish, distribute, sublicense, and/or sell copies of the Software,
+# and to permit persons to whom the Software is furnished to do so,
+# subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+# CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+HOST_TEST := host_bench
+
+LK_DIR := $(LOCAL_DIR)/../..
+
+HOST_SRCS := \
+        $(LOCAL_DIR)/bench.cpp \
+        $(LOCAL_DIR)/bst_bench.cpp \
+        $(LOCAL_DIR)/cbuf_bench.cpp \
+        $(LOCAL_DIR)/list_bench.cpp \
+        $(LOCAL_DIR)/string_bench.cpp \
+        $(LK_DIR)/lib/binary_search_tree/binary_search_tree.c \
+        $(LK_DIR)/lib/cbuf/cbuf.c \
+        $(LK_DIR)/lib/libc/string/hosttest/lk_string.c \
+
+HOST_INCLUDE_DIRS := \
+        $(LOCAL_DIR)/include \
+        $(LK_DIR)/include/shared \
+        $(LK_DIR)/lib/binary_search_tree/include \
+        $(LK_DIR)/lib/cbuf/include \
+
+HOST_LIBS := \
+        stdc++ \
+
+include make/host_test.mk
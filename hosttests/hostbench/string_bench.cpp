@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/* the lk routines, built by lib/libc/string/hosttest/lk_string.c */
+extern "C" {
+void* lk_memchr(const void* buf, int c, size_t len);
+char* lk_strchr(const char* s, int c);
+int lk_strcmp(const char* cs, const char* ct);
+size_t lk_strlen(const char* s);
+size_t lk_strnlen(const char* s, size_t count);
+}
+
+#define STRING_BENCH_SIZES {8, 64, 512, 4096}
+
+/*
+ * A string of size - 1 characters, none of them '\n'. Searches look for '\n'
+ * so they scan the whole string. The host libc versions are measured too as
+ * a reference point.
+ */
+static char* make_string(size_t size) {
+    char* s = (char*)malloc(size);
+    memset(s, 'a', size - 1);
+    s[size - 1] = '\0';
+    return s;
+}
+
+#define STRING_BENCH(name, call)                            \
+    BENCH(string, name, STRING_BENCH_SIZES) {               \
+        size_t size = state->arg;                           \
+        char* s = make_string(size);                        \
+        char* t = make_string(size);                        \
+        state->bytes_per_op = size;                         \
+        bench_start(state);                                 \
+        for (uint64_t i = 0; i < state->iterations; i++) {  \
+            bench_keep(s);                                  \
+            bench_keep(call);                               \
+        }                                                   \
+        bench_stop(state);                                  \
+        free(s);                                            \
+        free(t);                                            \
+    }
+
+STRING_BENCH(lk_strlen, lk_strlen(s))
+STRING_BENCH(lk_strnlen, lk_strnlen(s, size))
+STRING_BENCH(lk_strchr, lk_strchr(s, '\n'))
+STRING_BENCH(lk_memchr, lk_memchr(s, '\n', size))
+STRING_BENCH(lk_strcmp, lk_strcmp(s, t))
+STRING_BENCH(libc_strlen, strlen(s))
+STRING_BENCH(libc_strnlen, strnlen(s, size))
+STRING_BENCH(libc_strchr, strchr(s, '\n'))
+STRING_BENCH(libc_memchr, memchr(s, '\n', size))
+STRING_BENCH(libc_strcmp, strcmp(s, t))
@@ -21,5 +21,6 @@
 #
 
 MODULES += \
+	$(GET_LOCAL_DIR)/hostbench \
 	$(GET_LOCAL_DIR)/listtest \
 
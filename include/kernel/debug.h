@@ -34,6 +34,7 @@ __BEGIN_CDECLS;
 
 #include <lib/evlog.h>
 
+/* size of each cpu's event log, in words */
 #ifndef KERNEL_EVLOG_LEN
 #define KERNEL_EVLOG_LEN 1024
 #endif
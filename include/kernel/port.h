@@ -36,6 +36,10 @@ __BEGIN_CDECLS;
 
 #define PORT_NAME_LEN 12
 
+/* Largest ring, in packets, that port_create_etc() accepts.
+ */
+#define PORT_BUFF_SIZE_MAX 4096
+
 typedef void *port_t;
 
 typedef struct {
@@ -51,8 +55,11 @@ typedef enum {
     PORT_MODE_BROADCAST   = 0,
     PORT_MODE_UNICAST     = 1,
     PORT_MODE_BIG_BUFFER  = 2,
+    PORT_MODE_SLICE       = 4,
 } port_mode_t;
 
+struct vmm_obj_slice;
+
 /* Inits the port subsystem
  */
 void port_init(void);
@@ -63,6 +70,13 @@ void port_init(void);
  */
 status_t port_create(const char *name, port_mode_t mode, port_t *port);
 
+/* Same as port_create() but with a ring of |pk_count| packets, which must be
+ * a power of two between 8 and PORT_BUFF_SIZE_MAX. Only unicast ports can
+ * have more than 8. PORT_MODE_BIG_BUFFER is ignored.
+ */
+status_t port_create_etc(const char *name, port_mode_t mode, uint pk_count,
+                         port_t *port);
+
 /* Make a read-side port. Only non-destroyed existing write ports can
  * be opened with this api. Unicast ports can only be opened once. For
  * broadcast ports, each call if successful returns a new port.
@@ -86,12 +100,43 @@ status_t port_group_remove(port_t group, port_t port);
  */
 status_t port_write(port_t port, const port_packet_t *pk, size_t count);
 
+/* Same as port_write() but if |timeout| is not zero, waits for up to |timeout|
+ * for every reader to have room for all |count| packets instead of failing.
+ * Returns ERR_TIMED_OUT if they did not, ERR_TOO_BIG if they never can and
+ * ERR_CANCELLED if the port is closed meanwhile.
+ */
+status_t port_write_etc(port_t port, const port_packet_t *pk, size_t count,
+                        lk_time_t timeout);
+
 /* Read one packet from the port or port group, blocking. The |result| contains
  * the port that the message was read from. If |timeout| is zero the call
  * does not block.
  */
 status_t port_read(port_t port, lk_time_t timeout, port_result_t *result);
 
+/* Same as port_read() but reads up to |count| packets at once, blocking
+ * only until the first one is available. Returns the number of packets
+ * read or a negative error.
+ */
+ssize_t port_read_many(port_t port, lk_time_t timeout, port_result_t *results,
+                       size_t count);
+
+/* Hand the memory in |slice| to the reader of a unicast PORT_MODE_SLICE port
+ * without copying it. On success the reference held by |slice| moves to
+ * the port and |slice| is released. |timeout| works as in port_write_etc().
+ * Slice ports only carry slices; port_write() and port_read() on them fail
+ * with ERR_BAD_HANDLE, and their read ports cannot join a port group.
+ */
+status_t port_write_slice(port_t port, struct vmm_obj_slice *slice, lk_time_t timeout);
+
+/* Receive memory sent with port_write_slice(). |slice| must be initialized
+ * and unused, and on success holds the reference, e.g. for vmm_alloc_obj()
+ * to map it. |ctx|, if not NULL, receives the read port context. Slices
+ * still queued when the port goes away are released.
+ */
+status_t port_read_slice(port_t port, lk_time_t timeout, struct vmm_obj_slice *slice,
+                         void **ctx);
+
 /* Destroy the write-side port, flush queued packets and release all resources,
  * all calls will now fail on that port. Only a closed port can be destroyed.
  */
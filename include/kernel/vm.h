@@ -52,6 +52,7 @@
 #include <stdlib.h>
 #include <arch.h>
 #include <arch/mmu.h>
+#include <kernel/mutex.h>
 #include <kernel/vm_obj.h>
 #include <lib/binary_search_tree.h>
 #include <lk/reflist.h>
@@ -149,6 +150,7 @@ status_t pmm_add_arena(pmm_arena_t *arena);
 /* Optional flags passed to pmm_alloc */
 #define PMM_ALLOC_FLAG_KMAP (1U << 0)
 #define PMM_ALLOC_FLAG_CONTIGUOUS (1U << 1)
+#define PMM_ALLOC_FLAG_LAZY (1U << 2)
 
 /**
  * pmm_alloc - Allocate and clear @count pages of physical memory.
@@ -159,6 +161,9 @@ status_t pmm_add_arena(pmm_arena_t *arena);
  *              already mapped in the kernel, PMM_ALLOC_FLAG_KMAP (e.g for
  *              kernel heap and page tables) and/or to allocate a single
  *              physically contiguous range, PMM_ALLOC_FLAG_CONTIGUOUS.
+ *              PMM_ALLOC_FLAG_LAZY defers allocating each page until it is
+ *              first looked up with get_page. It cannot be combined with
+ *              PMM_ALLOC_FLAG_CONTIGUOUS.
  * @align_log2: Alignment needed for contiguous allocation, 0 otherwise.
  *
  * Allocate and initialize a vmm_obj that tracks the allocated pages.
@@ -169,6 +174,25 @@ status_t pmm_add_arena(pmm_arena_t *arena);
 status_t pmm_alloc(struct vmm_obj **objp, struct obj_ref* ref, uint count,
                    uint32_t flags, uint8_t align_log2);
 
+/**
+ * vmm_cow_obj_create - Create a copy-on-write object layered over another.
+ * @parent: Object to read unmodified pages from.
+ * @offset: Offset in bytes into @parent. Must be page aligned.
+ * @size:   Size of the new object. Must be page aligned.
+ * @objp:   Pointer to returned vmm_obj (untouched if return code is not 0).
+ * @ref:    Reference to add to *@objp (untouched if return code is not 0).
+ *
+ * The new object shares all pages with @parent until they are written. The
+ * first write to a page through a mapping of the new object copies that page.
+ * @parent must not be modified while the new object exists, e.g. it should be
+ * a template image that is only ever mapped read-only.
+ *
+ * Return: 0 on success, ERR_INVALID_ARGS if @offset or @size are not page
+ *         aligned, ERR_NO_MEMORY if the object could not be allocated.
+ */
+status_t vmm_cow_obj_create(struct vmm_obj *parent, size_t offset, size_t size,
+                            struct vmm_obj **objp, struct obj_ref *ref);
+
 /* Allocate a specific range of physical pages, adding to the tail of the passed list.
  * The list must be initialized.
  * Returns the number of pages allocated.
@@ -200,6 +224,67 @@ static inline void *pmm_alloc_kpage(void) { return pmm_alloc_kpages(1, NULL); }
 
 size_t pmm_free_kpages(void *ptr, uint count);
 
+/* Number of pages in all arenas, and how many of them are free. */
+size_t pmm_page_count(void);
+size_t pmm_free_page_count(void);
+
+/*
+ * Memory pressure.
+ *
+ * When an allocation leaves fewer than the low watermark of free pages, a low
+ * priority thread calls the registered shrinkers until the high watermark is
+ * reached again or none of them can give back any more pages.
+ */
+
+/**
+ * struct vm_shrinker - Callback to give memory back under pressure.
+ * @node:   Entry in the list of shrinkers, used internally.
+ * @name:   Name shown by the pmm console command.
+ * @shrink: Function that frees up to @count pages that the subsystem owning
+ *          @shrinker has cached but does not need, and returns how many it
+ *          freed. Called from thread context without any vm locks held.
+ */
+struct vm_shrinker {
+    struct list_node node;
+    const char *name;
+    size_t (*shrink)(struct vm_shrinker *shrinker, size_t count);
+};
+
+#define VM_SHRINKER_INITIAL_VALUE(_name, _shrink) \
+    { .node = LIST_INITIAL_CLEARED_VALUE, .name = _name, .shrink = _shrink }
+
+/**
+ * vm_register_shrinker - Add a shrinker to call under memory pressure.
+ * @shrinker: Shrinker to add. Must stay valid until it is unregistered.
+ */
+void vm_register_shrinker(struct vm_shrinker *shrinker);
+
+/**
+ * vm_unregister_shrinker - Remove a shrinker.
+ * @shrinker: Shrinker added by vm_register_shrinker().
+ *
+ * Waits for a call to @shrinker that is already running to finish.
+ */
+void vm_unregister_shrinker(struct vm_shrinker *shrinker);
+
+/**
+ * vm_shrink - Call the shrinkers in the order they were registered.
+ * @count: Number of pages to free.
+ *
+ * Return: the number of pages the shrinkers freed, which can be more or less
+ * than @count.
+ */
+size_t vm_shrink(size_t count);
+
+/**
+ * vm_set_watermarks - Set the free page counts that start and stop shrinking.
+ * @low:  Start shrinking when an allocation leaves fewer free pages than this.
+ *        0 turns background shrinking off.
+ * @high: Stop once this many pages are free.
+ */
+void vm_set_watermarks(size_t low, size_t high);
+void vm_get_watermarks(size_t *low, size_t *high);
+
 /* assign physical addresses and sizes to the dynamic entries in the initial
  * mappings
  */
@@ -233,8 +318,14 @@ typedef struct vmm_aspace {
     vaddr_t base;
     size_t  size;
 
+    /* protects regions, the accounting below and mappings made by the vmm */
+    mutex_t lock;
     struct bst_root regions;
 
+    /* bytes of address space backed by a vmm_obj, and how much of it is mapped */
+    size_t committed;
+    size_t resident;
+
     arch_aspace_t arch_aspace;
 } vmm_aspace_t;
 
@@ -311,10 +402,27 @@ typedef struct vmm_region {
     vaddr_t base;
 
     struct vmm_obj_slice obj_slice;
+    size_t resident;
+
+    /*
+     * entry in the mapping list of a copy-on-write obj_slice.obj and the
+     * aspace the region is in, see vmm_obj_mappings()
+     */
+    struct list_node obj_node;
+    vmm_aspace_t *aspace;
+
+    /*
+     * first and last address used by regions in the subtree rooted at node,
+     * and the largest number of unused bytes between two of those regions
+     */
+    vaddr_t subtree_base;
+    vaddr_t subtree_last;
+    size_t subtree_max_gap;
 } vmm_region_t;
 
 #define VMM_REGION_FLAG_RESERVED 0x1
 #define VMM_REGION_FLAG_PHYSICAL 0x2
+#define VMM_REGION_FLAG_UNMAPPED 0x4
 #define VMM_REGION_FLAG_INTERNAL_MASK 0xffff
 
 /* grab a handle to the kernel address space */
@@ -377,7 +485,8 @@ static inline status_t vmm_alloc_physical(vmm_aspace_t *aspace, const char *name
 status_t vmm_alloc_contiguous(vmm_aspace_t *aspace, const char *name, size_t size, void **ptr, uint8_t align_log2, uint vmm_flags, uint arch_mmu_flags);
 
 
-/* allocate a region of memory backed by newly allocated physical memory */
+/* allocate a region of memory backed by newly allocated physical memory.
+   with VMM_FLAG_LAZY, each page is allocated and cleared on first access. */
 status_t vmm_alloc(vmm_aspace_t *aspace, const char *name, size_t size, void **ptr, uint8_t align_log2, uint vmm_flags, uint arch_mmu_flags);
 
 /**
@@ -399,7 +508,7 @@ status_t vmm_alloc(vmm_aspace_t *aspace, const char *name, size_t size, void **p
  *
  * Return: Status code; any value other than NO_ERROR is a failure.
  */
-status_t vmm_get_obj(const vmm_aspace_t *aspace, vaddr_t vaddr, size_t size,
+status_t vmm_get_obj(vmm_aspace_t *aspace, vaddr_t vaddr, size_t size,
                      struct vmm_obj_slice *slice);
 
 #define VMM_FREE_REGION_FLAG_EXPAND 0x1
@@ -428,6 +537,37 @@ status_t vmm_free_region(vmm_aspace_t *aspace, vaddr_t va);
  */
 #define VMM_FLAG_NO_END_GUARD 0x40000
 
+/*
+ * Do not map the backing pages up front. Each page is looked up (and for
+ * objects allocated with PMM_ALLOC_FLAG_LAZY, allocated and cleared) and
+ * mapped by vmm_handle_page_fault() the first time it is accessed. Regions
+ * with this flag must not be accessed from a context that cannot block,
+ * e.g. with a spinlock held, and can therefore not be used for kernel stacks.
+ */
+#define VMM_FLAG_LAZY 0x80000
+
+/* Flags passed to vmm_handle_page_fault describing the faulting access */
+#define VMM_PF_FLAG_WRITE       (1U << 0)
+#define VMM_PF_FLAG_USER        (1U << 1)
+#define VMM_PF_FLAG_INSTRUCTION (1U << 2)
+
+/**
+ * vmm_handle_page_fault() - Populate a page of a lazy or copy-on-write region
+ * @vaddr:    Faulting virtual address.
+ * @pf_flags: VMM_PF_FLAG_* bits describing the access.
+ *
+ * Called by the architecture fault handlers on translation faults and on
+ * write permission faults. If @vaddr is inside a region created with
+ * VMM_FLAG_LAZY, or backed by an object with a get_private_page op, and the
+ * access is allowed by the region's permissions, the backing page is mapped
+ * (for writes to copy-on-write objects, after copying it) so the faulting
+ * instruction can be restarted.
+ *
+ * Return: NO_ERROR if the page is now mapped, an error code if the fault was
+ *         not handled and should be treated as fatal.
+ */
+status_t vmm_handle_page_fault(vaddr_t vaddr, uint pf_flags);
+
 /* allocate a new address space */
 status_t vmm_create_aspace(vmm_aspace_t **aspace, const char *name, uint flags);
 
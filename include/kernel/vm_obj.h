@@ -59,6 +59,18 @@ struct vmm_obj_ops {
      */
     int (*get_page)(struct vmm_obj *obj, size_t offset, paddr_t *paddr,
                     size_t *paddr_size);
+    /**
+     * @get_private_page: Optional function to get a writable page.
+     *
+     * If set, pages returned by @get_page may be shared with other objects,
+     * so the vmm maps them read-only. A write fault on such a page calls
+     * this function, which returns a page at @offset that is private to @obj,
+     * copying the shared page first if needed.
+     *
+     * Return 0 on success, error code to be passed to caller on failure.
+     */
+    int (*get_private_page)(struct vmm_obj *obj, size_t offset,
+                            paddr_t *paddr, size_t *paddr_size);
     /**
      * @destroy: Function to destroy object.
      *
@@ -171,13 +171,25 @@ static int cmd_threadload(int argc, const cmd_args *argv)
 #if WITH_KERNEL_EVLOG
 
 #include <lib/evlog.h>
+#include <pow2.h>
 
-static evlog_t kernel_evlog;
+/*
+ * One log per cpu, only written by that cpu with interrupts disabled, so
+ * events need no locking or atomics and cpus do not share a head. Each
+ * entry is 4 words: the time in microseconds, cpu << 16 | id, arg0, arg1.
+ * Microseconds take over an hour to wrap in a 32 bit word, nanoseconds only
+ * seconds.
+ */
+static evlog_t kernel_evlog[SMP_MAX_CPUS];
 volatile bool kernel_evlog_enable;
 
 void kernel_evlog_init(void)
 {
-    evlog_init(&kernel_evlog, KERNEL_EVLOG_LEN, 4);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (evlog_init(&kernel_evlog[i], KERNEL_EVLOG_LEN, 4) < 0) {
+            return;
+        }
+    }
 
     kernel_evlog_enable = true;
 }
@@ -185,12 +197,19 @@ void kernel_evlog_init(void)
 void kernel_evlog_add(uintptr_t id, uintptr_t arg0, uintptr_t arg1)
 {
     if (kernel_evlog_enable) {
-        uint index = evlog_bump_head(&kernel_evlog);
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-        kernel_evlog.items[index] = (uintptr_t)current_time_hires();
-        kernel_evlog.items[index+1] = (arch_curr_cpu_num() << 16) | id;
-        kernel_evlog.items[index+2] = arg0;
-        kernel_evlog.items[index+3] = arg1;
+        uint cpu = arch_curr_cpu_num();
+        evlog_t *e = &kernel_evlog[cpu];
+        uint index = evlog_bump_head(e);
+
+        e->items[index] = (uintptr_t)(current_time_ns() / 1000);
+        e->items[index+1] = (cpu << 16) | id;
+        e->items[index+2] = arg0;
+        e->items[index+3] = arg1;
+
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
     }
 }
 
@@ -198,34 +217,78 @@ void kernel_evlog_add(uintptr_t id, uintptr_t arg0, uintptr_t arg1)
 
 static void kevdump_cb(const uintptr_t *i)
 {
+    printf("%lu.%06lu cpu %lu: ", i[0] / 1000000, i[0] % 1000000, i[1] >> 16);
+
     switch (i[1] & 0xffff) {
         case KERNEL_EVLOG_CONTEXT_SWITCH:
-            printf("%lu.%lu: context switch from %p to %p\n", i[0], i[1] >> 16, (void *)i[2], (void *)i[3]);
+            printf("context switch from %p to %p\n", (void *)i[2], (void *)i[3]);
             break;
         case KERNEL_EVLOG_PREEMPT:
-            printf("%lu.%lu: preempt on thread %p\n", i[0], i[1] >> 16, (void *)i[2]);
+            printf("preempt on thread %p\n", (void *)i[2]);
             break;
         case KERNEL_EVLOG_TIMER_TICK:
-            printf("%lu.%lu: timer tick\n", i[0], i[1] >> 16);
+            printf("timer tick\n");
             break;
         case KERNEL_EVLOG_TIMER_CALL:
-            printf("%lu.%lu: timer call %p, arg %p\n", i[0], i[1] >> 16, (void *)i[2], (void *)i[3]);
+            printf("timer call %p, arg %p\n", (void *)i[2], (void *)i[3]);
             break;
         case KERNEL_EVLOG_IRQ_ENTER:
-            printf("%lu.%lu: irq entry %lu\n", i[0], i[1] >> 16, i[2]);
+            printf("irq entry %lu\n", i[2]);
             break;
         case KERNEL_EVLOG_IRQ_EXIT:
-            printf("%lu.%lu: irq exit  %lu\n", i[0], i[1] >> 16, i[2]);
+            printf("irq exit  %lu\n", i[2]);
             break;
         default:
-            printf("%lu: unknown id 0x%lx 0x%lx 0x%lx\n", i[0], i[1], i[2], i[3]);
+            printf("unknown id 0x%lx 0x%lx 0x%lx\n", i[1] & 0xffff, i[2], i[3]);
     }
 }
 
+/* merge the per cpu logs, oldest event first */
 void kernel_evlog_dump(void)
 {
+    uint pos[SMP_MAX_CPUS];
+    uint left[SMP_MAX_CPUS];
+
     kernel_evlog_enable = false;
-    evlog_dump(&kernel_evlog, &kevdump_cb);
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        evlog_t *e = &kernel_evlog[i];
+        /* like evlog_dump, leave out the slot at head, it is written next */
+        pos[i] = modpow2(e->head + e->unitsize, e->len_pow2);
+        left[i] = e->items ? (1U << e->len_pow2) / e->unitsize - 1 : 0;
+    }
+
+    for (;;) {
+        const uintptr_t *next = NULL;
+        uint next_cpu = 0;
+
+        for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+            evlog_t *e = &kernel_evlog[i];
+
+            /* skip slots that were never written */
+            while (left[i] &&
+                   (e->items[pos[i] + 1] & 0xffff) == KERNEL_EVLOG_NULL) {
+                pos[i] = modpow2(pos[i] + e->unitsize, e->len_pow2);
+                left[i]--;
+            }
+            /* timestamps wrap on 32 bit cpus, compare the difference */
+            if (left[i] &&
+                (!next || (intptr_t)(e->items[pos[i]] - next[0]) < 0)) {
+                next = &e->items[pos[i]];
+                next_cpu = i;
+            }
+        }
+        if (!next) {
+            break;
+        }
+
+        kevdump_cb(next);
+
+        evlog_t *e = &kernel_evlog[next_cpu];
+        pos[next_cpu] = modpow2(pos[next_cpu] + e->unitsize, e->len_pow2);
+        left[next_cpu]--;
+    }
+
     kernel_evlog_enable = true;
 }
 
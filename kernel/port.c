@@ -34,8 +34,19 @@
 #include <string.h>
 #include <pow2.h>
 #include <err.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <kernel/port.h>
+#include <lib/slab.h>
+#include <platform.h>
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
 
 // write ports can be in two states, open and closed, which have a
 // different magic number.
@@ -53,56 +64,184 @@
 
 #define MAX_PORT_GROUP_COUNT 256
 
+// named write ports live in a fixed size hash table; must be a power of 2.
+#define PORT_HASH_BUCKETS 256
+
+// locking: |port_lock| guards the port name table and every link between
+// ports (write port to read ports, port group to read ports). each write
+// port, port group and read port has its own spinlock guarding its buffer
+// and waiter count. locks are always taken in this order:
+//
+//   port_lock -> write_port_t.lock -> port_group_t.lock -> read_port_t.lock
+//
+// the thread lock is only taken, innermost, around the wait queue calls.
+// a reader drops its port lock only once it holds the thread lock, so a
+// writer that sees no waiters under the port lock never misses a wakeup.
+//
+// a port group keeps its members that have pending packets on |ready|,
+// linked by r_node under the group lock. port_write() appends to it and
+// group reads serve it round-robin. a member drained through its own
+// handle can linger on it; readers just drop it when found empty.
+//
+// blocked writers wait on the |space| queue of the read port that is full,
+// or of the write port itself while it has no readers. whoever frees space
+// wakes all of them and clears the count; a writer never touches the read
+// port again after blocking, since it may have been closed meanwhile. the
+// write port is counted in |writers| while they are blocked, and
+// port_destroy() waits on |drain| for them to leave before freeing it.
+
 typedef struct {
     uint log2;
     uint avail;
     uint head;
     uint tail;
+    uint high_water;
     port_packet_t packet[1];
 } port_buf_t;
 
+// counters, guarded by the lock of the port they are in. a read port adds
+// its counters to its write port when it is closed.
+struct port_stats {
+    uint64_t writes;
+    uint64_t reads;
+    uint64_t drops;
+    uint64_t wait_ns;
+};
+
 typedef struct {
     int magic;
+    spin_lock_t lock;
+    uint space_waiters;
+    wait_queue_t space;
+    uint writers;
+    wait_queue_t drain;
     struct list_node node;
     port_buf_t *buf;
     struct list_node rp_list;
     port_mode_t mode;
+    struct port_stats stats;
     char name[PORT_NAME_LEN];
 } write_port_t;
 
 typedef struct {
     int magic;
+    spin_lock_t lock;
+    uint waiters;
     wait_queue_t wait;
     struct list_node rp_list;
+    struct list_node ready;
 } port_group_t;
 
 typedef struct {
     int magic;
+    spin_lock_t lock;
+    uint waiters;
+    uint space_waiters;
+    port_mode_t mode;
     struct list_node w_node;
     struct list_node g_node;
+    struct list_node r_node;
     port_buf_t *buf;
     void *ctx;
     wait_queue_t wait;
+    wait_queue_t space;
     write_port_t *wport;
     port_group_t *gport;
+    struct port_stats stats;
 } read_port_t;
 
 
-static struct list_node write_port_list;
+#define PORT_BUF_BYTES(pk_count) \
+    (sizeof(port_buf_t) + (((pk_count) - 1) * sizeof(port_packet_t)))
 
+static struct list_node port_hash[PORT_HASH_BUCKETS];
+static uint port_count;
+static spin_lock_t port_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static KMEM_CACHE_DEFINE(write_port_cache, write_port_t, NULL);
+static KMEM_CACHE_DEFINE(read_port_cache, read_port_t, NULL);
+static KMEM_CACHE_DEFINE(port_group_cache, port_group_t, NULL);
+
+#if WITH_KERNEL_VM
+// a packet on a PORT_MODE_SLICE port is a pointer to one of these, which
+// owns the reference to the memory in flight.
+typedef struct {
+    struct vmm_obj_slice slice;
+} port_slice_t;
+
+static KMEM_CACHE_DEFINE(port_slice_cache, port_slice_t, NULL);
+
+static port_slice_t *packet_to_slice(const port_packet_t *pk)
+{
+    port_slice_t *ps;
+    STATIC_ASSERT(sizeof(ps) <= sizeof(pk->value));
+    memcpy(&ps, pk->value, sizeof(ps));
+    return ps;
+}
+
+static void free_slice(port_slice_t *ps)
+{
+    vmm_obj_slice_release(&ps->slice);
+    kmem_cache_free(&port_slice_cache, ps);
+}
+#endif
+static struct kmem_cache port_buf_cache =
+    KMEM_CACHE_INITIAL_VALUE(port_buf_cache, "port_buf",
+                             PORT_BUF_BYTES(PORT_BUFF_SIZE),
+                             __alignof__(port_buf_t), NULL);
+static struct kmem_cache port_buf_big_cache =
+    KMEM_CACHE_INITIAL_VALUE(port_buf_big_cache, "port_buf_big",
+                             PORT_BUF_BYTES(PORT_BUFF_SIZE_BIG),
+                             __alignof__(port_buf_t), NULL);
+
+// the two stock sizes come from slab caches, other sizes from the heap.
+static struct kmem_cache *buf_cache(uint pk_count)
+{
+    switch (pk_count) {
+    case PORT_BUFF_SIZE:
+        return &port_buf_cache;
+    case PORT_BUFF_SIZE_BIG:
+        return &port_buf_big_cache;
+    default:
+        return NULL;
+    }
+}
 
 static port_buf_t *make_buf(uint pk_count)
 {
-    uint size = sizeof(port_buf_t) + ((pk_count - 1) * sizeof(port_packet_t));
-    port_buf_t *buf = (port_buf_t *) malloc(size);
+    DEBUG_ASSERT(ispow2(pk_count));
+    struct kmem_cache *cache = buf_cache(pk_count);
+    port_buf_t *buf = cache ? kmem_cache_alloc(cache) :
+                              malloc(PORT_BUF_BYTES(pk_count));
     if (!buf)
         return NULL;
     buf->log2 = log2_uint(pk_count);
     buf->head = buf->tail = 0;
     buf->avail = pk_count;
+    buf->high_water = 0;
     return buf;
 }
 
+static void free_buf(port_buf_t *buf, port_mode_t mode)
+{
+    if (!buf)
+        return;
+#if WITH_KERNEL_VM
+    // release the memory of slices that were never read.
+    if (mode & PORT_MODE_SLICE) {
+        for (; buf->avail != valpow2(buf->log2); ++buf->avail) {
+            free_slice(packet_to_slice(&buf->packet[buf->head]));
+            buf->head = modpow2(buf->head + 1, buf->log2);
+        }
+    }
+#endif
+    struct kmem_cache *cache = buf_cache(valpow2(buf->log2));
+    if (cache)
+        kmem_cache_free(cache, buf);
+    else
+        free(buf);
+}
+
 static inline bool buf_is_empty(port_buf_t *buf)
 {
     return buf->avail == valpow2(buf->log2);
@@ -118,83 +257,164 @@ static status_t buf_write(port_buf_t *buf, const port_packet_t *packets, size_t
         buf->tail = modpow2(++buf->tail, buf->log2);
     }
     buf->avail -= count;
+    buf->high_water = MAX(buf->high_water, valpow2(buf->log2) - buf->avail);
     return NO_ERROR;
 }
 
-static status_t buf_read(port_buf_t *buf, port_result_t *pr)
+// reads up to |count| packets, returns how many were read.
+static size_t buf_read(port_buf_t *buf, void *ctx, port_result_t *pr, size_t count)
 {
-    if (buf_is_empty(buf))
-        return ERR_NO_MSG;
-    pr->packet = buf->packet[buf->head];
-    buf->head = modpow2(++buf->head, buf->log2);
-    ++buf->avail;
-    return NO_ERROR;
+    size_t ix;
+    for (ix = 0; ix != count && !buf_is_empty(buf); ix++) {
+        pr[ix].ctx = ctx;
+        pr[ix].packet = buf->packet[buf->head];
+        buf->head = modpow2(++buf->head, buf->log2);
+        ++buf->avail;
+    }
+    return ix;
+}
+
+// blocks on |wait| with |lock| held and interrupts disabled. |lock| is
+// dropped only after the thread lock is taken and is re-acquired on return
+// unless the wait queue was destroyed, in which case the port is gone.
+static status_t port_block(spin_lock_t *lock, wait_queue_t *wait, lk_time_t timeout)
+{
+    thread_lock_ints_disabled();
+    spin_unlock(lock);
+    status_t rc = wait_queue_block(wait, timeout);
+    thread_unlock_ints_disabled();
+    if (rc != ERR_OBJECT_DESTROYED)
+        spin_lock(lock);
+    return rc;
+}
+
+static int port_wake(wait_queue_t *wait, bool all, status_t error)
+{
+    thread_lock_ints_disabled();
+    int woken = all ? wait_queue_wake_all(wait, false, error) :
+                      wait_queue_wake_one(wait, false, error);
+    thread_unlock_ints_disabled();
+    return woken;
+}
+
+static void port_wake_space(wait_queue_t *space, uint *space_waiters, status_t error)
+{
+    if (*space_waiters) {
+        port_wake(space, true, error);
+        *space_waiters = 0;
+    }
+}
+
+static void port_destroy_wait(wait_queue_t *wait)
+{
+    thread_lock_ints_disabled();
+    wait_queue_destroy(wait, false);
+    thread_unlock_ints_disabled();
 }
 
 // must be called before any use of ports.
 void port_init(void)
 {
-    list_initialize(&write_port_list);
+    for (uint ix = 0; ix != countof(port_hash); ix++)
+        list_initialize(&port_hash[ix]);
+}
+
+// FNV-1a, names are short so this is cheap and spreads well.
+static struct list_node *port_bucket(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return &port_hash[hash & (PORT_HASH_BUCKETS - 1)];
+}
+
+// called with |port_lock| held.
+static write_port_t *port_lookup(struct list_node *bucket, const char *name)
+{
+    write_port_t *wp;
+    list_for_every_entry(bucket, wp, write_port_t, node) {
+        if (strcmp(wp->name, name) == 0)
+            return wp;
+    }
+    return NULL;
 }
 
 status_t port_create(const char *name, port_mode_t mode, port_t *port)
+{
+    uint size = (mode & PORT_MODE_BIG_BUFFER) ?  PORT_BUFF_SIZE_BIG : PORT_BUFF_SIZE;
+    return port_create_etc(name, mode, size, port);
+}
+
+status_t port_create_etc(const char *name, port_mode_t mode, uint pk_count, port_t *port)
 {
     if (!name || !port)
         return ERR_INVALID_ARGS;
 
-    // only unicast ports can have a large buffer.
-    if (mode & PORT_MODE_BROADCAST) {
-        if (mode & PORT_MODE_BIG_BUFFER)
+    if (!ispow2(pk_count) || pk_count < PORT_BUFF_SIZE || pk_count > PORT_BUFF_SIZE_MAX)
+        return ERR_INVALID_ARGS;
+
+    // only unicast ports can have a large buffer or carry slices.
+    if (!(mode & PORT_MODE_UNICAST)) {
+        if (pk_count != PORT_BUFF_SIZE || (mode & PORT_MODE_SLICE))
             return ERR_INVALID_ARGS;
     }
 
+#if !WITH_KERNEL_VM
+    if (mode & PORT_MODE_SLICE)
+        return ERR_NOT_SUPPORTED;
+#endif
+
     if (strlen(name) >= PORT_NAME_LEN)
         return ERR_INVALID_ARGS;
 
-    // lookup for existing port, return that if found.
-    write_port_t *wp = NULL;
-    THREAD_LOCK(state1);
-    list_for_every_entry(&write_port_list, wp, write_port_t, node) {
-        if (strcmp(wp->name, name) == 0) {
-            // can't return closed ports.
-            if (wp->magic == WRITEPORT_MAGIC_X)
-                wp = NULL;
-            THREAD_UNLOCK(state1);
-            if (wp) {
-                *port = (void *) wp;
-                return ERR_ALREADY_EXISTS;
-            } else {
-                return ERR_BUSY;
-            }
-        }
-    }
-    THREAD_UNLOCK(state1);
-
-    // not found, create the write port and the circular buffer.
-    wp = calloc(1, sizeof(write_port_t));
+    // assume success; create the write port and the circular buffer now so
+    // that the lookup and the insert below happen under one lock hold.
+    write_port_t *wp = kmem_cache_zalloc(&write_port_cache);
     if (!wp)
         return ERR_NO_MEMORY;
 
     wp->magic = WRITEPORT_MAGIC_W;
+    spin_lock_init(&wp->lock);
+    wait_queue_init(&wp->space);
+    wait_queue_init(&wp->drain);
     wp->mode = mode;
     strlcpy(wp->name, name, sizeof(wp->name));
     list_initialize(&wp->rp_list);
 
-    uint size = (mode & PORT_MODE_BIG_BUFFER) ?  PORT_BUFF_SIZE_BIG : PORT_BUFF_SIZE;
-    wp->buf = make_buf(size);
+    wp->buf = make_buf(pk_count);
     if (!wp->buf) {
-        free(wp);
+        kmem_cache_free(&write_port_cache, wp);
         return ERR_NO_MEMORY;
     }
 
-    // todo: race condtion! a port with the same name could have been created
-    // by another thread at is point.
-    THREAD_LOCK(state2);
-    list_add_tail(&write_port_list, &wp->node);
-    THREAD_UNLOCK(state2);
+    // lookup for existing port, return that if found.
+    status_t rc = NO_ERROR;
+    struct list_node *bucket = port_bucket(name);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock, state);
+    write_port_t *existing = port_lookup(bucket, name);
+    if (existing) {
+        // can't return closed ports.
+        if (existing->magic == WRITEPORT_MAGIC_X) {
+            rc = ERR_BUSY;
+        } else {
+            rc = ERR_ALREADY_EXISTS;
+            *port = (void *)existing;
+        }
+    } else {
+        list_add_tail(bucket, &wp->node);
+        port_count++;
+        *port = (void *)wp;
+    }
+    spin_unlock_irqrestore(&port_lock, state);
 
-    *port = (void *)wp;
-    return NO_ERROR;
+    if (existing) {
+        free_buf(wp->buf, mode);
+        kmem_cache_free(&write_port_cache, wp);
+    }
+    return rc;
 }
 
 status_t port_open(const char *name, void *ctx, port_t *port)
@@ -203,12 +423,14 @@ status_t port_open(const char *name, void *ctx, port_t *port)
         return ERR_INVALID_ARGS;
 
     // assume success; create the read port and buffer now.
-    read_port_t *rp = calloc(1, sizeof(read_port_t));
+    read_port_t *rp = kmem_cache_zalloc(&read_port_cache);
     if (!rp)
         return ERR_NO_MEMORY;
 
     rp->magic = READPORT_MAGIC;
+    spin_lock_init(&rp->lock);
     wait_queue_init(&rp->wait);
+    wait_queue_init(&rp->space);
     rp->ctx = ctx;
 
     // |buf| might not be needed, but we always allocate outside the lock.
@@ -216,57 +438,100 @@ status_t port_open(const char *name, void *ctx, port_t *port)
     // that here.
     port_buf_t *buf = make_buf(PORT_BUFF_SIZE);
     if (!buf) {
-        free(rp);
+        kmem_cache_free(&read_port_cache, rp);
         return ERR_NO_MEMORY;
     }
 
     // find the named write port and associate it with read port.
     status_t rc = ERR_NOT_FOUND;
 
-    THREAD_LOCK(state);
-    write_port_t *wp = NULL;
-    list_for_every_entry(&write_port_list, wp, write_port_t, node) {
-        if (strcmp(wp->name, name) == 0) {
-            // found; add read port to write port list.
-            rp->wport = wp;
-            if (wp->buf) {
-                // this is the first read port; transfer the circular buffer.
-                list_add_tail(&wp->rp_list, &rp->w_node);
-                rp->buf = wp->buf;
-                wp->buf = NULL;
-                rc = NO_ERROR;
-            } else if (buf) {
-                // not first read port.
-                if (wp->mode & PORT_MODE_UNICAST) {
-                    // cannot add a second listener.
-                    rc = ERR_NOT_ALLOWED;
-                    break;
-                }
-                // use the new (small) circular buffer.
-                list_add_tail(&wp->rp_list, &rp->w_node);
-                rp->buf = buf;
-                buf = NULL;
-                rc = NO_ERROR;
-            } else {
-                // |buf| allocation failed and the buffer was needed.
-                rc = ERR_NO_MEMORY;
-            }
-            break;
+    struct list_node *bucket = port_bucket(name);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock, state);
+    write_port_t *wp = port_lookup(bucket, name);
+    if (wp) {
+        // found; add read port to write port list.
+        spin_lock(&wp->lock);
+        rp->wport = wp;
+        rp->mode = wp->mode;
+        if (wp->buf) {
+            // this is the first read port; transfer the circular buffer.
+            // writers blocked on it now need to wait on the read port.
+            list_add_tail(&wp->rp_list, &rp->w_node);
+            rp->buf = wp->buf;
+            wp->buf = NULL;
+            port_wake_space(&wp->space, &wp->space_waiters, NO_ERROR);
+            rc = NO_ERROR;
+        } else if (wp->mode & PORT_MODE_UNICAST) {
+            // not first read port, cannot add a second listener.
+            rc = ERR_NOT_ALLOWED;
+        } else {
+            // not first read port; use the new (small) circular buffer.
+            list_add_tail(&wp->rp_list, &rp->w_node);
+            rp->buf = buf;
+            buf = NULL;
+            rc = NO_ERROR;
         }
+        spin_unlock(&wp->lock);
     }
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&port_lock, state);
 
-    if (buf)
-        free(buf);
+    free_buf(buf, 0);
 
     if (rc == NO_ERROR) {
         *port = (void *)rp;
     } else {
-        free(rp);
+        kmem_cache_free(&read_port_cache, rp);
     }
     return rc;
 }
 
+// links |rp| into |pg| and wakes a group reader if |rp| has pending packets.
+// called with |port_lock| held; the write port lock keeps a concurrent
+// port_write() from seeing a half linked read port.
+static void group_link(port_group_t *pg, read_port_t *rp)
+{
+    write_port_t *wp = rp->wport;
+    if (wp)
+        spin_lock(&wp->lock);
+    spin_lock(&pg->lock);
+
+    rp->gport = pg;
+    list_add_tail(&pg->rp_list, &rp->g_node);
+
+    spin_lock(&rp->lock);
+    bool pending = !buf_is_empty(rp->buf);
+    spin_unlock(&rp->lock);
+
+    if (pending) {
+        list_add_tail(&pg->ready, &rp->r_node);
+        if (pg->waiters)
+            port_wake(&pg->wait, false, NO_ERROR);
+    }
+
+    spin_unlock(&pg->lock);
+    if (wp)
+        spin_unlock(&wp->lock);
+}
+
+// inverse of group_link(), same locking rules.
+static void group_unlink(port_group_t *pg, read_port_t *rp)
+{
+    write_port_t *wp = rp->wport;
+    if (wp)
+        spin_lock(&wp->lock);
+    spin_lock(&pg->lock);
+
+    list_delete(&rp->g_node);
+    if (list_in_list(&rp->r_node))
+        list_delete(&rp->r_node);
+    rp->gport = NULL;
+
+    spin_unlock(&pg->lock);
+    if (wp)
+        spin_unlock(&wp->lock);
+}
+
 status_t port_group(port_t *ports, size_t count, port_t *group)
 {
     if (count > MAX_PORT_GROUP_COUNT)
@@ -280,38 +545,41 @@ status_t port_group(port_t *ports, size_t count, port_t *group)
         return ERR_INVALID_ARGS;
 
     // assume success; create port group now.
-    port_group_t *pg = calloc(1, sizeof(port_group_t));
+    port_group_t *pg = kmem_cache_zalloc(&port_group_cache);
     if (!pg)
         return ERR_NO_MEMORY;
 
     pg->magic = PORTGROUP_MAGIC;
+    spin_lock_init(&pg->lock);
     wait_queue_init(&pg->wait);
     list_initialize(&pg->rp_list);
+    list_initialize(&pg->ready);
 
     status_t rc = NO_ERROR;
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock, state);
     for (size_t ix = 0; ix != count; ix++) {
         read_port_t *rp = (read_port_t *)ports[ix];
-        if ((rp->magic != READPORT_MAGIC) || rp->gport) {
+        if ((rp->magic != READPORT_MAGIC) || rp->gport ||
+                (rp->mode & PORT_MODE_SLICE)) {
             // wrong type of port, or port already part of a group,
             // in any case, undo the changes to the previous read ports.
             for (size_t jx = 0; jx != ix; jx++) {
-                ((read_port_t *)ports[jx])->gport = NULL;
+                group_unlink(pg, (read_port_t *)ports[jx]);
             }
             rc = ERR_BAD_HANDLE;
             break;
         }
         // link port group and read port.
-        rp->gport = pg;
-        list_add_tail(&pg->rp_list, &rp->g_node);
+        group_link(pg, rp);
     }
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&port_lock, state);
 
     if (rc == NO_ERROR) {
         *group = (port_t *)pg;
     } else {
-        free(pg);
+        kmem_cache_free(&port_group_cache, pg);
     }
     return rc;
 }
@@ -326,27 +594,26 @@ status_t port_group_add(port_t group, port_t port)
     if (pg->magic != PORTGROUP_MAGIC)
         return ERR_INVALID_ARGS;
 
+    // slices can only be read with port_read_slice().
     read_port_t *rp = (read_port_t *)port;
-    if (rp->magic != READPORT_MAGIC || rp->gport)
+    if (rp->magic != READPORT_MAGIC || (rp->mode & PORT_MODE_SLICE))
         return ERR_BAD_HANDLE;
 
     status_t rc = NO_ERROR;
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock, state);
 
-    if (list_length(&pg->rp_list) == MAX_PORT_GROUP_COUNT) {
+    if (rp->gport) {
+        rc = ERR_BAD_HANDLE;
+    } else if (list_length(&pg->rp_list) == MAX_PORT_GROUP_COUNT) {
         rc = ERR_TOO_BIG;
     } else {
-        rp->gport = pg;
-        list_add_tail(&pg->rp_list, &rp->g_node);
-        
-        // If the new read port being added has messages available, try to wake
-        // any readers that might be present.
-        if (!buf_is_empty(rp->buf)) {
-            wait_queue_wake_one(&pg->wait, false, NO_ERROR);
-        }
+        // If the new read port being added has messages available, this
+        // wakes any readers that might be present.
+        group_link(pg, rp);
     }
 
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&port_lock, state);
 
     return rc;
 }
@@ -362,72 +629,184 @@ status_t port_group_remove(port_t group, port_t port)
         return ERR_INVALID_ARGS;
 
     read_port_t *rp = (read_port_t *)port;
-    if (rp->magic != READPORT_MAGIC || rp->gport != pg)
+    if (rp->magic != READPORT_MAGIC)
         return ERR_BAD_HANDLE;
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock, state);
 
     bool found = false;
     read_port_t *current_rp;
     list_for_every_entry(&pg->rp_list, current_rp, read_port_t, g_node) {
         if (current_rp == rp) {
             found = true;
+            break;
         }
     }
 
-    if (!found)
-        return ERR_BAD_HANDLE;
+    if (found)
+        group_unlink(pg, rp);
 
-    list_delete(&rp->g_node);
+    spin_unlock_irqrestore(&port_lock, state);
 
-    THREAD_UNLOCK(state);
-
-    return NO_ERROR;
+    return found ? NO_ERROR : ERR_BAD_HANDLE;
 }
 
 status_t port_write(port_t port, const port_packet_t *pk, size_t count)
+{
+    return port_write_etc(port, pk, count, 0);
+}
+
+// returns the first read port that cannot take |count| more packets, with
+// its lock held, or NULL if they all can. called with wp->lock held.
+static read_port_t *find_full_reader(write_port_t *wp, size_t count)
+{
+    read_port_t *rp;
+    list_for_every_entry(&wp->rp_list, rp, read_port_t, w_node) {
+        spin_lock(&rp->lock);
+        if (rp->buf->avail < count)
+            return rp;
+        spin_unlock(&rp->lock);
+    }
+    return NULL;
+}
+
+// blocks a writer on |space|, which belongs to |wp| or to one of its read
+// ports. called with wp->lock held and |rp_lock| too if not NULL; both are
+// dropped while blocked, and wp->lock is always held again on return.
+static status_t port_block_writer(write_port_t *wp, spin_lock_t *rp_lock,
+                                  wait_queue_t *space, lk_time_t timeout)
+{
+    wp->writers++;
+    thread_lock_ints_disabled();
+    if (rp_lock)
+        spin_unlock(rp_lock);
+    spin_unlock(&wp->lock);
+    status_t rc = wait_queue_block(space, timeout);
+    thread_unlock_ints_disabled();
+    spin_lock(&wp->lock);
+    if (--wp->writers == 0 && wp->magic != WRITEPORT_MAGIC_W)
+        port_wake(&wp->drain, true, NO_ERROR);
+    return rc;
+}
+
+// waits until every buffer of |wp| has room for |count| packets. called
+// with wp->lock held, which is dropped while blocked.
+static status_t wait_for_space(write_port_t *wp, size_t count, lk_time_t timeout)
+{
+    while (true) {
+        if (wp->magic != WRITEPORT_MAGIC_W) {
+            // closed while we were blocked.
+            return ERR_CANCELLED;
+        }
+
+        if (wp->buf) {
+            // no readers, wait for one to open or for the port to close.
+            if (count > valpow2(wp->buf->log2))
+                return ERR_TOO_BIG;
+            if (wp->buf->avail >= count)
+                return NO_ERROR;
+
+            wp->space_waiters++;
+            status_t rc = port_block_writer(wp, NULL, &wp->space, timeout);
+            if (rc != NO_ERROR)
+                return rc;
+            continue;
+        }
+
+        read_port_t *rp = find_full_reader(wp, count);
+        if (!rp)
+            return NO_ERROR;
+
+        if (count > valpow2(rp->buf->log2)) {
+            spin_unlock(&rp->lock);
+            return ERR_TOO_BIG;
+        }
+
+        rp->space_waiters++;
+        status_t rc = port_block_writer(wp, &rp->lock, &rp->space, timeout);
+
+        // a closed read port is not an error, the buffer layout changed
+        // so just look again.
+        if (rc != NO_ERROR && rc != ERR_OBJECT_DESTROYED)
+            return rc;
+    }
+}
+
+// |slices| says whether the caller is port_write_slice(); slice ports only
+// take packets from it and other ports never do.
+static status_t write_packets(port_t port, const port_packet_t *pk, size_t count,
+                              lk_time_t timeout, bool slices)
 {
     if (!port || !pk)
         return ERR_INVALID_ARGS;
 
     write_port_t *wp = (write_port_t *)port;
-    THREAD_LOCK(state);
-    if (wp->magic != WRITEPORT_MAGIC_W) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&wp->lock, state);
+    if (wp->magic != WRITEPORT_MAGIC_W || !(wp->mode & PORT_MODE_SLICE) != !slices) {
         // wrong port type.
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&wp->lock, state);
         return ERR_BAD_HANDLE;
     }
 
     status_t status = NO_ERROR;
     int awake_count = 0;
 
+    if (timeout) {
+        status = wait_for_space(wp, count, timeout);
+        if (status != NO_ERROR)
+            goto done;
+    }
+
+    bool delivered = false;
     if (wp->buf) {
         // there are no read ports, just write to the buffer.
         status = buf_write(wp->buf, pk, count);
+        delivered = status == NO_ERROR;
     } else {
         // there are read ports. for each, write and attempt to wake a thread
-        // from the port group or from the read port itself.
+        // from the port group or from the read port itself. the thread lock
+        // is only needed if somebody is actually waiting.
         read_port_t *rp;
         list_for_every_entry(&wp->rp_list, rp, read_port_t, w_node) {
+            port_group_t *pg = rp->gport;
+            if (pg)
+                spin_lock(&pg->lock);
+            spin_lock(&rp->lock);
+
             if (buf_write(rp->buf, pk, count) < 0) {
                 // buffer full.
                 status = ERR_PARTIAL_WRITE;
-                continue;
-            }
-
-            int awaken = 0;
-            if (rp->gport) {
-                awaken = wait_queue_wake_one(&rp->gport->wait, false, NO_ERROR);
-            }
-            if (!awaken) {
-                awaken = wait_queue_wake_one(&rp->wait, false, NO_ERROR);
+                wp->stats.drops += count;
+            } else {
+                delivered = true;
+                if (pg && !list_in_list(&rp->r_node)) {
+                    list_add_tail(&pg->ready, &rp->r_node);
+                }
+                int awaken = 0;
+                if (pg && pg->waiters) {
+                    awaken = port_wake(&pg->wait, false, NO_ERROR);
+                }
+                if (!awaken && rp->waiters) {
+                    awaken = port_wake(&rp->wait, false, NO_ERROR);
+                }
+                awake_count += awaken;
             }
 
-            awake_count += awaken;
+            spin_unlock(&rp->lock);
+            if (pg)
+                spin_unlock(&pg->lock);
         }
     }
 
-    THREAD_UNLOCK(state);
+    if (delivered)
+        wp->stats.writes += count;
+    else if (wp->buf)
+        wp->stats.drops += count;
+
+done:
+    spin_unlock_irqrestore(&wp->lock, state);
 
 #if RESCHEDULE_POLICY
     if (awake_count)
@@ -437,61 +816,183 @@ status_t port_write(port_t port, const port_packet_t *pk, size_t count)
     return status;
 }
 
-static inline status_t read_no_lock(read_port_t *rp, lk_time_t timeout, port_result_t *result)
+status_t port_write_etc(port_t port, const port_packet_t *pk, size_t count,
+                        lk_time_t timeout)
 {
-    status_t status = buf_read(rp->buf, result);
-    result->ctx = rp->ctx;
+    return write_packets(port, pk, count, timeout, false);
+}
 
-    if (status != ERR_NO_MSG)
-        return status;
+// called with rp->lock held, returns the number of packets read. on
+// ERR_OBJECT_DESTROYED the port was closed while blocked and the lock is no
+// longer held.
+static ssize_t read_locked(read_port_t *rp, lk_time_t timeout,
+                           port_result_t *results, size_t count)
+{
+    while (true) {
+        size_t read = buf_read(rp->buf, rp->ctx, results, count);
+        rp->stats.reads += read;
+        if (read) {
+            port_wake_space(&rp->space, &rp->space_waiters, NO_ERROR);
+            return read;
+        }
 
-    // early return allows compiler to elide the rest for the group read case.
-    if (!timeout)
-        return ERR_TIMED_OUT;
+        // early return allows compiler to elide the rest for the group read case.
+        if (!timeout)
+            return ERR_TIMED_OUT;
+
+        rp->waiters++;
+        lk_time_ns_t start = current_time_ns();
+        status_t wr = port_block(&rp->lock, &rp->wait, timeout);
+        if (wr == ERR_OBJECT_DESTROYED)
+            return wr;
+        rp->stats.wait_ns += current_time_ns() - start;
+        rp->waiters--;
+        if (wr != NO_ERROR)
+            return wr;
+    }
+}
+
+// called with pg->lock held, same contract as read_locked().
+static ssize_t group_read_locked(port_group_t *pg, lk_time_t timeout,
+                                 port_result_t *results, size_t count)
+{
+    lk_time_ns_t waited = 0;
+    while (true) {
+        // take one packet from the head of the ready list at a time and
+        // requeue the port at the tail if it has more, so that a busy port
+        // cannot starve the others.
+        size_t read = 0;
+        read_port_t *rp;
+        while (read != count &&
+               (rp = list_remove_head_type(&pg->ready, read_port_t, r_node))) {
+            spin_lock(&rp->lock);
+            ssize_t rc = read_locked(rp, 0, results + read, 1);
+            if (rc > 0) {
+                // the time spent blocked on the group goes to the port that
+                // ended the wait.
+                rp->stats.wait_ns += waited;
+                waited = 0;
+                read += rc;
+                if (!buf_is_empty(rp->buf))
+                    list_add_tail(&pg->ready, &rp->r_node);
+            }
+            spin_unlock(&rp->lock);
+        }
 
-    status_t wr = wait_queue_block(&rp->wait, timeout);
-    if (wr != NO_ERROR)
-        return wr;
-    // recursive tail call is usually optimized away with a goto.
-    return read_no_lock(rp, timeout, result);
+        if (read)
+            return read;
+
+        if (!timeout)
+            return ERR_TIMED_OUT;
+
+        // no data, block on the group waitqueue.
+        pg->waiters++;
+        lk_time_ns_t start = current_time_ns();
+        status_t wr = port_block(&pg->lock, &pg->wait, timeout);
+        if (wr == ERR_OBJECT_DESTROYED)
+            return wr;
+        waited += current_time_ns() - start;
+        pg->waiters--;
+        if (wr != NO_ERROR)
+            return wr;
+    }
 }
 
 status_t port_read(port_t port, lk_time_t timeout, port_result_t *result)
 {
-    if (!port || !result)
+    ssize_t rc = port_read_many(port, timeout, result, 1);
+    return rc < 0 ? (status_t)rc : NO_ERROR;
+}
+
+static ssize_t read_packets(port_t port, lk_time_t timeout, port_result_t *results,
+                            size_t count, bool slices)
+{
+    if (!port || !results || !count)
         return ERR_INVALID_ARGS;
 
-    status_t rc = ERR_GENERIC;
+    ssize_t rc;
+    spin_lock_t *lock;
+    spin_lock_saved_state_t state;
     read_port_t *rp = (read_port_t *)port;
 
-    THREAD_LOCK(state);
     if (rp->magic == READPORT_MAGIC) {
         // dealing with a single port.
-        rc = read_no_lock(rp, timeout, result);
-    } else if (rp->magic == PORTGROUP_MAGIC) {
+        if (!(rp->mode & PORT_MODE_SLICE) != !slices)
+            return ERR_BAD_HANDLE;
+        lock = &rp->lock;
+        spin_lock_irqsave(lock, state);
+        rc = read_locked(rp, timeout, results, count);
+    } else if (rp->magic == PORTGROUP_MAGIC && !slices) {
         // dealing with a port group.
         port_group_t *pg = (port_group_t *)port;
-        do {
-            // read each port with no timeout.
-            // todo: this order is fixed, probably a bad thing.
-            list_for_every_entry(&pg->rp_list, rp, read_port_t, g_node) {
-                rc = read_no_lock(rp, 0, result);
-                if (rc != ERR_TIMED_OUT)
-                    goto read_exit;
-            }
-            // no data, block on the group waitqueue.
-            rc = wait_queue_block(&pg->wait, timeout);
-        } while (rc == NO_ERROR);
+        lock = &pg->lock;
+        spin_lock_irqsave(lock, state);
+        rc = group_read_locked(pg, timeout, results, count);
     } else {
         // wrong port type.
-        rc = ERR_BAD_HANDLE;
+        return ERR_BAD_HANDLE;
     }
 
-read_exit:
-    THREAD_UNLOCK(state);
+    if (rc == ERR_OBJECT_DESTROYED) {
+        // the port is gone and so is its lock, only restore interrupts.
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    } else {
+        spin_unlock_irqrestore(lock, state);
+    }
     return rc;
 }
 
+ssize_t port_read_many(port_t port, lk_time_t timeout, port_result_t *results,
+                       size_t count)
+{
+    return read_packets(port, timeout, results, count, false);
+}
+
+#if WITH_KERNEL_VM
+status_t port_write_slice(port_t port, struct vmm_obj_slice *slice, lk_time_t timeout)
+{
+    if (!slice || !slice->obj)
+        return ERR_INVALID_ARGS;
+
+    // take our own reference for the trip, the caller's is dropped only once
+    // the write succeeded.
+    port_slice_t *ps = kmem_cache_alloc(&port_slice_cache);
+    if (!ps)
+        return ERR_NO_MEMORY;
+    vmm_obj_slice_init(&ps->slice);
+    vmm_obj_slice_bind(&ps->slice, slice->obj, slice->offset, slice->size);
+
+    port_packet_t pk;
+    memcpy(pk.value, &ps, sizeof(ps));
+    status_t rc = write_packets(port, &pk, 1, timeout, true);
+    if (rc == NO_ERROR) {
+        vmm_obj_slice_release(slice);
+    } else {
+        free_slice(ps);
+    }
+    return rc;
+}
+
+status_t port_read_slice(port_t port, lk_time_t timeout, struct vmm_obj_slice *slice,
+                         void **ctx)
+{
+    if (!slice || slice->obj)
+        return ERR_INVALID_ARGS;
+
+    port_result_t pr;
+    ssize_t rc = read_packets(port, timeout, &pr, 1, true);
+    if (rc < 0)
+        return rc;
+
+    port_slice_t *ps = packet_to_slice(&pr.packet);
+    vmm_obj_slice_bind(slice, ps->slice.obj, ps->slice.offset, ps->slice.size);
+    free_slice(ps);
+    if (ctx)
+        *ctx = pr.ctx;
+    return NO_ERROR;
+}
+#endif
+
 status_t port_destroy(port_t port)
 {
     if (!port)
@@ -500,14 +1001,30 @@ status_t port_destroy(port_t port)
     write_port_t *wp = (write_port_t *) port;
     port_buf_t *buf = NULL;
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&wp->lock, state);
     if (wp->magic != WRITEPORT_MAGIC_X) {
         // wrong port type.
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&wp->lock, state);
         return ERR_BAD_HANDLE;
     }
-    // remove self from global named ports list.
+    // writers failed by port_close() may still be on their way out. none
+    // can block anew, the port is closed.
+    while (wp->writers)
+        port_block(&wp->lock, &wp->drain, INFINITE_TIME);
+    spin_unlock(&wp->lock);
+
+    spin_lock(&port_lock);
+    spin_lock(&wp->lock);
+    if (wp->magic != WRITEPORT_MAGIC_X) {
+        // wrong port type.
+        spin_unlock(&wp->lock);
+        spin_unlock_irqrestore(&port_lock, state);
+        return ERR_BAD_HANDLE;
+    }
+    // remove self from the port name table.
     list_delete(&wp->node);
+    port_count--;
 
     if (wp->buf) {
         // we have no readers.
@@ -516,21 +1033,31 @@ status_t port_destroy(port_t port)
         // for each reader:
         read_port_t *rp;
         list_for_every_entry(&wp->rp_list, rp, read_port_t, w_node) {
+            port_group_t *pg = rp->gport;
+            if (pg)
+                spin_lock(&pg->lock);
+            spin_lock(&rp->lock);
             // wake the read and group ports.
-            wait_queue_wake_all(&rp->wait, false, ERR_CANCELLED);
-            if (rp->gport) {
-                wait_queue_wake_all(&rp->gport->wait, false, ERR_CANCELLED);
+            port_wake(&rp->wait, true, ERR_CANCELLED);
+            if (pg) {
+                port_wake(&pg->wait, true, ERR_CANCELLED);
             }
             // remove self from reader ports.
             rp->wport = NULL;
+            spin_unlock(&rp->lock);
+            if (pg)
+                spin_unlock(&pg->lock);
         }
     }
 
+    port_destroy_wait(&wp->space);
+    port_destroy_wait(&wp->drain);
     wp->magic = 0;
-    THREAD_UNLOCK(state);
+    spin_unlock(&wp->lock);
+    spin_unlock_irqrestore(&port_lock, state);
 
-    free(buf);
-    free(wp);
+    free_buf(buf, wp->mode);
+    kmem_cache_free(&write_port_cache, wp);
     return NO_ERROR;
 }
 
@@ -541,57 +1068,200 @@ status_t port_close(port_t port)
 
     read_port_t *rp = (read_port_t *) port;
     port_buf_t *buf = NULL;
+    port_mode_t mode = 0;
+    struct kmem_cache *cache;
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock, state);
     if (rp->magic == READPORT_MAGIC) {
         // dealing with a read port.
-        if (rp->wport) {
+        cache = &read_port_cache;
+        write_port_t *wp = rp->wport;
+        port_group_t *pg = rp->gport;
+        if (wp)
+            spin_lock(&wp->lock);
+        if (pg)
+            spin_lock(&pg->lock);
+        spin_lock(&rp->lock);
+
+        mode = rp->mode;
+        if (wp) {
             // remove self from write port list and reassign the bufer if last.
             list_delete(&rp->w_node);
-            if (list_is_empty(&rp->wport->rp_list)) {
-                rp->wport->buf = rp->buf;
+            wp->stats.reads += rp->stats.reads;
+            wp->stats.wait_ns += rp->stats.wait_ns;
+            if (list_is_empty(&wp->rp_list)) {
+                wp->buf = rp->buf;
                 rp->buf = NULL;
             } else {
                 buf = rp->buf;
             }
+        } else {
+            // the write port is gone, nobody else owns the buffer.
+            buf = rp->buf;
         }
-        if (rp->gport) {
-            // remove self from port group list.
+        if (pg) {
+            // remove self from port group lists.
             list_delete(&rp->g_node);
+            if (list_in_list(&rp->r_node))
+                list_delete(&rp->r_node);
         }
-        // wake up waiters, the return code is ERR_OBJECT_DESTROYED.
-        wait_queue_destroy(&rp->wait, true);
+        // wake up readers, the return code is ERR_OBJECT_DESTROYED. blocked
+        // writers see the same code and retry against the new layout.
+        port_destroy_wait(&rp->wait);
+        port_destroy_wait(&rp->space);
         rp->magic = 0;
 
+        spin_unlock(&rp->lock);
+        if (pg)
+            spin_unlock(&pg->lock);
+        if (wp)
+            spin_unlock(&wp->lock);
+
     } else if (rp->magic == PORTGROUP_MAGIC) {
         // dealing with a port group.
         port_group_t *pg = (port_group_t *) port;
-        // wake up waiters.
-        wait_queue_destroy(&pg->wait, true);
-        // remove self from reader ports.
-        rp = NULL;
-        list_for_every_entry(&pg->rp_list, rp, read_port_t, g_node) {
-            rp->gport = NULL;
+        cache = &port_group_cache;
+        // remove self from reader ports first so that no writer can reach
+        // the group once its lock is released.
+        read_port_t *tmp;
+        list_for_every_entry_safe(&pg->rp_list, rp, tmp, read_port_t, g_node) {
+            group_unlink(pg, rp);
         }
+        // wake up waiters.
+        spin_lock(&pg->lock);
+        port_destroy_wait(&pg->wait);
         pg->magic = 0;
+        spin_unlock(&pg->lock);
 
     } else if (rp->magic == WRITEPORT_MAGIC_W) {
         // dealing with a write port.
         write_port_t *wp = (write_port_t *) port;
         // mark it as closed. Now it can be read but not written to.
+        spin_lock(&wp->lock);
         wp->magic = WRITEPORT_MAGIC_X;
-        THREAD_UNLOCK(state);
+        // fail writers blocked waiting for space.
+        port_wake_space(&wp->space, &wp->space_waiters, ERR_CANCELLED);
+        read_port_t *wrp;
+        list_for_every_entry(&wp->rp_list, wrp, read_port_t, w_node) {
+            spin_lock(&wrp->lock);
+            port_wake_space(&wrp->space, &wrp->space_waiters, ERR_CANCELLED);
+            spin_unlock(&wrp->lock);
+        }
+        spin_unlock(&wp->lock);
+        spin_unlock_irqrestore(&port_lock, state);
         return NO_ERROR;
 
     } else {
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&port_lock, state);
         return ERR_BAD_HANDLE;
     }
 
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&port_lock, state);
 
-    free(buf);
-    free(port);
+    free_buf(buf, mode);
+    kmem_cache_free(cache, port);
     return NO_ERROR;
 }
 
+
+#if WITH_LIB_CONSOLE
+struct port_info {
+    char name[PORT_NAME_LEN];
+    port_mode_t mode;
+    bool closed;
+    uint readers;
+    uint size;
+    uint depth;
+    uint high_water;
+    struct port_stats stats;
+};
+
+static void buf_info(port_buf_t *buf, struct port_info *info)
+{
+    uint size = valpow2(buf->log2);
+    info->size = MAX(info->size, size);
+    info->depth = MAX(info->depth, size - buf->avail);
+    info->high_water = MAX(info->high_water, buf->high_water);
+}
+
+// called with |port_lock| and wp->lock held. for broadcast ports the depth
+// and high water mark are those of the fullest reader.
+static void port_info(write_port_t *wp, struct port_info *info)
+{
+    memset(info, 0, sizeof(*info));
+    strlcpy(info->name, wp->name, sizeof(info->name));
+    info->mode = wp->mode;
+    info->closed = wp->magic == WRITEPORT_MAGIC_X;
+    info->stats = wp->stats;
+
+    if (wp->buf) {
+        buf_info(wp->buf, info);
+        return;
+    }
+
+    read_port_t *rp;
+    list_for_every_entry(&wp->rp_list, rp, read_port_t, w_node) {
+        spin_lock(&rp->lock);
+        info->readers++;
+        info->stats.reads += rp->stats.reads;
+        info->stats.wait_ns += rp->stats.wait_ns;
+        buf_info(rp->buf, info);
+        spin_unlock(&rp->lock);
+    }
+}
+
+static int cmd_ports(int argc, const cmd_args *argv)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock, state);
+    uint count = port_count;
+    spin_unlock_irqrestore(&port_lock, state);
+
+    if (!count) {
+        printf("no ports\n");
+        return NO_ERROR;
+    }
+
+    // snapshot under the locks, print after.
+    struct port_info *info = calloc(count, sizeof(*info));
+    if (!info)
+        return ERR_NO_MEMORY;
+
+    uint found = 0;
+    spin_lock_irqsave(&port_lock, state);
+    for (uint ix = 0; ix != countof(port_hash) && found != count; ix++) {
+        write_port_t *wp;
+        list_for_every_entry(&port_hash[ix], wp, write_port_t, node) {
+            if (found == count)
+                break;
+            spin_lock(&wp->lock);
+            port_info(wp, &info[found++]);
+            spin_unlock(&wp->lock);
+        }
+    }
+    spin_unlock_irqrestore(&port_lock, state);
+
+    printf("%-12s %-13s %7s %5s %5s %5s %10s %10s %10s %12s\n",
+           "name", "mode", "readers", "size", "depth", "hwm",
+           "writes", "reads", "drops", "wait us");
+    for (uint ix = 0; ix != found; ix++) {
+        struct port_info *pi = &info[ix];
+        printf("%-12s %-5s%s%s %7u %5u %5u %5u %10llu %10llu %10llu %12llu\n",
+               pi->name, (pi->mode & PORT_MODE_UNICAST) ? "ucast" : "bcast",
+               (pi->mode & PORT_MODE_SLICE) ? " slice" : "      ",
+               pi->closed ? " x" : "  ", pi->readers, pi->size, pi->depth,
+               pi->high_water, pi->stats.writes, pi->stats.reads,
+               pi->stats.drops, pi->stats.wait_ns / 1000);
+    }
+
+    free(info);
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+#if LK_DEBUGLEVEL > 0
+STATIC_COMMAND("ports", "list ports and their counters", &cmd_ports)
+#endif
+STATIC_COMMAND_END(ports);
+#endif
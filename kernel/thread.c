@@ -45,6 +45,7 @@
 #include <platform.h>
 #include <target.h>
 #include <lib/heap.h>
+#include <lib/slab.h>
 #if WITH_KERNEL_VM
 #include <kernel/vm.h>
 #endif
@@ -68,6 +69,9 @@ spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 
 atomic_uint thread_lock_owner = SMP_MAX_CPUS;
 
+/* dynamically allocated thread structures */
+static KMEM_CACHE_DEFINE(thread_cache, thread_t, NULL);
+
 /* the run queue */
 static struct list_node run_queue[NUM_PRIORITIES];
 static uint32_t run_queue_bitmap;
@@ -202,7 +206,7 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
     unsigned int flags = 0;
 
     if (!t) {
-        t = malloc(sizeof(thread_t));
+        t = kmem_cache_alloc(&thread_cache);
         if (!t)
             return NULL;
         flags |= THREAD_FLAG_FREE_STRUCT;
@@ -225,13 +229,17 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
     t->aspace = NULL;
 #endif
 
-    /* create the stack */
+    /*
+     * create the stack. This can't use VMM_FLAG_LAZY since exceptions are
+     * taken on the same stack, so a fault on an unmapped stack page would
+     * recurse instead of being handled.
+     */
     if (!stack) {
         ret = vmm_alloc(vmm_get_kernel_aspace(), "kernel-stack", stack_size,
                         &t->stack, 0, 0, ARCH_MMU_FLAG_PERM_NO_EXECUTE);
         if (ret) {
             if (flags & THREAD_FLAG_FREE_STRUCT)
-                free(t);
+                kmem_cache_free(&thread_cache, t);
             return NULL;
         }
         flags |= THREAD_FLAG_FREE_STACK;
@@ -255,7 +263,7 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
         if (flags & THREAD_FLAG_FREE_STACK)
             free(t->stack);
         if (flags & THREAD_FLAG_FREE_STRUCT)
-            free(t);
+            kmem_cache_free(&thread_cache, t);
         return NULL;
     }
     flags |= THREAD_FLAG_FREE_SHADOW_STACK;
@@ -442,7 +450,7 @@ static void thread_free(thread_t *t)
 #endif
 
     if (t->flags & THREAD_FLAG_FREE_STRUCT) {
-        free(t);
+        kmem_cache_free(&thread_cache, t);
     }
 }
 
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <kernel/mutex.h>
+#include <kernel/vm.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trace.h>
+
+#include "vm_priv.h"
+
+#define LOCAL_TRACE 0
+
+/**
+ * struct cow_vmm_obj - Copy-on-write object layered over another vmm_obj.
+ * @vmm_obj:   VMM object.
+ * @parent:    Slice of the object that unmodified pages are read from.
+ * @mappings:  Regions mapping this object.
+ * @lock:      Protects @page and @page_list.
+ * @page_list: Pages allocated for private copies.
+ * @page_count: Number of entries in @page.
+ * @page:      Private copy of each page, or %NULL if it is still shared with
+ *             @parent.
+ */
+struct cow_vmm_obj {
+    struct vmm_obj vmm_obj;
+    struct vmm_obj_slice parent;
+    struct vmm_obj_mappings mappings;
+    mutex_t lock;
+    struct list_node page_list;
+    size_t page_count;
+    struct vm_page* page[];
+};
+
+static struct cow_vmm_obj* vmm_obj_to_cow_obj(struct vmm_obj* vmm_obj) {
+    return containerof(vmm_obj, struct cow_vmm_obj, vmm_obj);
+}
+
+static int cow_vmm_obj_check_flags(struct vmm_obj* obj, uint* arch_mmu_flags) {
+    struct cow_vmm_obj* cow_obj = vmm_obj_to_cow_obj(obj);
+    struct vmm_obj* parent = cow_obj->parent.obj;
+    uint parent_flags = *arch_mmu_flags | ARCH_MMU_FLAG_PERM_RO;
+    int ret;
+
+    /*
+     * The parent is never written through this object, so only ask it to
+     * allow read-only mappings, but pick up any memory type it requires.
+     */
+    ret = parent->ops->check_flags(parent, &parent_flags);
+    if (ret) {
+        return ret;
+    }
+    *arch_mmu_flags |= parent_flags & ~ARCH_MMU_FLAG_PERM_RO;
+    return 0;
+}
+
+static int cow_vmm_obj_get_page(struct vmm_obj* obj,
+                                size_t offset,
+                                paddr_t* paddr,
+                                size_t* paddr_size) {
+    struct cow_vmm_obj* cow_obj = vmm_obj_to_cow_obj(obj);
+    struct vmm_obj* parent = cow_obj->parent.obj;
+    size_t index = offset / PAGE_SIZE;
+    int ret = 0;
+
+    if (index >= cow_obj->page_count) {
+        return ERR_OUT_OF_RANGE;
+    }
+
+    mutex_acquire(&cow_obj->lock);
+    if (cow_obj->page[index]) {
+        *paddr = vm_page_to_paddr(cow_obj->page[index]) + offset % PAGE_SIZE;
+    } else {
+        ret = parent->ops->get_page(parent, cow_obj->parent.offset + offset,
+                                    paddr, paddr_size);
+    }
+    mutex_release(&cow_obj->lock);
+
+    /* Neighbouring pages may be private, so return one page at a time */
+    *paddr_size = PAGE_SIZE - offset % PAGE_SIZE;
+    return ret;
+}
+
+static int cow_vmm_obj_get_private_page(struct vmm_obj* obj,
+                                        size_t offset,
+                                        paddr_t* paddr,
+                                        size_t* paddr_size) {
+    struct cow_vmm_obj* cow_obj = vmm_obj_to_cow_obj(obj);
+    struct vmm_obj* parent = cow_obj->parent.obj;
+    size_t index = offset / PAGE_SIZE;
+    paddr_t src_pa;
+    paddr_t dst_pa;
+    size_t src_size;
+    void* src;
+    void* dst;
+    struct list_node new_page = LIST_INITIAL_VALUE(new_page);
+    int ret = 0;
+
+    if (index >= cow_obj->page_count) {
+        return ERR_OUT_OF_RANGE;
+    }
+
+    mutex_acquire(&cow_obj->lock);
+    if (cow_obj->page[index]) {
+        goto done;
+    }
+
+    ret = parent->ops->get_page(parent,
+                                cow_obj->parent.offset +
+                                        round_down(offset, PAGE_SIZE),
+                                &src_pa, &src_size);
+    if (ret) {
+        goto err;
+    }
+    src = paddr_to_kvaddr(src_pa);
+    if (!src) {
+        TRACEF("parent page 0x%lx is not mapped in the kernel\n", src_pa);
+        ret = ERR_NOT_SUPPORTED;
+        goto err;
+    }
+
+    if (!pmm_alloc_contiguous(1, PAGE_SIZE_SHIFT, &dst_pa, &new_page)) {
+        ret = ERR_NO_MEMORY;
+        goto err;
+    }
+    dst = paddr_to_kvaddr(dst_pa);
+    memcpy(dst, src, PAGE_SIZE);
+
+    LTRACEF("offset 0x%zx copied 0x%lx -> 0x%lx\n", offset, src_pa, dst_pa);
+
+    cow_obj->page[index] = list_peek_head_type(&new_page, vm_page_t, node);
+    list_splice_tail(&cow_obj->page_list, &new_page);
+
+done:
+    *paddr = vm_page_to_paddr(cow_obj->page[index]) + offset % PAGE_SIZE;
+    *paddr_size = PAGE_SIZE - offset % PAGE_SIZE;
+err:
+    mutex_release(&cow_obj->lock);
+    return ret;
+}
+
+static void cow_vmm_obj_destroy(struct vmm_obj* obj) {
+    struct cow_vmm_obj* cow_obj = vmm_obj_to_cow_obj(obj);
+
+    DEBUG_ASSERT(list_is_empty(&cow_obj->mappings.regions));
+    vmm_obj_slice_release(&cow_obj->parent);
+    pmm_free(&cow_obj->page_list);
+    mutex_destroy(&cow_obj->mappings.lock);
+    mutex_destroy(&cow_obj->lock);
+    free(cow_obj);
+}
+
+static struct vmm_obj_ops cow_vmm_obj_ops = {
+        .check_flags = cow_vmm_obj_check_flags,
+        .get_page = cow_vmm_obj_get_page,
+        .get_private_page = cow_vmm_obj_get_private_page,
+        .destroy = cow_vmm_obj_destroy,
+};
+
+struct vmm_obj_mappings* vmm_obj_mappings(struct vmm_obj* obj) {
+    if (obj->ops != &cow_vmm_obj_ops) {
+        return NULL;
+    }
+    return &vmm_obj_to_cow_obj(obj)->mappings;
+}
+
+status_t vmm_cow_obj_create(struct vmm_obj* parent,
+                            size_t offset,
+                            size_t size,
+                            struct vmm_obj** objp,
+                            struct obj_ref* ref) {
+    struct cow_vmm_obj* cow_obj;
+    size_t page_count;
+
+    DEBUG_ASSERT(parent);
+    DEBUG_ASSERT(objp);
+    DEBUG_ASSERT(ref);
+    DEBUG_ASSERT(!obj_ref_active(ref));
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(size) || !size) {
+        return ERR_INVALID_ARGS;
+    }
+
+    page_count = size / PAGE_SIZE;
+    cow_obj = calloc(1, sizeof(*cow_obj) +
+                                sizeof(cow_obj->page[0]) * page_count);
+    if (!cow_obj) {
+        return ERR_NO_MEMORY;
+    }
+
+    vmm_obj_slice_init(&cow_obj->parent);
+    vmm_obj_slice_bind(&cow_obj->parent, parent, offset, size);
+    mutex_init(&cow_obj->mappings.lock);
+    list_initialize(&cow_obj->mappings.regions);
+    mutex_init(&cow_obj->lock);
+    list_initialize(&cow_obj->page_list);
+    cow_obj->page_count = page_count;
+
+    vmm_obj_init(&cow_obj->vmm_obj, ref, &cow_vmm_obj_ops);
+    *objp = &cow_obj->vmm_obj;
+    return NO_ERROR;
+}
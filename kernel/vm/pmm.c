@@ -32,6 +32,7 @@
 #include <pow2.h>
 #include <lib/console.h>
 #include <kernel/mutex.h>
+#include <lib/slab.h>
 
 #define LOCAL_TRACE 0
 
@@ -51,6 +52,10 @@ static inline struct pmm_vmm_obj* vmm_obj_to_pmm_obj(struct vmm_obj *vmm_obj)
 static struct list_node arena_list = LIST_INITIAL_VALUE(arena_list);
 static mutex_t lock = MUTEX_INITIAL_VALUE(lock);
 
+/* totals over all arenas, protected by lock */
+static size_t pmm_pages;
+static size_t pmm_free_pages;
+
 #define PAGE_BELONGS_TO_ARENA(page, arena) \
     (((uintptr_t)(page) >= (uintptr_t)(arena)->page_array) && \
      ((uintptr_t)(page) < ((uintptr_t)(arena)->page_array + (arena)->size / PAGE_SIZE * sizeof(vm_page_t))))
@@ -151,6 +156,8 @@ done_add:
 
         arena->free_count++;
     }
+    pmm_pages += page_count;
+    pmm_free_pages += page_count;
 
     return NO_ERROR;
 }
@@ -178,12 +185,30 @@ static int pmm_vmm_obj_get_page(struct vmm_obj *obj, size_t offset,
     return 0;
 }
 
+/*
+ * Most objects are a single chunk (a single page or one contiguous run), so
+ * those come from a cache and only larger chunk arrays use the heap.
+ */
+static struct kmem_cache pmm_obj_cache = KMEM_CACHE_INITIAL_VALUE(
+        pmm_obj_cache, "pmm_vmm_obj",
+        sizeof(struct pmm_vmm_obj) + sizeof(struct vm_page *),
+        __alignof__(struct pmm_vmm_obj), NULL);
+
+static void pmm_free_obj(struct pmm_vmm_obj *pmm_obj)
+{
+    if (pmm_obj->chunk_count == 1) {
+        kmem_cache_free(&pmm_obj_cache, pmm_obj);
+    } else {
+        free(pmm_obj);
+    }
+}
+
 static void pmm_vmm_obj_destroy(struct vmm_obj *obj)
 {
     struct pmm_vmm_obj *pmm_obj = vmm_obj_to_pmm_obj(obj);
 
     pmm_free(&pmm_obj->page_list);
-    free(pmm_obj);
+    pmm_free_obj(pmm_obj);
 }
 
 static struct vmm_obj_ops pmm_vmm_obj_ops = {
@@ -192,6 +217,49 @@ static struct vmm_obj_ops pmm_vmm_obj_ops = {
     .destroy = pmm_vmm_obj_destroy,
 };
 
+static status_t pmm_alloc_pages_locked(struct list_node *page_list,
+                                       struct vm_page *pages[], uint count,
+                                       uint32_t flags, uint8_t align_log2);
+
+static int pmm_lazy_vmm_obj_get_page(struct vmm_obj *obj, size_t offset,
+                                     paddr_t *paddr, size_t *paddr_size)
+{
+    struct pmm_vmm_obj *pmm_obj = vmm_obj_to_pmm_obj(obj);
+    size_t index;
+    status_t ret = 0;
+
+    DEBUG_ASSERT(pmm_obj->chunk_size == PAGE_SIZE);
+
+    index = offset / PAGE_SIZE;
+    if (index >= pmm_obj->chunk_count) {
+        return ERR_OUT_OF_RANGE;
+    }
+
+    /*
+     * The chunk array is only written with the pmm lock held, so a page
+     * can't be allocated twice if two threads fault on it at the same time.
+     */
+    mutex_acquire(&lock);
+    if (!pmm_obj->chunk[index]) {
+        ret = pmm_alloc_pages_locked(&pmm_obj->page_list,
+                                     &pmm_obj->chunk[index], 1, 0, 0);
+    }
+    mutex_release(&lock);
+    if (ret) {
+        return ret;
+    }
+
+    *paddr = vm_page_to_paddr(pmm_obj->chunk[index]) + offset % PAGE_SIZE;
+    *paddr_size = PAGE_SIZE - offset % PAGE_SIZE;
+    return 0;
+}
+
+static struct vmm_obj_ops pmm_lazy_vmm_obj_ops = {
+    .check_flags = pmm_vmm_obj_check_flags,
+    .get_page = pmm_lazy_vmm_obj_get_page,
+    .destroy = pmm_vmm_obj_destroy,
+};
+
 static struct pmm_vmm_obj *pmm_alloc_obj(size_t chunk_count, size_t chunk_size)
 {
     struct pmm_vmm_obj *pmm_obj;
@@ -201,8 +269,12 @@ static struct pmm_vmm_obj *pmm_alloc_obj(size_t chunk_count, size_t chunk_size)
     if (chunk_count == 0)
         return NULL;
 
-    pmm_obj = calloc(
-            1, sizeof(*pmm_obj) + sizeof(pmm_obj->chunk[0]) * chunk_count);
+    if (chunk_count == 1) {
+        pmm_obj = kmem_cache_zalloc(&pmm_obj_cache);
+    } else {
+        pmm_obj = calloc(
+                1, sizeof(*pmm_obj) + sizeof(pmm_obj->chunk[0]) * chunk_count);
+    }
     if (!pmm_obj) {
         return NULL;
     }
@@ -309,6 +381,7 @@ static status_t pmm_alloc_pages_locked(struct list_node *page_list,
             clear_page(page);
 
             a->free_count--;
+            pmm_free_pages--;
 
             page->flags |= VM_PAGE_FLAG_NONFREE;
             if (pages && (!allocated || !(flags & PMM_ALLOC_FLAG_CONTIGUOUS))) {
@@ -328,6 +401,7 @@ static status_t pmm_alloc_pages_locked(struct list_node *page_list,
         pmm_free_locked(&tmp_page_list);
         return ERR_NO_MEMORY;
     }
+    vm_shrink_check(pmm_free_pages);
     if (page_list) {
         list_splice_tail(page_list, &tmp_page_list);
     }
@@ -346,6 +420,19 @@ status_t pmm_alloc(struct vmm_obj **objp, struct obj_ref* ref, uint count,
     DEBUG_ASSERT(count > 0);
 
     LTRACEF("count %u\n", count);
+    if (flags & PMM_ALLOC_FLAG_LAZY) {
+        if (flags & PMM_ALLOC_FLAG_CONTIGUOUS) {
+            return ERR_INVALID_ARGS;
+        }
+        /* No pages yet, pmm_lazy_vmm_obj_get_page fills in the chunks */
+        pmm_obj = pmm_alloc_obj(count, PAGE_SIZE);
+        if (!pmm_obj) {
+            return ERR_NO_MEMORY;
+        }
+        vmm_obj_init(&pmm_obj->vmm_obj, ref, &pmm_lazy_vmm_obj_ops);
+        *objp = &pmm_obj->vmm_obj;
+        return 0;
+    }
     if (flags & PMM_ALLOC_FLAG_CONTIGUOUS) {
         /*
          * When allocating a physically contiguous region we don't need a
@@ -367,7 +454,7 @@ status_t pmm_alloc(struct vmm_obj **objp, struct obj_ref* ref, uint count,
     mutex_release(&lock);
 
     if (ret) {
-        free(pmm_obj);
+        pmm_free_obj(pmm_obj);
         return ret;
     }
 
@@ -411,6 +498,7 @@ size_t pmm_alloc_range(paddr_t address, uint count, struct list_node *list)
             list_add_tail(list, &page->node);
 
             a->free_count--;
+            pmm_free_pages--;
             allocated++;
             address += PAGE_SIZE;
         }
@@ -418,6 +506,7 @@ size_t pmm_alloc_range(paddr_t address, uint count, struct list_node *list)
         if (allocated == count)
             break;
     }
+    vm_shrink_check(pmm_free_pages);
 
     mutex_release(&lock);
     return allocated;
@@ -444,6 +533,7 @@ static size_t pmm_free_locked(struct list_node *list)
 
                 list_add_head(&a->free_list, &page->node);
                 a->free_count++;
+                pmm_free_pages++;
                 count++;
                 break;
             }
@@ -542,6 +632,16 @@ size_t pmm_alloc_contiguous(uint count, uint8_t alignment_log2, paddr_t *pa, str
     return count;
 }
 
+size_t pmm_page_count(void)
+{
+    return pmm_pages;
+}
+
+size_t pmm_free_page_count(void)
+{
+    return pmm_free_pages;
+}
+
 static void dump_page(const vm_page_t *page)
 {
     DEBUG_ASSERT(page);
@@ -600,6 +700,9 @@ usage:
         printf("%s alloc_contig <count> <alignment>\n", argv[0].str);
         printf("%s dump_alloced\n", argv[0].str);
         printf("%s free_alloced\n", argv[0].str);
+        printf("%s pressure\n", argv[0].str);
+        printf("%s watermarks <low> <high>\n", argv[0].str);
+        printf("%s shrink <count>\n", argv[0].str);
         return ERR_GENERIC;
     }
 
@@ -659,6 +762,21 @@ usage:
     } else if (!strcmp(argv[1].str, "free_alloced")) {
         size_t err = pmm_free(&allocated);
         printf("pmm_free returns %zu\n", err);
+    } else if (!strcmp(argv[1].str, "pressure")) {
+        printf("%zu of %zu pages free\n", pmm_free_pages, pmm_pages);
+        vm_shrink_dump();
+    } else if (!strcmp(argv[1].str, "watermarks")) {
+        if (argc < 4) goto notenoughargs;
+
+        if (argv[3].u < argv[2].u || argv[3].u > pmm_pages) {
+            printf("need <low> <= <high> <= %zu\n", pmm_pages);
+            goto usage;
+        }
+        vm_set_watermarks(argv[2].u, argv[3].u);
+    } else if (!strcmp(argv[1].str, "shrink")) {
+        if (argc < 3) goto notenoughargs;
+
+        printf("vm_shrink returns %zu\n", vm_shrink(argv[2].u));
     } else {
         printf("unknown command\n");
         goto usage;
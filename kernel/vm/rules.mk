@@ -5,9 +5,11 @@ MODULE := $(LOCAL_DIR)
 MODULE_SRCS += \
 	$(LOCAL_DIR)/asid.c \
 	$(LOCAL_DIR)/bootalloc.c \
+	$(LOCAL_DIR)/cow.c \
 	$(LOCAL_DIR)/physmem.c \
 	$(LOCAL_DIR)/pmm.c \
 	$(LOCAL_DIR)/relocate.c \
+	$(LOCAL_DIR)/shrink.c \
 	$(LOCAL_DIR)/vm.c \
 	$(LOCAL_DIR)/vmm.c \
 
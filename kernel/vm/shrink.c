@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <kernel/vm.h>
+#include "vm_priv.h"
+
+#include <assert.h>
+#include <debug.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <list.h>
+#include <lk/init.h>
+#include <stdio.h>
+#include <trace.h>
+
+#define LOCAL_TRACE 0
+
+/* Default watermarks, as a fraction of all pages */
+#ifndef VM_LOW_WATERMARK_DIVISOR
+#define VM_LOW_WATERMARK_DIVISOR 32
+#endif
+#ifndef VM_HIGH_WATERMARK_DIVISOR
+#define VM_HIGH_WATERMARK_DIVISOR 16
+#endif
+
+static struct list_node shrinkers = LIST_INITIAL_VALUE(shrinkers);
+static mutex_t shrinker_lock = MUTEX_INITIAL_VALUE(shrinker_lock);
+
+static event_t shrink_event =
+        EVENT_INITIAL_VALUE(shrink_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+/* 0 until the shrinker thread has started */
+static size_t low_watermark;
+static size_t high_watermark;
+
+/* set when the thread has been woken up and cleared when it is done */
+static bool shrink_pending;
+
+static size_t shrink_runs;
+static size_t shrink_pages;
+
+void vm_register_shrinker(struct vm_shrinker *shrinker) {
+    DEBUG_ASSERT(shrinker);
+    DEBUG_ASSERT(shrinker->shrink);
+    DEBUG_ASSERT(!list_in_list(&shrinker->node));
+
+    mutex_acquire(&shrinker_lock);
+    list_add_tail(&shrinkers, &shrinker->node);
+    mutex_release(&shrinker_lock);
+}
+
+void vm_unregister_shrinker(struct vm_shrinker *shrinker) {
+    DEBUG_ASSERT(shrinker);
+    DEBUG_ASSERT(list_in_list(&shrinker->node));
+
+    mutex_acquire(&shrinker_lock);
+    list_delete(&shrinker->node);
+    mutex_release(&shrinker_lock);
+}
+
+size_t vm_shrink(size_t count) {
+    struct vm_shrinker *shrinker;
+    size_t freed = 0;
+
+    mutex_acquire(&shrinker_lock);
+    list_for_every_entry(&shrinkers, shrinker, struct vm_shrinker, node) {
+        if (freed >= count) {
+            break;
+        }
+        size_t ret = shrinker->shrink(shrinker, count - freed);
+        LTRACEF("%s freed %zu pages\n", shrinker->name, ret);
+        freed += ret;
+    }
+    mutex_release(&shrinker_lock);
+
+    return freed;
+}
+
+void vm_set_watermarks(size_t low, size_t high) {
+    DEBUG_ASSERT(!low || high >= low);
+
+    high_watermark = high;
+    low_watermark = low;
+}
+
+void vm_get_watermarks(size_t *low, size_t *high) {
+    *low = low_watermark;
+    *high = high_watermark;
+}
+
+void vm_shrink_check(size_t free_pages) {
+    if (likely(free_pages >= low_watermark) || shrink_pending) {
+        return;
+    }
+    shrink_pending = true;
+    event_signal(&shrink_event, false);
+}
+
+static int vm_shrink_thread(void *arg) {
+    for (;;) {
+        event_wait(&shrink_event);
+
+        /*
+         * Stop once enough is free, or when a round freed nothing, since the
+         * shrinkers can only give back what they have cached.
+         */
+        size_t free_pages;
+        while ((free_pages = pmm_free_page_count()) < high_watermark) {
+            size_t freed = vm_shrink(high_watermark - free_pages);
+            shrink_runs++;
+            shrink_pages += freed;
+            if (!freed) {
+                break;
+            }
+        }
+        LTRACEF("%zu pages free\n", pmm_free_page_count());
+
+        shrink_pending = false;
+    }
+    return 0;
+}
+
+void vm_shrink_dump(void) {
+    struct vm_shrinker *shrinker;
+
+    printf("watermarks: low %zu, high %zu\n", low_watermark, high_watermark);
+    printf("shrinker thread: %zu runs, %zu pages freed\n", shrink_runs,
+           shrink_pages);
+
+    mutex_acquire(&shrinker_lock);
+    list_for_every_entry(&shrinkers, shrinker, struct vm_shrinker, node) {
+        printf("\tshrinker %s\n", shrinker->name);
+    }
+    mutex_release(&shrinker_lock);
+}
+
+static void vm_shrink_init(uint level) {
+    thread_t *thread = thread_create("vm-shrink", vm_shrink_thread, NULL,
+                                     LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!thread) {
+        TRACEF("failed to create shrinker thread\n");
+        return;
+    }
+    thread_detach_and_resume(thread);
+
+    size_t pages = pmm_page_count();
+    vm_set_watermarks(pages / VM_LOW_WATERMARK_DIVISOR,
+                      pages / VM_HIGH_WATERMARK_DIVISOR);
+}
+
+LK_INIT_HOOK(vm_shrink, &vm_shrink_init, LK_INIT_LEVEL_THREADING);
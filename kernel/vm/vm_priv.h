@@ -24,7 +24,9 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <kernel/mutex.h>
 #include <kernel/vm.h>
+#include <list.h>
 
 /* simple boot time allocator state */
 extern uintptr_t boot_alloc_start;
@@ -33,3 +35,24 @@ extern uintptr_t boot_alloc_end;
 void vmm_init_preheap(void);
 void vmm_init(void);
 
+/* wake the shrinker thread if @free_pages is below the low watermark, called
+ * with the pmm lock held */
+void vm_shrink_check(size_t free_pages);
+void vm_shrink_dump(void);
+
+/**
+ * struct vmm_obj_mappings - Regions mapping an object.
+ * @lock:    Protects @regions. Taken before the aspace lock of any region.
+ * @regions: Regions with this object in their obj_slice, linked by obj_node.
+ */
+struct vmm_obj_mappings {
+    mutex_t lock;
+    struct list_node regions;
+};
+
+/*
+ * Copy-on-write objects track their mappings, so a write fault that makes a
+ * page private can unmap the shared page from the other mappings. Returns
+ * %NULL for objects that are not tracked.
+ */
+struct vmm_obj_mappings *vmm_obj_mappings(struct vmm_obj *obj);
@@ -26,6 +26,7 @@
 #include <kernel/vm.h>
 #include <lib/console.h>
 #include <lib/rand/rand.h>
+#include <lib/slab.h>
 #include <string.h>
 #include <trace.h>
 
@@ -33,13 +34,24 @@
 
 #define LOCAL_TRACE 0
 
+/*
+ * Lock ordering: vmm_lock or the mapping list lock of a copy-on-write object,
+ * aspace->lock, vmm_obj_lock. Each address space is protected by its own lock
+ * so unrelated tasks can map and unmap concurrently.
+ */
+
+/* protects aspace_list */
 static struct list_node aspace_list = LIST_INITIAL_VALUE(aspace_list);
 static mutex_t vmm_lock = MUTEX_INITIAL_VALUE(vmm_lock);
 
+/* protects the reference lists of all vmm_objs */
+static mutex_t vmm_obj_lock = MUTEX_INITIAL_VALUE(vmm_obj_lock);
+
 vmm_aspace_t _kernel_aspace;
 
-static void dump_aspace(const vmm_aspace_t* a);
+static void dump_aspace(vmm_aspace_t* a);
 static void dump_region(const vmm_region_t* r);
+static void vmm_region_augment(struct bst_node* node);
 
 void vmm_init_preheap(void) {
     /* initialize the kernel address space */
@@ -47,7 +59,8 @@ void vmm_init_preheap(void) {
     _kernel_aspace.base = KERNEL_ASPACE_BASE;
     _kernel_aspace.size = KERNEL_ASPACE_SIZE;
     _kernel_aspace.flags = VMM_ASPACE_FLAG_KERNEL;
-    bst_root_initialize(&_kernel_aspace.regions);
+    mutex_init(&_kernel_aspace.lock);
+    bst_root_initialize_augmented(&_kernel_aspace.regions, vmm_region_augment);
 
     arch_mmu_init_aspace(&_kernel_aspace.arch_aspace, KERNEL_ASPACE_BASE,
                          KERNEL_ASPACE_SIZE, ARCH_ASPACE_FLAG_KERNEL);
@@ -155,20 +168,6 @@ void vmm_obj_slice_init(struct vmm_obj_slice *slice) {
     slice->size = 0;
 }
 
-/*
- * This will not invoke the destructor on the vmm_obj if it is the last
- * one out, as the vmm lock is held. If we would need to destroy the object,
- * we instead assert fail in debug builds, and with NDEBUG builds leak.
- */
-static void vmm_obj_slice_release_locked(struct vmm_obj_slice *slice) {
-    bool dead = false;
-    if (slice->obj) {
-        dead = obj_del_ref(&slice->obj->obj, &slice->obj_ref, NULL);
-        slice->obj = NULL;
-    }
-    ASSERT(!dead);
-}
-
 void vmm_obj_slice_release(struct vmm_obj_slice *slice) {
     if (slice->obj) {
         vmm_obj_del_ref(slice->obj, &slice->obj_ref);
@@ -176,24 +175,16 @@ void vmm_obj_slice_release(struct vmm_obj_slice *slice) {
     }
 }
 
-static void vmm_obj_slice_bind_locked(struct vmm_obj_slice *slice,
-                                      struct vmm_obj *obj,
-                                      size_t offset,
-                                      size_t size) {
+void vmm_obj_slice_bind(struct vmm_obj_slice *slice, struct vmm_obj *obj,
+                        size_t offset, size_t size) {
     DEBUG_ASSERT(!slice->obj);
     slice->obj = obj;
-    /* Use obj_add_ref directly to avoid acquiring the vmm lock. */
-    obj_add_ref(&slice->obj->obj, &slice->obj_ref);
+    vmm_obj_add_ref(obj, &slice->obj_ref);
     slice->offset = offset;
     slice->size = size;
 }
 
-void vmm_obj_slice_bind(struct vmm_obj_slice *slice, struct vmm_obj *obj,
-                        size_t offset, size_t size) {
-    mutex_acquire(&vmm_lock);
-    vmm_obj_slice_bind_locked(slice, obj, offset, size);
-    mutex_release(&vmm_lock);
-}
+static KMEM_CACHE_DEFINE(vmm_region_cache, vmm_region_t, NULL);
 
 static vmm_region_t* alloc_region_struct(const char* name,
                                          vaddr_t base,
@@ -202,7 +193,7 @@ static vmm_region_t* alloc_region_struct(const char* name,
                                          uint arch_mmu_flags) {
     DEBUG_ASSERT(name);
 
-    vmm_region_t* r = calloc(1, sizeof(vmm_region_t));
+    vmm_region_t* r = kmem_cache_zalloc(&vmm_region_cache);
     if (!r)
         return NULL;
 
@@ -254,6 +245,39 @@ static int vmm_region_cmp(struct bst_node *_a, struct bst_node *_b) {
     return 0;
 }
 
+/*
+ * Number of unused bytes between the region ending at @low_last and the one
+ * starting at @high_prev + 1. Both arguments are inclusive addresses so the
+ * ends of the address space can be represented without overflow.
+ */
+static size_t vmm_gap_free(vaddr_t low_last, vaddr_t high_prev) {
+    return high_prev > low_last ? high_prev - low_last : 0;
+}
+
+static void vmm_region_augment(struct bst_node* node) {
+    vmm_region_t* r = containerof(node, vmm_region_t, node);
+    vmm_region_t* left = containerof_null_safe(node->child[0], vmm_region_t,
+                                               node);
+    vmm_region_t* right = containerof_null_safe(node->child[1], vmm_region_t,
+                                                node);
+    vaddr_t last = r->base + (r->obj_slice.size - 1);
+    size_t max_gap = 0;
+
+    r->subtree_base = r->base;
+    r->subtree_last = last;
+    if (left) {
+        r->subtree_base = left->subtree_base;
+        max_gap = MAX(left->subtree_max_gap,
+                      vmm_gap_free(left->subtree_last, r->base - 1));
+    }
+    if (right) {
+        r->subtree_last = right->subtree_last;
+        max_gap = MAX(max_gap, right->subtree_max_gap);
+        max_gap = MAX(max_gap, vmm_gap_free(last, right->subtree_base - 1));
+    }
+    r->subtree_max_gap = max_gap;
+}
+
 /* add a region to the appropriate spot in the address space list,
  * testing to see if there's a space */
 static status_t add_region_to_aspace(vmm_aspace_t* aspace, vmm_region_t* r) {
@@ -565,6 +589,92 @@ static inline vaddr_t spot_in_gap(vmm_aspace_t* aspace,
     return base;
 }
 
+/**
+ * struct alloc_spot_state - Search state shared by alloc_spot() helpers
+ * @aspace:         The address space to search within
+ * @align:          Required alignment in bytes
+ * @size:           Size of the new region
+ * @arch_mmu_flags: Architecture-specifc MMU flags for the new region
+ * @min_free:       Gaps with fewer unused bytes than this cannot hold the
+ *                  new region and its guard pages.
+ * @select:         %false to count available spots in @choices, %true to
+ *                  pick spot number @index and store it in @spot.
+ * @choices:        Number of spots counted so far.
+ * @index:          Index of the spot to pick among the remaining gaps.
+ * @spot:           Selected spot.
+ */
+struct alloc_spot_state {
+    vmm_aspace_t* aspace;
+    vaddr_t align;
+    size_t size;
+    uint arch_mmu_flags;
+    size_t min_free;
+    bool select;
+    size_t choices;
+    size_t index;
+    vaddr_t spot;
+};
+
+static bool alloc_spot_visit_gap(struct alloc_spot_state* s,
+                                 vmm_region_t* low,
+                                 vmm_region_t* high) {
+    size_t spots = scan_gap(s->aspace, low, high, s->align, s->size,
+                            s->arch_mmu_flags);
+    if (!s->select) {
+        s->choices += spots;
+        return false;
+    }
+    if (spots > s->index) {
+        s->spot = spot_in_gap(s->aspace, low, high, s->align, s->size,
+                              s->arch_mmu_flags, s->index);
+        return true;
+    }
+    s->index -= spots;
+    return false;
+}
+
+/**
+ * alloc_spot_walk() - Visit, in address order, the gaps in a subtree
+ * @s:    Search state.
+ * @r:    Root of the subtree, or %NULL for the single gap between @low and
+ *        @high.
+ * @low:  Region just below the subtree, %NULL for the start of the aspace.
+ * @high: Region just above the subtree, %NULL for the end of the aspace.
+ *
+ * Subtrees where neither the inner gaps, tracked by vmm_region_augment(), nor
+ * the gaps to @low and @high are large enough are skipped. scan_gap() would
+ * find no spots in those gaps, so the result is the same as visiting every
+ * gap, but the cost is O(log n) per gap that can hold the region rather than
+ * O(n) in total.
+ *
+ * Return: %true if a spot was selected and the walk should stop.
+ */
+static bool alloc_spot_walk(struct alloc_spot_state* s,
+                            vmm_region_t* r,
+                            vmm_region_t* low,
+                            vmm_region_t* high) {
+    if (!r) {
+        return alloc_spot_visit_gap(s, low, high);
+    }
+
+    vaddr_t low_last = low ? low->base + (low->obj_slice.size - 1)
+                           : s->aspace->base - 1;
+    vaddr_t high_prev = high ? high->base - 1
+                             : s->aspace->base + (s->aspace->size - 1);
+    if (r->subtree_max_gap < s->min_free &&
+        vmm_gap_free(low_last, r->subtree_base - 1) < s->min_free &&
+        vmm_gap_free(r->subtree_last, high_prev) < s->min_free) {
+        return false;
+    }
+
+    vmm_region_t* left = containerof_null_safe(r->node.child[0], vmm_region_t,
+                                               node);
+    vmm_region_t* right = containerof_null_safe(r->node.child[1],
+                                                vmm_region_t, node);
+    return alloc_spot_walk(s, left, low, r) ||
+           alloc_spot_walk(s, right, r, high);
+}
+
 /**
  * alloc_spot() - Find a place in the address space for a new virtual region
  * @aspace:         The address space to search within
@@ -597,61 +707,49 @@ static vaddr_t alloc_spot(vmm_aspace_t* aspace,
 
     if (align_pow2 < PAGE_SIZE_SHIFT)
         align_pow2 = PAGE_SIZE_SHIFT;
-    vaddr_t align = 1UL << align_pow2;
 
-    vaddr_t spot;
-    vmm_region_t* left = NULL;
-    vmm_region_t* right;
+    vmm_region_t* root = containerof_null_safe(aspace->regions.root,
+                                               vmm_region_t, node);
+    struct alloc_spot_state s = {
+        .aspace = aspace,
+        .align = 1UL << align_pow2,
+        .size = size,
+        .arch_mmu_flags = arch_mmu_flags,
+        /* extract_gap() needs a guard page on at least one side */
+        .min_free = size + PAGE_SIZE,
+    };
+    if (s.min_free < size) {
+        return (vaddr_t)-1;
+    }
 
+#ifdef ASLR
     /*
-     * TODO: When ASLR is enabled, pick a random address and check if it is
-     * available with bst_search before falling back to examine every region.
+     * Picking uniformly among all legal positions needs the number of spots in
+     * every gap that is large enough, so this pass is linear in the number of
+     * such gaps rather than in the number of regions.
      */
-
-    /* Figure out how many options we have to size randomness appropriately */
-    size_t choices = 0;
-    bst_for_every_entry(&aspace->regions, right, vmm_region_t, node) {
-        choices += scan_gap(aspace, left, right, align, size, arch_mmu_flags);
-        left = right;
-    }
-    right = NULL;
-    choices += scan_gap(aspace, left, right, align, size, arch_mmu_flags);
-    if (!choices) {
+    alloc_spot_walk(&s, root, NULL, NULL);
+    if (!s.choices) {
         /* No available choices, bail */
         return (vaddr_t)-1;
     }
 
     /* Grab the index through all choices */
-#ifdef ASLR
-    size_t index = rand_get_size(choices - 1);
+    s.index = rand_get_size(s.choices - 1);
 #else
-    size_t index = 0;
+    s.index = 0;
 #endif
-    left = NULL;
-    bst_for_every_entry(&aspace->regions, right, vmm_region_t, node) {
-        size_t local_spots =
-                scan_gap(aspace, left, right, align, size, arch_mmu_flags);
-        if (local_spots > index) {
-            spot = spot_in_gap(aspace, left, right, align, size,
-                               arch_mmu_flags, index);
-            goto done;
-        } else {
-            index -= local_spots;
-        }
-        left = right;
+    s.select = true;
+    if (!alloc_spot_walk(&s, root, NULL, NULL)) {
+        return (vaddr_t)-1;
     }
-    right = NULL;
-    spot = spot_in_gap(aspace, left, right, align, size, arch_mmu_flags,
-                       index);
-
-done:
-    return spot;
+    return s.spot;
 }
 
 bool vmm_find_spot(vmm_aspace_t* aspace, size_t size, vaddr_t* out) {
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&aspace->lock);
     *out = alloc_spot(aspace, size, PAGE_SIZE_SHIFT, 0);
-    mutex_release(&vmm_lock);
+    mutex_release(&aspace->lock);
     return *out != (vaddr_t)(-1);
 }
 
@@ -679,7 +777,7 @@ static status_t alloc_region(vmm_aspace_t* aspace,
         status_t ret = add_region_to_aspace(aspace, r);
         if (ret < 0) {
             /* didn't fit */
-            free(r);
+            kmem_cache_free(&vmm_region_cache, r);
             return ret;
         }
     } else {
@@ -696,7 +794,7 @@ static status_t alloc_region(vmm_aspace_t* aspace,
 
         if (vaddr == (vaddr_t)-1) {
             LTRACEF("failed to find spot\n");
-            free(r);
+            kmem_cache_free(&vmm_region_cache, r);
             return ERR_NO_MEMORY;
         }
 
@@ -719,6 +817,12 @@ static status_t vmm_map_obj_locked(vmm_aspace_t* aspace, vmm_region_t* r,
     status_t err;
     size_t off = 0;
     struct vmm_obj *vmm_obj = r->obj_slice.obj;
+
+    /* shared pages are made writable one at a time by vmm_handle_page_fault */
+    if (vmm_obj->ops->get_private_page) {
+        arch_mmu_flags |= ARCH_MMU_FLAG_PERM_RO;
+    }
+
     while (off < r->obj_slice.size) {
         paddr_t pa;
         vaddr_t va;
@@ -784,7 +888,7 @@ status_t vmm_reserve_space(vmm_aspace_t* aspace,
     /* trim the size */
     size = trim_to_aspace(aspace, vaddr, size);
 
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&aspace->lock);
 
     /* lookup how it's already mapped */
     uint arch_mmu_flags = 0;
@@ -794,21 +898,21 @@ status_t vmm_reserve_space(vmm_aspace_t* aspace,
     ret = alloc_region(aspace, name, size, vaddr, 0, VMM_FLAG_VALLOC_SPECIFIC,
                        VMM_REGION_FLAG_RESERVED, arch_mmu_flags, NULL);
 
-    mutex_release(&vmm_lock);
+    mutex_release(&aspace->lock);
     return ret;
 }
 
 void vmm_obj_add_ref(struct vmm_obj* obj, struct obj_ref* ref) {
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&vmm_obj_lock);
     obj_add_ref(&obj->obj, ref);
-    mutex_release(&vmm_lock);
+    mutex_release(&vmm_obj_lock);
 }
 
 void vmm_obj_del_ref(struct vmm_obj* obj, struct obj_ref* ref) {
     bool destroy;
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&vmm_obj_lock);
     destroy = obj_del_ref(&obj->obj, ref, NULL);
-    mutex_release(&vmm_lock);
+    mutex_release(&vmm_obj_lock);
     if (destroy) {
         obj->ops->destroy(obj);
     }
@@ -816,9 +920,9 @@ void vmm_obj_del_ref(struct vmm_obj* obj, struct obj_ref* ref) {
 
 bool vmm_obj_has_only_ref(struct vmm_obj* obj, struct obj_ref* ref) {
     bool has_only_ref;
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&vmm_obj_lock);
     has_only_ref = obj_has_only_ref(&obj->obj, ref);
-    mutex_release(&vmm_lock);
+    mutex_release(&vmm_obj_lock);
     return has_only_ref;
 }
 
@@ -862,7 +966,15 @@ status_t vmm_alloc_obj(vmm_aspace_t* aspace, const char* name,
         goto err_check_flags;
     }
 
-    mutex_acquire(&vmm_lock);
+    /*
+     * Register the region before any of it is mapped, so a write fault in
+     * another mapping can't make a page private without seeing this one.
+     */
+    struct vmm_obj_mappings* mappings = vmm_obj_mappings(vmm_obj);
+    if (mappings) {
+        mutex_acquire(&mappings->lock);
+    }
+    mutex_acquire(&aspace->lock);
 
     /* allocate a region and put it in the aspace list */
     vmm_region_t* r;
@@ -874,24 +986,47 @@ status_t vmm_alloc_obj(vmm_aspace_t* aspace, const char* name,
         goto err_alloc_region;
     }
 
-    vmm_obj_slice_bind_locked(&r->obj_slice, vmm_obj, offset, size);
-    ret = vmm_map_obj_locked(aspace, r, arch_mmu_flags);
-    if (ret) {
-        goto err_map_obj;
+    vmm_obj_slice_bind(&r->obj_slice, vmm_obj, offset, size);
+    if (mappings) {
+        r->aspace = aspace;
+        list_add_tail(&mappings->regions, &r->obj_node);
+    }
+    if (!(vmm_flags & VMM_FLAG_LAZY)) {
+        ret = vmm_map_obj_locked(aspace, r, arch_mmu_flags);
+        if (ret) {
+            goto err_map_obj;
+        }
+        r->resident = size;
     }
+    aspace->committed += size;
+    aspace->resident += r->resident;
 
     /* return the vaddr */
     *ptr = (void*)r->base;
 
-    mutex_release(&vmm_lock);
+    mutex_release(&aspace->lock);
+    if (mappings) {
+        mutex_release(&mappings->lock);
+    }
     return NO_ERROR;
 
 err_map_obj:
-    vmm_obj_slice_release_locked(&r->obj_slice);
     bst_delete(&aspace->regions, &r->node);
-    free(r);
+    mutex_release(&aspace->lock);
+    if (mappings) {
+        list_delete(&r->obj_node);
+        mutex_release(&mappings->lock);
+    }
+    /* the caller still holds a reference, so this will not destroy vmm_obj */
+    vmm_obj_slice_release(&r->obj_slice);
+    kmem_cache_free(&vmm_region_cache, r);
+    return ret;
+
 err_alloc_region:
-    mutex_release(&vmm_lock);
+    mutex_release(&aspace->lock);
+    if (mappings) {
+        mutex_release(&mappings->lock);
+    }
 err_check_flags:
 err_missing_ptr:
     return ret;
@@ -939,6 +1074,11 @@ status_t vmm_alloc_physical_etc(vmm_aspace_t* aspace,
         return ERR_INVALID_ARGS;
     }
 
+    /* there is no vmm_obj to look pages up in on a fault */
+    if (vmm_flags & VMM_FLAG_LAZY) {
+        return ERR_INVALID_ARGS;
+    }
+
     vaddr_t vaddr = 0;
 
     /* if they're asking for a specific spot, copy the address */
@@ -946,7 +1086,7 @@ status_t vmm_alloc_physical_etc(vmm_aspace_t* aspace,
         vaddr = (vaddr_t)*ptr;
     }
 
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&aspace->lock);
 
     /* allocate a region and put it in the aspace list */
     vmm_region_t* r;
@@ -969,7 +1109,7 @@ status_t vmm_alloc_physical_etc(vmm_aspace_t* aspace,
     ret = NO_ERROR;
 
 err_alloc_region:
-    mutex_release(&vmm_lock);
+    mutex_release(&aspace->lock);
     return ret;
 }
 
@@ -990,6 +1130,10 @@ static status_t vmm_alloc_pmm(vmm_aspace_t* aspace,
     if (size == 0)
         return ERR_INVALID_ARGS;
 
+    if (vmm_flags & VMM_FLAG_LAZY) {
+        pmm_alloc_flags |= PMM_ALLOC_FLAG_LAZY;
+    }
+
     ret = pmm_alloc(&vmm_obj, &vmm_obj_ref, size / PAGE_SIZE,
                     pmm_alloc_flags, pmm_alloc_align_pow2);
     if (ret) {
@@ -1054,7 +1198,7 @@ static vmm_region_t* vmm_find_region(const vmm_aspace_t* aspace,
     return r;
 }
 
-status_t vmm_get_obj(const vmm_aspace_t *aspace, vaddr_t vaddr, size_t size,
+status_t vmm_get_obj(vmm_aspace_t *aspace, vaddr_t vaddr, size_t size,
                      struct vmm_obj_slice *slice) {
     status_t ret = NO_ERROR;
 
@@ -1064,7 +1208,7 @@ status_t vmm_get_obj(const vmm_aspace_t *aspace, vaddr_t vaddr, size_t size,
         return ERR_INVALID_ARGS;
     }
 
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&aspace->lock);
 
     struct vmm_region *region = vmm_find_region(aspace, vaddr);
     if (!region) {
@@ -1110,11 +1254,10 @@ status_t vmm_get_obj(const vmm_aspace_t *aspace, vaddr_t vaddr, size_t size,
     slice->obj = region->obj_slice.obj;
     slice->size = size;
     slice->offset = offset;
-    /* direct use of obj_add_ref to operate inside the vmm mutex */
-    obj_add_ref(&slice->obj->obj, &slice->obj_ref);
+    vmm_obj_add_ref(slice->obj, &slice->obj_ref);
 
 out:
-    mutex_release(&vmm_lock);
+    mutex_release(&aspace->lock);
     return ret;
 }
 
@@ -1132,17 +1275,33 @@ static bool vmm_region_is_match(vmm_region_t* r,
     }
 }
 
+/*
+ * Remove @r from the mapping list of its object, if it is on one. Called
+ * without the aspace lock held, after @r was marked unmapped.
+ */
+static void vmm_region_unregister(vmm_region_t* r) {
+    if (!list_in_list(&r->obj_node)) {
+        return;
+    }
+
+    struct vmm_obj_mappings* mappings = vmm_obj_mappings(r->obj_slice.obj);
+    DEBUG_ASSERT(r->flags & VMM_REGION_FLAG_UNMAPPED);
+    mutex_acquire(&mappings->lock);
+    list_delete(&r->obj_node);
+    mutex_release(&mappings->lock);
+}
+
 status_t vmm_free_region_etc(vmm_aspace_t* aspace,
                              vaddr_t vaddr,
                              size_t size,
                              uint32_t flags) {
     DEBUG_ASSERT(aspace);
 
-    mutex_acquire(&vmm_lock);
+    mutex_acquire(&aspace->lock);
 
     vmm_region_t* r = vmm_find_region(aspace, vaddr);
     if (!vmm_region_is_match(r, vaddr, size, flags)) {
-        mutex_release(&vmm_lock);
+        mutex_release(&aspace->lock);
         return ERR_NOT_FOUND;
     }
 
@@ -1152,14 +1311,22 @@ status_t vmm_free_region_etc(vmm_aspace_t* aspace,
     /* unmap it */
     arch_mmu_unmap(&aspace->arch_aspace, r->base,
                    r->obj_slice.size / PAGE_SIZE);
+    r->flags |= VMM_REGION_FLAG_UNMAPPED;
 
-    mutex_release(&vmm_lock);
+    if (r->obj_slice.obj) {
+        aspace->committed -= r->obj_slice.size;
+        aspace->resident -= r->resident;
+    }
+
+    mutex_release(&aspace->lock);
+
+    vmm_region_unregister(r);
 
     /* release our hold on the backing object, if any */
     vmm_obj_slice_release(&r->obj_slice);
 
     /* free it */
-    free(r);
+    kmem_cache_free(&vmm_region_cache, r);
 
     return NO_ERROR;
 }
@@ -1168,6 +1335,170 @@ status_t vmm_free_region(vmm_aspace_t* aspace, vaddr_t vaddr) {
     return vmm_free_region_etc(aspace, vaddr, 1, VMM_FREE_REGION_FLAG_EXPAND);
 }
 
+static bool vmm_pf_allowed(uint arch_mmu_flags, uint pf_flags) {
+    if ((pf_flags & VMM_PF_FLAG_WRITE) &&
+        (arch_mmu_flags & ARCH_MMU_FLAG_PERM_RO)) {
+        return false;
+    }
+    if ((pf_flags & VMM_PF_FLAG_INSTRUCTION) &&
+        (arch_mmu_flags & ARCH_MMU_FLAG_PERM_NO_EXECUTE)) {
+        return false;
+    }
+    if ((pf_flags & VMM_PF_FLAG_USER) &&
+        !(arch_mmu_flags & ARCH_MMU_FLAG_PERM_USER)) {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * A copy-on-write object just replaced the shared page at @offset with the
+ * private page @pa. Other regions mapping the same object may still have the
+ * shared page mapped read-only, unmap it there so their next access faults in
+ * the private copy. Only the regions on the object's mapping list are
+ * visited, each under its own aspace lock.
+ */
+static void vmm_unmap_shared_page(struct vmm_obj_mappings* mappings,
+                                  size_t offset,
+                                  paddr_t pa) {
+    vmm_region_t* r;
+    paddr_t mapped_pa;
+    vaddr_t va;
+
+    mutex_acquire(&mappings->lock);
+    list_for_every_entry(&mappings->regions, r, vmm_region_t, obj_node) {
+        if (offset < r->obj_slice.offset ||
+            offset - r->obj_slice.offset >= r->obj_slice.size) {
+            continue;
+        }
+        va = r->base + (offset - r->obj_slice.offset);
+
+        vmm_aspace_t* a = r->aspace;
+        mutex_acquire(&a->lock);
+        if (!(r->flags & VMM_REGION_FLAG_UNMAPPED) &&
+            arch_mmu_query(&a->arch_aspace, va, &mapped_pa, NULL) ==
+                    NO_ERROR &&
+            mapped_pa != pa) {
+            arch_mmu_unmap(&a->arch_aspace, va, 1);
+            r->resident -= PAGE_SIZE;
+            a->resident -= PAGE_SIZE;
+        }
+        mutex_release(&a->lock);
+    }
+    mutex_release(&mappings->lock);
+}
+
+status_t vmm_handle_page_fault(vaddr_t vaddr, uint pf_flags) {
+    status_t ret;
+    paddr_t pa;
+    size_t pa_size;
+    size_t offset;
+    uint mapped_flags;
+    bool mapped;
+    struct vmm_obj_mappings* mappings = NULL;
+    struct obj_ref vmm_obj_ref = OBJ_REF_INITIAL_VALUE(vmm_obj_ref);
+
+    LTRACEF("vaddr 0x%lx pf_flags 0x%x\n", vaddr, pf_flags);
+
+    vmm_aspace_t* aspace = vaddr_to_aspace((void*)vaddr);
+    if (!aspace) {
+        return ERR_NOT_FOUND;
+    }
+
+    /*
+     * We have to block on the aspace lock and possibly the pmm lock below.
+     * Refuse faults taken from code that can't do that rather than deadlock:
+     * with interrupts disabled, which covers any spinlock being held, or
+     * with the aspace lock already held.
+     */
+    if (arch_ints_disabled() || thread_lock_held() ||
+        is_mutex_held(&aspace->lock)) {
+        return ERR_BAD_STATE;
+    }
+
+    vaddr = round_down(vaddr, PAGE_SIZE);
+
+    mutex_acquire(&aspace->lock);
+
+    vmm_region_t* r = vmm_find_region(aspace, vaddr);
+    if (!r || !r->obj_slice.obj) {
+        ret = ERR_NOT_FOUND;
+        goto out;
+    }
+
+    struct vmm_obj* vmm_obj = r->obj_slice.obj;
+    bool cow = vmm_obj->ops->get_private_page;
+    if (!(r->flags & VMM_FLAG_LAZY) && !cow) {
+        ret = ERR_NOT_FOUND;
+        goto out;
+    }
+
+    if (!vmm_pf_allowed(r->arch_mmu_flags, pf_flags)) {
+        ret = ERR_ACCESS_DENIED;
+        goto out;
+    }
+
+    mapped = arch_mmu_query(&aspace->arch_aspace, vaddr, NULL,
+                            &mapped_flags) == NO_ERROR;
+    if (mapped && (!(pf_flags & VMM_PF_FLAG_WRITE) ||
+                   !(mapped_flags & ARCH_MMU_FLAG_PERM_RO))) {
+        /* another thread faulted on the same page and mapped it first */
+        ret = NO_ERROR;
+        goto out;
+    }
+
+    uint arch_mmu_flags = r->arch_mmu_flags;
+    offset = (vaddr - r->base) + r->obj_slice.offset;
+    if (cow && (pf_flags & VMM_PF_FLAG_WRITE)) {
+        ret = vmm_obj->ops->get_private_page(vmm_obj, offset, &pa, &pa_size);
+        mappings = vmm_obj_mappings(vmm_obj);
+    } else {
+        ret = vmm_obj->ops->get_page(vmm_obj, offset, &pa, &pa_size);
+        if (cow) {
+            /* the page may be shared, wait for a write fault to copy it */
+            arch_mmu_flags |= ARCH_MMU_FLAG_PERM_RO;
+        }
+    }
+    if (ret) {
+        goto out;
+    }
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(pa));
+
+    if (mapped) {
+        /* replace the read-only shared page with the private copy */
+        arch_mmu_unmap(&aspace->arch_aspace, vaddr, 1);
+    }
+    ret = arch_mmu_map(&aspace->arch_aspace, vaddr, pa, 1, arch_mmu_flags);
+    if (ret) {
+        if (mapped) {
+            r->resident -= PAGE_SIZE;
+            aspace->resident -= PAGE_SIZE;
+        }
+        goto out;
+    }
+    if (!mapped) {
+        r->resident += PAGE_SIZE;
+        aspace->resident += PAGE_SIZE;
+    }
+
+    if (mappings) {
+        /*
+         * The mapping list lock comes before aspace->lock, so the other
+         * mappings are updated after it is dropped. Keep the object alive
+         * until then, the region may be freed meanwhile.
+         */
+        vmm_obj_add_ref(vmm_obj, &vmm_obj_ref);
+    }
+
+out:
+    mutex_release(&aspace->lock);
+    if (obj_ref_active(&vmm_obj_ref)) {
+        vmm_unmap_shared_page(mappings, offset, pa);
+        vmm_obj_del_ref(vmm_obj, &vmm_obj_ref);
+    }
+    return ret;
+}
+
 status_t vmm_create_aspace(vmm_aspace_t** _aspace,
                            const char* name,
                            uint flags) {
@@ -1215,7 +1546,8 @@ status_t vmm_create_aspace(vmm_aspace_t** _aspace,
     }
 
     list_clear_node(&aspace->node);
-    bst_root_initialize(&aspace->regions);
+    mutex_init(&aspace->lock);
+    bst_root_initialize_augmented(&aspace->regions, vmm_region_augment);
 
     mutex_acquire(&vmm_lock);
     list_add_head(&aspace_list, &aspace->node);
@@ -1236,30 +1568,37 @@ status_t vmm_free_aspace(vmm_aspace_t* aspace) {
         return ERR_INVALID_ARGS;
     }
     list_delete(&aspace->node);
+    mutex_release(&vmm_lock);
 
     /* free all of the regions */
 
+    mutex_acquire(&aspace->lock);
     vmm_region_t* r;
     bst_for_every_entry(&aspace->regions, r, vmm_region_t, node) {
         /* unmap it */
         arch_mmu_unmap(&aspace->arch_aspace, r->base,
                        r->obj_slice.size / PAGE_SIZE);
 
-        /* mark it as unmapped (only used for debug assert below) */
+        /* mark it as unmapped (size only used for debug assert below) */
         r->obj_slice.size = 0;
+        r->flags |= VMM_REGION_FLAG_UNMAPPED;
     }
-    mutex_release(&vmm_lock);
+    mutex_release(&aspace->lock);
 
-    /* without the vmm lock held, free all of the pmm pages and the structure */
+    /*
+     * The aspace is no longer reachable, so without the aspace lock held,
+     * free all of the pmm pages and the structure.
+     */
     bst_for_every_entry(&aspace->regions, r, vmm_region_t, node) {
         DEBUG_ASSERT(!r->obj_slice.size);
         bst_delete(&aspace->regions, &r->node);
+        vmm_region_unregister(r);
 
         /* release our hold on the backing object, if any */
         vmm_obj_slice_release(&r->obj_slice);
 
         /* free it */
-        free(r);
+        kmem_cache_free(&vmm_region_cache, r);
     }
 
     /* make sure the current thread does not map the aspace */
@@ -1275,6 +1614,7 @@ status_t vmm_free_aspace(vmm_aspace_t* aspace) {
     arch_mmu_destroy_aspace(&aspace->arch_aspace);
 
     /* free the aspace */
+    mutex_destroy(&aspace->lock);
     free(aspace);
 
     return NO_ERROR;
@@ -1307,22 +1647,26 @@ static void dump_region(const vmm_region_t* r) {
     DEBUG_ASSERT(r);
 
     printf("\tregion %p: name '%s' range 0x%lx - 0x%lx size 0x%zx flags 0x%x "
-           "mmu_flags 0x%x\n",
+           "mmu_flags 0x%x resident 0x%zx\n",
            r, r->name, r->base, r->base + (r->obj_slice.size - 1),
-           r->obj_slice.size, r->flags, r->arch_mmu_flags);
+           r->obj_slice.size, r->flags, r->arch_mmu_flags, r->resident);
 }
 
-static void dump_aspace(const vmm_aspace_t* a) {
+static void dump_aspace(vmm_aspace_t* a) {
     DEBUG_ASSERT(a);
 
+    mutex_acquire(&a->lock);
+
     printf("aspace %p: name '%s' range 0x%lx - 0x%lx size 0x%zx flags 0x%x\n",
            a, a->name, a->base, a->base + (a->size - 1), a->size, a->flags);
+    printf("committed 0x%zx resident 0x%zx\n", a->committed, a->resident);
 
     printf("regions:\n");
     vmm_region_t* r;
     bst_for_every_entry(&a->regions, r, vmm_region_t, node) {
         dump_region(r);
     }
+    mutex_release(&a->lock);
 }
 
 static int cmd_vmm(int argc, const cmd_args* argv) {
@@ -1333,6 +1677,7 @@ static int cmd_vmm(int argc, const cmd_args* argv) {
         printf("usage:\n");
         printf("%s aspaces\n", argv[0].str);
         printf("%s alloc <size> <align_pow2>\n", argv[0].str);
+        printf("%s alloc_lazy <size> <align_pow2>\n", argv[0].str);
         printf("%s alloc_physical <paddr> <size> <align_pow2>\n", argv[0].str);
         printf("%s alloc_contig <size> <align_pow2>\n", argv[0].str);
         printf("%s free_region <address>\n", argv[0].str);
@@ -1349,9 +1694,11 @@ static int cmd_vmm(int argc, const cmd_args* argv) {
 
     if (!strcmp(argv[1].str, "aspaces")) {
         vmm_aspace_t* a;
+        mutex_acquire(&vmm_lock);
         list_for_every_entry(&aspace_list, a, vmm_aspace_t, node) {
             dump_aspace(a);
         }
+        mutex_release(&vmm_lock);
     } else if (!strcmp(argv[1].str, "alloc")) {
         if (argc < 4)
             goto notenoughargs;
@@ -1360,6 +1707,14 @@ static int cmd_vmm(int argc, const cmd_args* argv) {
         status_t err = vmm_alloc(test_aspace, "alloc test", argv[2].u, &ptr,
                                  argv[3].u, 0, 0);
         printf("vmm_alloc returns %d, ptr %p\n", err, ptr);
+    } else if (!strcmp(argv[1].str, "alloc_lazy")) {
+        if (argc < 4)
+            goto notenoughargs;
+
+        void* ptr = (void*)0x99;
+        status_t err = vmm_alloc(test_aspace, "lazy test", argv[2].u, &ptr,
+                                 argv[3].u, VMM_FLAG_LAZY, 0);
+        printf("vmm_alloc returns %d, ptr %p\n", err, ptr);
     } else if (!strcmp(argv[1].str, "alloc_physical")) {
         if (argc < 4)
             goto notenoughargs;
@@ -33,6 +33,21 @@ static size_t bst_node_rank(struct bst_node *node) {
     return node ? node->rank : 0;
 }
 
+/**
+ * bst_augment_path - Internal helper function
+ * @root:   Tree.
+ * @node:   Lowest node with a changed subtree.
+ *
+ * Call @root->augment on @node and every ancestor of @node.
+ */
+static void bst_augment_path(struct bst_root *root, struct bst_node *node) {
+    DEBUG_ASSERT(root->augment);
+
+    for (; node; node = node->parent) {
+        root->augment(node);
+    }
+}
+
 /**
  * bst_is_right_child - Internal helper function
  * @node:   Node to check.
@@ -121,7 +136,9 @@ static void bst_move_node(struct bst_root *root,
  *      /  \                /    \
  *     A    B              B      C
  *
- * Caller is responsible for updating the rank of the moved nodes.
+ * Caller is responsible for updating the rank of the moved nodes. Augmented
+ * data of the moved nodes is updated here. The set of nodes below @up is the
+ * same as the set of nodes that was below @down, so no other node changes.
  */
 static void bst_rotate(struct bst_root *root, struct bst_node *up,
                        struct bst_node *down, bool up_was_right_child) {
@@ -130,6 +147,10 @@ static void bst_rotate(struct bst_root *root, struct bst_node *up,
     bst_move_node(root, down, up);
     bst_link_node(down, up_was_right_child, move_subtree);
     bst_link_node(up, !up_was_right_child, down);
+    if (root->augment) {
+        root->augment(down);
+        root->augment(up);
+    }
 }
 
 /**
@@ -197,6 +218,11 @@ void bst_update_rank_insert(struct bst_root *root, struct bst_node *node) {
     DEBUG_ASSERT(node);
     DEBUG_ASSERT(node->rank == 1); /* Inserted node must have rank 1 */
 
+    /* Update augmented data before rotations below rely on it */
+    if (root->augment) {
+        bst_augment_path(root, node);
+    }
+
     while (node) {
         bool is_right_child = bst_is_right_child(node);
 
@@ -481,6 +507,10 @@ void bst_delete(struct bst_root *root, struct bst_node *node) {
     }
     bst_move_node(root, node, new_child);
     node->rank = 0;
+    if (root->augment && update_rank_start) {
+        /* update_rank_start is the lowest node whose subtree changed */
+        bst_augment_path(root, update_rank_start);
+    }
     if (update_rank_start) {
         bst_update_rank_delete(root, update_rank_start, update_rank_is_right_child);
     }
@@ -966,3 +966,139 @@ TEST_P(BstTest, RandomInsertDelete) {
         }
     }
 }
+
+/*
+ * Augmented tree tests. Each node is a range [base, base + size) and caches
+ * the largest gap between ranges in its subtree, like vmm regions do.
+ */
+struct bst_test_range {
+    struct bst_node node;
+    size_t base;
+    size_t size;
+    size_t subtree_base;
+    size_t subtree_end;
+    size_t max_gap;
+};
+
+static struct bst_test_range *bst_test_range(struct bst_node *node) {
+    return containerof_null_safe(node, struct bst_test_range, node);
+}
+
+static int bst_test_range_compare(struct bst_node *a, struct bst_node *b) {
+    struct bst_test_range *ra = bst_test_range(a);
+    struct bst_test_range *rb = bst_test_range(b);
+    if (rb->base >= ra->base + ra->size) {
+        return 1;
+    }
+    if (ra->base >= rb->base + rb->size) {
+        return -1;
+    }
+    return 0;
+}
+
+static void bst_test_range_compute(struct bst_node *node,
+                                   struct bst_test_range *out) {
+    struct bst_test_range *r = bst_test_range(node);
+    struct bst_test_range *left = bst_test_range(node->child[0]);
+    struct bst_test_range *right = bst_test_range(node->child[1]);
+
+    out->subtree_base = left ? left->subtree_base : r->base;
+    out->subtree_end = right ? right->subtree_end : r->base + r->size;
+    out->max_gap = 0;
+    if (left) {
+        out->max_gap = MAX(left->max_gap, r->base - left->subtree_end);
+    }
+    if (right) {
+        out->max_gap = MAX(out->max_gap, right->max_gap);
+        out->max_gap = MAX(out->max_gap,
+                           right->subtree_base - (r->base + r->size));
+    }
+}
+
+static void bst_test_range_augment(struct bst_node *node) {
+    bst_test_range_compute(node, bst_test_range(node));
+}
+
+static void bst_test_range_check_augmented(struct bst_node *node) {
+    struct bst_test_range expected;
+
+    if (!node) {
+        return;
+    }
+    bst_test_range_check_augmented(node->child[0]);
+    bst_test_range_check_augmented(node->child[1]);
+    bst_test_range_compute(node, &expected);
+    EXPECT_EQ(bst_test_range(node)->subtree_base, expected.subtree_base);
+    EXPECT_EQ(bst_test_range(node)->subtree_end, expected.subtree_end);
+    EXPECT_EQ(bst_test_range(node)->max_gap, expected.max_gap);
+}
+
+/* Reference implementation, visiting every range like alloc_spot used to */
+static size_t bst_test_range_first_fit_linear(struct bst_root *root,
+                                              size_t space, size_t size) {
+    struct bst_test_range *entry;
+    size_t free_start = 0;
+
+    bst_for_every_entry(root, entry, struct bst_test_range, node) {
+        if (entry->base - free_start >= size) {
+            return free_start;
+        }
+        free_start = entry->base + entry->size;
+    }
+    return space - free_start >= size ? free_start : SIZE_MAX;
+}
+
+static size_t bst_test_range_first_fit_walk(struct bst_node *node,
+                                            size_t low_end, size_t high_base,
+                                            size_t size) {
+    struct bst_test_range *r = bst_test_range(node);
+
+    if (!r) {
+        return high_base - low_end >= size ? low_end : SIZE_MAX;
+    }
+    if (r->max_gap < size && r->subtree_base - low_end < size &&
+        high_base - r->subtree_end < size) {
+        return SIZE_MAX;
+    }
+    size_t ret = bst_test_range_first_fit_walk(node->child[0], low_end,
+                                               r->base, size);
+    if (ret != SIZE_MAX) {
+        return ret;
+    }
+    return bst_test_range_first_fit_walk(node->child[1], r->base + r->size,
+                                         high_base, size);
+}
+
+TEST(BstTest, AugmentedInit) {
+    struct bst_root root;
+    memset(&root, 0xff, sizeof(root));
+    bst_root_initialize_augmented(&root, bst_test_range_augment);
+    EXPECT_EQ(root.root, nullptr);
+    EXPECT_EQ(root.augment, bst_test_range_augment);
+}
+
+TEST(BstTest, AugmentedRandomFirstFit) {
+    const size_t space = 1 << 16;
+    struct bst_root root;
+    struct bst_test_range ranges[500] = {};
+
+    bst_root_initialize_augmented(&root, bst_test_range_augment);
+    for (size_t i = 0; i < countof(ranges) * 100; i++) {
+        struct bst_test_range *r = &ranges[lrand48() % countof(ranges)];
+        if (r->node.rank) {
+            bst_delete(&root, &r->node);
+        } else {
+            r->size = 1 + lrand48() % 256;
+            r->base = lrand48() % (space - r->size);
+            bst_insert(&root, &r->node, bst_test_range_compare);
+        }
+        bst_test_check_tree_valid(&root);
+        bst_test_range_check_augmented(root.root);
+        ASSERT_FALSE(HasFailure());
+
+        size_t size = 1 + lrand48() % 512;
+        ASSERT_EQ(bst_test_range_first_fit_walk(root.root, 0, space, size),
+                  bst_test_range_first_fit_linear(&root, space, size))
+                << "size " << size;
+    }
+}
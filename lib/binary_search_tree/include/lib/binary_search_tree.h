@@ -52,12 +52,29 @@ struct bst_node {
     struct bst_node *child[2];
 };
 
+/**
+ * bst_augment_t - Update function for augmented trees provided by caller
+ * @node: Node to update.
+ *
+ * Called after the children of @node changed, or data in the subtrees below
+ * @node changed. Any data cached in the struct containing @node about its
+ * subtree should be recomputed from @node itself and its direct children,
+ * which are already up to date when this is called.
+ */
+typedef void (*bst_augment_t)(struct bst_node *node);
+
+/**
+ * struct bst_root - Root of binary search tree.
+ * @root:    Pointer to root node or %NULL for an empty tree.
+ * @augment: Optional function to keep per-subtree data up to date, or %NULL.
+ */
 struct bst_root {
     struct bst_node *root;
+    bst_augment_t augment;
 };
 
 #define BST_NODE_INITIAL_VALUE {0, NULL, {NULL, NULL}}
-#define BST_ROOT_INITIAL_VALUE {NULL}
+#define BST_ROOT_INITIAL_VALUE {NULL, NULL}
 
 static inline void bst_node_initialize(struct bst_node *node) {
     /* Set rank to an invalid value to detect double insertion. */
@@ -66,6 +83,23 @@ static inline void bst_node_initialize(struct bst_node *node) {
 
 static inline void bst_root_initialize(struct bst_root *root) {
     root->root = NULL;
+    root->augment = NULL;
+}
+
+/**
+ * bst_root_initialize_augmented - Initialize an augmented tree.
+ * @root:       Tree.
+ * @augment:    Function to call on every node whose subtree changes.
+ *
+ * bst_insert and bst_delete call @augment on each node whose subtree changed,
+ * bottom up, so every node can cache data about its subtree (e.g. the largest
+ * gap between keys) that can be used to prune searches. This adds O(log n)
+ * calls to @augment to every insert and delete.
+ */
+static inline void bst_root_initialize_augmented(struct bst_root *root,
+                                                 bst_augment_t augment) {
+    root->root = NULL;
+    root->augment = augment;
 }
 
 /**
@@ -258,6 +292,7 @@ void bst_delete_all_helper(struct bst_root *root, struct bst_node *node);
 
 /**
  * bst_for_every_entry_delete - Loop over tree and delete every entry.
+ * Augmented data is not updated as nodes are removed.
  * @root:       Tree.
  * @entry:      Entry variable used by loop body.
  * @type:       Type of @entry.
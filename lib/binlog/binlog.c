@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <lib/binlog.h>
+
+#include <arch/ops.h>
+#include <assert.h>
+#include <debug.h>
+#include <kernel/spinlock.h>
+#include <lk/macros.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BINLOG_RING_SIZE
+#define BINLOG_RING_SIZE 4096
+#endif
+
+/* largest record, built on the stack before it is copied to the ring */
+#define BINLOG_MAX_RECORD 256
+
+STATIC_ASSERT(!(BINLOG_RING_SIZE & (BINLOG_RING_SIZE - 1)));
+STATIC_ASSERT(BINLOG_RING_SIZE >= 2 * BINLOG_MAX_RECORD);
+
+#define BINLOG_LONGFLAG     0x1
+#define BINLOG_LONGLONGFLAG 0x2
+#define BINLOG_HALFFLAG     0x4
+#define BINLOG_HALFHALFFLAG 0x8
+#define BINLOG_SIZETFLAG    0x10
+#define BINLOG_INTMAXFLAG   0x20
+#define BINLOG_PTRDIFFFLAG  0x40
+
+struct binlog_ring {
+    spin_lock_t lock;
+    uint32_t head; /* byte offsets, only reduced modulo the size on use */
+    uint32_t tail;
+    uint32_t seq;
+    uint8_t data[BINLOG_RING_SIZE] __ALIGNED(8);
+};
+
+static struct binlog_ring binlog_rings[SMP_MAX_CPUS];
+
+/*
+ * Printed by binlog_dump so the decoder can find out where the kernel was
+ * loaded relative to the addresses in the ELF file.
+ */
+static const char binlog_anchor[] = "binlog anchor";
+
+static struct binlog_record *binlog_ring_at(struct binlog_ring *ring,
+                                            uint32_t pos)
+{
+    return (struct binlog_record *)&ring->data[pos & (BINLOG_RING_SIZE - 1)];
+}
+
+/* append a record, dropping the oldest ones to make room */
+static void binlog_ring_write(struct binlog_ring *ring,
+                              struct binlog_record *rec)
+{
+    uint32_t off = ring->head & (BINLOG_RING_SIZE - 1);
+    uint32_t pad = 0;
+
+    /* records do not wrap, fill the end of the ring and start over */
+    if (off + rec->size > BINLOG_RING_SIZE) {
+        pad = BINLOG_RING_SIZE - off;
+    }
+
+    while (ring->head + pad + rec->size - ring->tail > BINLOG_RING_SIZE) {
+        ring->tail += binlog_ring_at(ring, ring->tail)->size;
+    }
+
+    if (pad) {
+        struct binlog_record *filler = binlog_ring_at(ring, ring->head);
+        filler->size = pad;
+        filler->flags = BINLOG_FLAG_PAD;
+        ring->head += pad;
+    }
+
+    rec->seq = ring->seq++;
+    memcpy(binlog_ring_at(ring, ring->head), rec, rec->size);
+    ring->head += rec->size;
+}
+
+void binlog_vprintf(const char *fmt, va_list ap)
+{
+    uint64_t buf[BINLOG_MAX_RECORD / sizeof(uint64_t)];
+    struct binlog_record *rec = (struct binlog_record *)buf;
+    uint64_t *arg = rec->args;
+    uint64_t *end = buf + countof(buf);
+    uint8_t flags = 0;
+    uint nargs = 0;
+
+    rec->time = current_time_ns();
+    rec->fmt = (uintptr_t)fmt;
+
+    /*
+     * Walk the format like _printf_engine does, but only to pull each
+     * argument off with the right type.
+     */
+    for (const char *f = fmt; *f;) {
+        uint lenflags = 0;
+        uint64_t val;
+        char c;
+
+        if (*f++ != '%') {
+            continue;
+        }
+next_format:
+        c = *f++;
+        switch (c) {
+            case 0:
+                f--;
+                continue;
+            case '0'...'9':
+            case '.':
+            case '-':
+            case '+':
+            case ' ':
+            case '#':
+                goto next_format;
+            case 'l':
+                if (lenflags & BINLOG_LONGFLAG)
+                    lenflags |= BINLOG_LONGLONGFLAG;
+                lenflags |= BINLOG_LONGFLAG;
+                goto next_format;
+            case 'h':
+                if (lenflags & BINLOG_HALFFLAG)
+                    lenflags |= BINLOG_HALFHALFFLAG;
+                lenflags |= BINLOG_HALFFLAG;
+                goto next_format;
+            case 'z':
+                lenflags |= BINLOG_SIZETFLAG;
+                goto next_format;
+            case 'j':
+                lenflags |= BINLOG_INTMAXFLAG;
+                goto next_format;
+            case 't':
+                lenflags |= BINLOG_PTRDIFFFLAG;
+                goto next_format;
+            case 'c':
+                val = va_arg(ap, unsigned int);
+                break;
+            case 'i':
+            case 'd':
+                val = (uint64_t)((lenflags & BINLOG_LONGLONGFLAG) ? va_arg(ap, long long) :
+                    (lenflags & BINLOG_LONGFLAG) ? va_arg(ap, long) :
+                    (lenflags & BINLOG_HALFHALFFLAG) ? (signed char)va_arg(ap, int) :
+                    (lenflags & BINLOG_HALFFLAG) ? (short)va_arg(ap, int) :
+                    (lenflags & BINLOG_SIZETFLAG) ? va_arg(ap, ssize_t) :
+                    (lenflags & BINLOG_INTMAXFLAG) ? va_arg(ap, intmax_t) :
+                    (lenflags & BINLOG_PTRDIFFFLAG) ? va_arg(ap, ptrdiff_t) :
+                    va_arg(ap, int));
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+                val = (lenflags & BINLOG_LONGLONGFLAG) ? va_arg(ap, unsigned long long) :
+                    (lenflags & BINLOG_LONGFLAG) ? va_arg(ap, unsigned long) :
+                    (lenflags & BINLOG_HALFHALFFLAG) ? (unsigned char)va_arg(ap, unsigned int) :
+                    (lenflags & BINLOG_HALFFLAG) ? (unsigned short)va_arg(ap, unsigned int) :
+                    (lenflags & BINLOG_SIZETFLAG) ? va_arg(ap, size_t) :
+                    (lenflags & BINLOG_INTMAXFLAG) ? va_arg(ap, uintmax_t) :
+                    (lenflags & BINLOG_PTRDIFFFLAG) ? (uintptr_t)va_arg(ap, ptrdiff_t) :
+                    va_arg(ap, unsigned int);
+                break;
+            case 'p':
+                val = (uintptr_t)va_arg(ap, void *);
+                break;
+            case 's': {
+                const char *s = va_arg(ap, const char *);
+                if (!s)
+                    s = "<null>";
+                size_t len = strlen(s);
+                size_t words = 1 + DIV_ROUND_UP(len, sizeof(uint64_t));
+                if (words > (size_t)(end - arg)) {
+                    flags |= BINLOG_FLAG_TRUNCATED;
+                    goto done;
+                }
+                arg[words - 1] = 0;
+                *arg = len;
+                memcpy(arg + 1, s, len);
+                arg += words;
+                nargs++;
+                continue;
+            }
+            case 'n':
+                va_arg(ap, void *);
+                continue;
+            case 'f':
+            case 'F':
+            case 'a':
+            case 'A':
+                flags |= BINLOG_FLAG_TRUNCATED;
+                goto done;
+            default:
+                /* %% and unknown conversions take no argument */
+                continue;
+        }
+
+        if (arg == end) {
+            flags |= BINLOG_FLAG_TRUNCATED;
+            goto done;
+        }
+        *arg++ = val;
+        nargs++;
+    }
+
+done:
+    rec->size = (uint8_t *)arg - (uint8_t *)buf;
+    rec->flags = flags;
+    rec->nargs = nargs;
+
+    spin_lock_saved_state_t state;
+    struct binlog_ring *ring = &binlog_rings[arch_curr_cpu_num()];
+    spin_lock_irqsave(&ring->lock, state);
+    /* may have migrated before interrupts were disabled, that is fine */
+    binlog_ring_write(ring, rec);
+    spin_unlock_irqrestore(&ring->lock, state);
+}
+
+void binlog_printf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    binlog_vprintf(fmt, ap);
+    va_end(ap);
+}
+
+void binlog_dump(void)
+{
+    uint8_t *copy = malloc(BINLOG_RING_SIZE);
+    if (!copy) {
+        printf("binlog: no memory for dump\n");
+        return;
+    }
+
+    printf("binlog: anchor %p\n", binlog_anchor);
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct binlog_ring *ring = &binlog_rings[cpu];
+        spin_lock_saved_state_t state;
+        uint32_t head;
+        uint32_t tail;
+
+        /* copy the ring so it is not locked while printing */
+        spin_lock_irqsave(&ring->lock, state);
+        head = ring->head;
+        tail = ring->tail;
+        memcpy(copy, ring->data, BINLOG_RING_SIZE);
+        spin_unlock_irqrestore(&ring->lock, state);
+
+        while (tail != head) {
+            const struct binlog_record *rec =
+                (const void *)&copy[tail & (BINLOG_RING_SIZE - 1)];
+            const uint8_t *bytes = (const uint8_t *)rec;
+
+            tail += rec->size;
+            if (rec->flags & BINLOG_FLAG_PAD) {
+                continue;
+            }
+            printf("binlog: cpu %u ", cpu);
+            for (uint i = 0; i < rec->size; i++) {
+                printf("%02x", bytes[i]);
+            }
+            printf("\n");
+        }
+    }
+
+    free(copy);
+}
+
+#if WITH_LIB_CONSOLE
+
+#include <lib/console.h>
+
+#define BINLOG_BENCH_ITER 1000
+
+static void binlog_bench(void)
+{
+    char buf[128];
+    lk_time_ns_t t;
+
+    t = current_time_ns();
+    for (uint i = 0; i < BINLOG_BENCH_ITER; i++) {
+        binlog_printf("bench %u: addr %p size %zu name %s\n", i, &buf[0],
+                      sizeof(buf), "binlog");
+    }
+    t = current_time_ns() - t;
+    printf("binlog_printf: %llu ns per call\n", t / BINLOG_BENCH_ITER);
+
+    t = current_time_ns();
+    for (uint i = 0; i < BINLOG_BENCH_ITER; i++) {
+        snprintf(buf, sizeof(buf), "bench %u: addr %p size %zu name %s\n", i,
+                 &buf[0], sizeof(buf), "binlog");
+    }
+    t = current_time_ns() - t;
+    printf("snprintf: %llu ns per call\n", t / BINLOG_BENCH_ITER);
+}
+
+static int cmd_binlog(int argc, const cmd_args *argv)
+{
+    if (argc < 2) {
+usage:
+        printf("usage: %s dump\n", argv[0].str);
+        printf("usage: %s printftest\n", argv[0].str);
+        printf("usage: %s bench\n", argv[0].str);
+        return -1;
+    }
+
+    if (!strcmp(argv[1].str, "dump")) {
+        binlog_dump();
+    } else if (!strcmp(argv[1].str, "printftest")) {
+        binlog_printf("a plain string\n");
+        binlog_printf("numbers: %d %d %d %u\n", 1, -2, 3, 99);
+        binlog_printf("sizes: %hhd %hd %ld %lld %zu\n", (signed char)-1,
+                      (short)-2, -3L, -4LL, (size_t)5);
+        binlog_printf("hex: %x %#X %08llx %p\n", 0xabcU, 0xdefU,
+                      0x123456789aULL, &binlog_rings[0]);
+        binlog_printf("strings: '%s' '%-8s' '%s'\n", "a little string", "pad",
+                      (const char *)NULL);
+        binlog_printf("chars: %c%c 100%%\n", 'o', 'k');
+    } else if (!strcmp(argv[1].str, "bench")) {
+        binlog_bench();
+    } else {
+        printf("ERROR unknown command\n");
+        goto usage;
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("binlog", "binary log commands", &cmd_binlog)
+STATIC_COMMAND_END(binlog);
+
+#endif // WITH_LIB_CONSOLE
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <compiler.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Binary logging.
+ *
+ * binlog_printf records the address of its format string, a timestamp and
+ * the raw arguments into a ring for the current cpu instead of formatting
+ * them. Strings passed to %s are copied into the record. The text is
+ * produced offline: "binlog dump" prints the rings as hex and
+ * tools/binlog_decode.py formats them using the kernel ELF file.
+ *
+ * Floating point conversions are not supported, recording stops at the
+ * first one.
+ */
+
+#define BINLOG_FLAG_PAD       0x1 /* filler up to the end of the ring */
+#define BINLOG_FLAG_TRUNCATED 0x2 /* some arguments did not fit */
+
+struct binlog_record {
+    uint16_t size;  /* in bytes, including this header, multiple of 8 */
+    uint8_t flags;
+    uint8_t nargs;
+    uint32_t seq;   /* per cpu, for spotting overwritten records */
+    uint64_t time;  /* current_time_ns() */
+    uint64_t fmt;   /* address of the format string */
+    /*
+     * one word per argument, or for %s a length word followed by the
+     * string, padded to a word
+     */
+    uint64_t args[];
+};
+
+#if WITH_LIB_BINLOG
+
+void binlog_printf(const char *fmt, ...) __PRINTFLIKE(1, 2);
+void binlog_vprintf(const char *fmt, va_list ap);
+
+/* print the rings to the console, for tools/binlog_decode.py */
+void binlog_dump(void);
+
+#else
+
+static inline void __PRINTFLIKE(1, 2) binlog_printf(const char *fmt, ...) {}
+static inline void binlog_vprintf(const char *fmt, va_list ap) {}
+static inline void binlog_dump(void) {}
+
+#endif
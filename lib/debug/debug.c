@@ -28,6 +28,7 @@
 #include <printf.h>
 #include <stdio.h>
 #include <lib/backtrace/backtrace.h>
+#include <lib/io.h>
 #include <list.h>
 #include <arch/ops.h>
 #include <platform.h>
@@ -53,6 +54,9 @@ void _panic(const char *fmt, ...)
     va_list ap;
     struct thread *curr = get_current_thread();
 
+    /* get buffered output out and make the rest synchronous */
+    console_async_panic();
+
     if (thread_lock_held()) {
         printf("panic called with thread lock held\n");
         thread_unlock_ints_disabled();
@@ -32,12 +32,21 @@
 #include <lib/cmpctmalloc.h>
 #include <lib/heap.h>
 #include <lib/page_alloc.h>
+#include <lk/init.h>
+#if CMPCT_GUARD
+#include <err.h>
+#include <kernel/vm.h>
+#endif
 
 // Malloc implementation tuned for space.
 //
 // Allocation strategy takes place with a global mutex.  Freelist entries are
 // kept in linked lists with 8 different sizes per binary order of magnitude
 // and the header size is two words with eager coalescing on free.
+//
+// Small allocations are served from per-cpu caches of already allocated
+// blocks when possible, so they only take the global mutex to move a batch of
+// blocks between a cache and the free lists.
 
 #ifdef DEBUG
 #define CMPCT_DEBUG
@@ -57,6 +66,19 @@
 
 STATIC_ASSERT(IS_PAGE_ALIGNED(HEAP_GROW_SIZE));
 
+// Number of blocks of each small size each cpu can cache, 0 disables the
+// caches. Blocks move between a cache and the free lists CMPCT_CACHE_BATCH at
+// a time.
+#ifndef CMPCT_CPU_CACHE_COUNT
+#define CMPCT_CPU_CACHE_COUNT 16
+#endif
+#define CMPCT_CACHE_BATCH ((CMPCT_CPU_CACHE_COUNT + 1) / 2)
+
+// Only allocations up to this size, which use the first 16 buckets, are
+// cached.
+#define CMPCT_CACHE_MAX_SIZE 128
+#define CMPCT_CACHE_BUCKETS 16
+
 // Individual allocations above 4Mbytes are just fetched directly from the
 // block allocator.
 #define HEAP_ALLOC_VIRTUAL_BITS 22
@@ -88,6 +110,7 @@ typedef struct free_struct {
 
 struct heap {
     size_t size;
+    size_t peak_size;  // High-water mark of size.
     size_t remaining;
     mutex_t lock;
     free_t *free_lists[NUMBER_OF_BUCKETS];
@@ -100,7 +123,57 @@ struct heap {
 // Heap static vars.
 static struct heap theheap;
 
+#if CMPCT_CPU_CACHE_COUNT
+// Cached blocks are allocated as far as the free lists are concerned. The
+// first word of the payload links them together.
+typedef struct cache_obj {
+    struct cache_obj *next;
+#ifdef CMPCT_DEBUG
+    // Set while the block is in a cache, to catch freeing it twice.
+    uintptr_t tag;
+#endif
+} cache_obj_t;
+
+// The smallest block has room for the links of a free_t.
+STATIC_ASSERT(sizeof(cache_obj_t) <= sizeof(free_t) - sizeof(header_t));
+
+#ifdef CMPCT_DEBUG
+#define CACHE_OBJ_TAG(obj) (~(uintptr_t)(obj))
+
+static void cache_obj_tag(cache_obj_t *obj)
+{
+    obj->tag = CACHE_OBJ_TAG(obj);
+}
+
+static void cache_obj_untag(cache_obj_t *obj)
+{
+    DEBUG_ASSERT(obj->tag == CACHE_OBJ_TAG(obj));
+    obj->tag = 0;
+}
+#else
+static void cache_obj_tag(cache_obj_t *obj)
+{
+}
+
+static void cache_obj_untag(cache_obj_t *obj)
+{
+}
+#endif
+
+struct cpu_cache {
+    spin_lock_t lock;
+    cache_obj_t *head[CMPCT_CACHE_BUCKETS];
+    uint count[CMPCT_CACHE_BUCKETS];
+} __CPU_ALIGN;
+
+static struct cpu_cache cpu_cache[SMP_MAX_CPUS];
+
+// Set while cmpct_test runs, as it checks the free list accounting.
+static bool cache_disabled;
+#endif
+
 static ssize_t heap_grow(size_t len, free_t **bucket);
+static void cache_drain(void);
 
 static void lock(void)
 {
@@ -112,6 +185,204 @@ static void unlock(void)
     mutex_release(&theheap.lock);
 }
 
+#if CMPCT_GUARD
+// Sampled allocations get their own vmm region instead of a heap block. The
+// payload ends at the end of the region, so the unmapped gap vmm leaves after
+// every region catches overflows as soon as they happen. Freed regions are
+// replaced by a reservation of the same address range that stays unmapped for
+// a while, so use after free faults too. The header in front of the payload
+// marks it as guarded and holds the requested size.
+
+#if !WITH_KERNEL_VM
+#error CMPCT_GUARD needs WITH_KERNEL_VM
+#endif
+
+// On average one in this many allocations is guarded, 0 turns it off.
+#ifndef CMPCT_GUARD_RATE
+#define CMPCT_GUARD_RATE 1024
+#endif
+
+// Number of freed regions kept unmapped by default, and at most.
+#ifndef CMPCT_GUARD_QUARANTINE
+#define CMPCT_GUARD_QUARANTINE 64
+#endif
+#define CMPCT_GUARD_QUARANTINE_MAX 256
+
+// Larger allocations cost too much address space to guard.
+#ifndef CMPCT_GUARD_MAX_SIZE
+#define CMPCT_GUARD_MAX_SIZE (4 * PAGE_SIZE)
+#endif
+
+// Never a valid pointer, and doesn't look like a free block either.
+#define GUARD_TAG ((header_t *)(uintptr_t)0x4752)
+
+// Payloads keep the 8 byte alignment of heap blocks, the bytes between the
+// end of the requested size and the end of the region are checked on free.
+#define GUARD_ALIGN 8
+
+static struct {
+    mutex_t lock;
+    // Both start at 0 and are set at LK_INIT_LEVEL_VM, before that there is no
+    // kernel address space to allocate from.
+    uint rate;
+    uint quarantine;
+    bool paused;  // Set while cmpct_test runs.
+    uint countdown[SMP_MAX_CPUS];
+    // Ring of quarantined region addresses, oldest at head.
+    vaddr_t ring[CMPCT_GUARD_QUARANTINE_MAX];
+    uint head;
+    uint count;
+    size_t allocs;
+    size_t live;
+    size_t failed;
+} guard = {
+    .lock = MUTEX_INITIAL_VALUE(guard.lock),
+};
+
+static bool is_guarded(header_t *header)
+{
+    return header->left == GUARD_TAG;
+}
+
+static size_t guard_region_size(size_t size)
+{
+    return round_up(round_up(size, GUARD_ALIGN) + sizeof(header_t), PAGE_SIZE);
+}
+
+// Decides whether this allocation is guarded. The per-cpu countdown is not
+// locked, a thread migrating in between only skews the sampling a little.
+static bool guard_sample(size_t size)
+{
+    uint rate = guard.rate;
+    if (rate == 0 || guard.paused || size == 0 || size > CMPCT_GUARD_MAX_SIZE) {
+        return false;
+    }
+    uint *countdown = &guard.countdown[arch_curr_cpu_num()];
+    if (*countdown != 0) {
+        (*countdown)--;
+        return false;
+    }
+    // Randomise the interval so allocation patterns don't alias with it.
+    *countdown = (uint)rand() % (2 * rate);
+    return true;
+}
+
+static void *guard_alloc(size_t size)
+{
+    size_t region_size = guard_region_size(size);
+    void *region;
+    status_t err = vmm_alloc(vmm_get_kernel_aspace(), "cmpct guard",
+                             region_size, &region, 0, 0,
+                             ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    mutex_acquire(&guard.lock);
+    if (err) {
+        guard.failed++;
+    } else {
+        guard.allocs++;
+        guard.live++;
+    }
+    mutex_release(&guard.lock);
+    if (err) {
+        return NULL;
+    }
+
+    char *payload = (char *)region + region_size - round_up(size, GUARD_ALIGN);
+    header_t *header = (header_t *)payload - 1;
+    header->left = GUARD_TAG;
+    header->size = size;
+    memset(payload + size, PADDING_FILL, round_up(size, GUARD_ALIGN) - size);
+#ifdef CMPCT_DEBUG
+    memset(payload, ALLOC_FILL, size);
+#endif
+    return payload;
+}
+
+static void guard_free(header_t *header)
+{
+    vmm_aspace_t *aspace = vmm_get_kernel_aspace();
+    char *payload = (char *)(header + 1);
+    size_t size = header->size;
+    for (size_t i = size; i < round_up(size, GUARD_ALIGN); i++) {
+        if ((unsigned char)payload[i] != PADDING_FILL) {
+            panic("cmpctmalloc: overflow of %zu byte allocation at %p\n",
+                  size, payload);
+        }
+    }
+
+    vaddr_t base = round_down((vaddr_t)header, PAGE_SIZE);
+    size_t region_size = guard_region_size(size);
+    status_t err = vmm_free_region(aspace, base);
+    ASSERT(!err);
+
+    // Another thread can take the address range before it is reserved again,
+    // in which case this block just isn't quarantined.
+    bool reserved = guard.quarantine &&
+        vmm_reserve_space(aspace, "cmpct quarantine", region_size, base) == NO_ERROR;
+    bool queued = false;
+
+    mutex_acquire(&guard.lock);
+    guard.live--;
+    if (reserved && guard.count < CMPCT_GUARD_QUARANTINE_MAX) {
+        guard.ring[(guard.head + guard.count) % CMPCT_GUARD_QUARANTINE_MAX] = base;
+        guard.count++;
+        queued = true;
+    }
+    mutex_release(&guard.lock);
+    if (reserved && !queued) {
+        vmm_free_region(aspace, base);
+    }
+
+    // Release the oldest reservations beyond the quarantine size.
+    for (;;) {
+        vaddr_t evict = 0;
+        mutex_acquire(&guard.lock);
+        if (guard.count > guard.quarantine) {
+            evict = guard.ring[guard.head];
+            guard.head = (guard.head + 1) % CMPCT_GUARD_QUARANTINE_MAX;
+            guard.count--;
+        }
+        mutex_release(&guard.lock);
+        if (evict == 0) break;
+        vmm_free_region(aspace, evict);
+    }
+}
+
+void cmpct_guard_config(uint rate, uint quarantine)
+{
+    mutex_acquire(&guard.lock);
+    guard.rate = rate;
+    guard.quarantine = MIN(quarantine, CMPCT_GUARD_QUARANTINE_MAX);
+    // Start over with the new rate instead of finishing the old intervals.
+    memset(guard.countdown, 0, sizeof(guard.countdown));
+    mutex_release(&guard.lock);
+}
+
+static void guard_init(uint level)
+{
+    cmpct_guard_config(CMPCT_GUARD_RATE, CMPCT_GUARD_QUARANTINE);
+}
+
+LK_INIT_HOOK(cmpct_guard, guard_init, LK_INIT_LEVEL_VM + 1);
+
+static void guard_dump(void)
+{
+    mutex_acquire(&guard.lock);
+    dprintf(INFO, "\tguard: 1 in %u, %zu allocated, %zu live, %zu failed, "
+            "%u/%u quarantined\n", guard.rate, guard.allocs, guard.live,
+            guard.failed, guard.count, guard.quarantine);
+    mutex_release(&guard.lock);
+}
+#else
+static inline bool is_guarded(header_t *header)
+{
+    return false;
+}
+
+static inline void guard_dump(void)
+{
+}
+#endif
+
 static void dump_free(header_t *header)
 {
     dprintf(INFO, "\t\tbase %p, end 0x%lx, len 0x%zx\n", header, (vaddr_t)header + header->size, header->size);
@@ -121,8 +392,9 @@ void cmpct_dump(void)
 {
     lock();
     dprintf(INFO, "Heap dump (using cmpctmalloc):\n");
-    dprintf(INFO, "\tsize %lu, remaining %lu\n",
+    dprintf(INFO, "\tsize %lu, peak %lu, remaining %lu\n",
             (unsigned long)theheap.size,
+            (unsigned long)theheap.peak_size,
             (unsigned long)theheap.remaining);
 
     dprintf(INFO, "\tfree list:\n");
@@ -139,6 +411,28 @@ void cmpct_dump(void)
         }
     }
     unlock();
+
+#if CMPCT_CPU_CACHE_COUNT
+    dprintf(INFO, "\tcpu caches:\n");
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_saved_state_t state;
+        size_t count = 0;
+        size_t bytes = 0;
+        spin_lock_irqsave(&cpu_cache[cpu].lock, state);
+        for (int i = 0; i < CMPCT_CACHE_BUCKETS; i++) {
+            cache_obj_t *obj = cpu_cache[cpu].head[i];
+            for (; obj != NULL; obj = obj->next) {
+                count++;
+                bytes += ((header_t *)obj - 1)->size;
+            }
+        }
+        spin_unlock_irqrestore(&cpu_cache[cpu].lock, state);
+        if (count) {
+            dprintf(INFO, "\t\tcpu %u: %zu blocks, %zu bytes\n", cpu, count, bytes);
+        }
+    }
+#endif
+    guard_dump();
 }
 
 // Operates in sizes that don't include the allocation header.
@@ -570,12 +864,82 @@ static void cmpct_test_return_to_os(void)
     ASSERT(remaining == theheap.remaining);
 }
 
+static void cmpct_test_realloc(void)
+{
+    char *a = cmpct_alloc(256);
+    char *b = cmpct_alloc(256);
+    char *c = cmpct_alloc(256);
+    if (b != a + 256 + sizeof(header_t) || c != b + 256 + sizeof(header_t)) {
+        // Not laid out next to each other, the test below makes no sense.
+        cmpct_free(a);
+        cmpct_free(b);
+        cmpct_free(c);
+        return;
+    }
+    memset(a, 0xa5, 256);
+    cmpct_free(b);
+
+    // Grows into the free neighbour without moving.
+    char *a2 = cmpct_realloc(a, 400);
+    ASSERT(a2 == a);
+    for (int i = 0; i < 256; i++) ASSERT((unsigned char)a2[i] == 0xa5);
+
+    // Takes all of the neighbour, including the bit too small to split off.
+    a2 = cmpct_realloc(a, 512);
+    ASSERT(a2 == a);
+    ASSERT(((header_t *)a - 1)->size >= 512 + sizeof(header_t));
+
+    // Shrinking gives back the tail.
+    a2 = cmpct_realloc(a, 64);
+    ASSERT(a2 == a);
+    for (int i = 0; i < 64; i++) ASSERT((unsigned char)a2[i] == 0xa5);
+    ASSERT(is_tagged_as_free(right_header((header_t *)a - 1)));
+
+    // No room on the right, so this has to move.
+    a2 = cmpct_realloc(a, 1024);
+    ASSERT(a2 != a);
+    for (int i = 0; i < 64; i++) ASSERT((unsigned char)a2[i] == 0xa5);
+
+    cmpct_free(a2);
+    cmpct_free(c);
+}
+
+#if CMPCT_GUARD
+static void cmpct_test_guard(void)
+{
+    static const size_t sizes[] = {1, 8, 100, PAGE_SIZE, PAGE_SIZE + 3};
+    for (size_t i = 0; i < countof(sizes); i++) {
+        size_t size = sizes[i];
+        char *a = guard_alloc(size);
+        ASSERT(a != NULL);
+        ASSERT(is_guarded((header_t *)a - 1));
+        // The payload ends right before the unmapped gap after the region.
+        ASSERT(IS_PAGE_ALIGNED(a + round_up(size, GUARD_ALIGN)));
+        memset(a, 0xa5, size);
+
+        char *a2 = cmpct_realloc(a, size + 1);
+        ASSERT(a2 != NULL && a2 != a);
+        for (size_t j = 0; j < size; j++) ASSERT((unsigned char)a2[j] == 0xa5);
+        cmpct_free(a2);
+    }
+}
+#endif
+
 void cmpct_test(void)
 {
+#if CMPCT_CPU_CACHE_COUNT
+    cache_disabled = true;
+    cache_drain();
+#endif
+#if CMPCT_GUARD
+    guard.paused = true;
+    cmpct_test_guard();
+#endif
     cmpct_test_buckets();
     cmpct_test_get_back_newly_freed();
     cmpct_test_return_to_os();
     cmpct_test_trim();
+    cmpct_test_realloc();
     cmpct_dump();
     void *ptr[16];
 
@@ -628,6 +992,12 @@ void cmpct_test(void)
     }
 
     cmpct_dump();
+#if CMPCT_CPU_CACHE_COUNT
+    cache_disabled = false;
+#endif
+#if CMPCT_GUARD
+    guard.paused = false;
+#endif
 }
 
 static void *large_alloc(size_t size)
@@ -639,7 +1009,8 @@ static void *large_alloc(size_t size)
     free_t *free_area = NULL;
     lock();
     if (heap_grow(size, &free_area) < 0) {
-      return 0;
+        unlock();
+        return NULL;
     }
     void *result =
         create_allocation_header(free_area, 0, free_area->header.size, free_area->header.left);
@@ -658,15 +1029,21 @@ static void *large_alloc(size_t size)
     return result;
 }
 
-void cmpct_trim(void)
+size_t cmpct_trim(void)
 {
     // Look at free list entries that are at least as large as one page plus a
     // header. They might be at the start or the end of a block, so we can trim
-    // them and free the page(s).
-    lock();
+    // them and free the page(s). Cached blocks keep their neighbours from
+    // coalescing, so give them back first.
+    cache_drain();
+    size_t trimmed = 0;
     for (int bucket = size_to_index_freeing(PAGE_SIZE);
             bucket < NUMBER_OF_BUCKETS;
             bucket++) {
+        // Take the lock per bucket, so allocations don't wait for the whole
+        // walk. A trimmed area that moves to a later bucket has nothing left
+        // to trim when it is seen again.
+        lock();
         free_t *next;
         for (free_t *free_area = theheap.free_lists[bucket];
                 free_area != NULL;
@@ -693,6 +1070,7 @@ void cmpct_trim(void)
                 create_free_area(free_area, untag(free_area->header.left), new_free_size, NULL);
                 page_free(new_os_allocation_end, freed_up >> PAGE_SIZE_SHIFT);
                 theheap.size -= freed_up;
+                trimmed += freed_up;
             } else if (is_start_of_os_allocation(untag(free_area->header.left))) {
                 char *old_os_allocation_start =
                     (char *)round_down((uintptr_t)free_area, PAGE_SIZE);
@@ -724,24 +1102,18 @@ void cmpct_trim(void)
                 }
                 page_free(old_os_allocation_start, freed_up >> PAGE_SIZE_SHIFT);
                 theheap.size -= freed_up;
+                trimmed += freed_up;
             }
         }
+        unlock();
     }
-    unlock();
+    return trimmed;
 }
 
-void *cmpct_alloc(size_t size)
+// Allocates a block with room for rounded_up bytes including the header from
+// the free lists. Called with the lock held.
+static void *alloc_locked(size_t size, int start_bucket, size_t rounded_up)
 {
-    if (size == 0u) return NULL;
-
-    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
-
-    size_t rounded_up;
-    int start_bucket = size_to_index_allocating(size, &rounded_up);
-
-    rounded_up += sizeof(header_t);
-
-    lock();
     int bucket = find_nonempty_bucket(start_bucket);
     if (bucket == -1) {
         // Grow heap by at least 12% if we can.
@@ -750,7 +1122,6 @@ void *cmpct_alloc(size_t size)
                                 MAX(HEAP_GROW_SIZE, rounded_up)));
         while (heap_grow(growby, NULL) < 0) {
             if (growby <= rounded_up) {
-                unlock();
                 return NULL;
             }
             growby = MAX(growby >> 1, rounded_up);
@@ -774,22 +1145,205 @@ void *cmpct_alloc(size_t size)
     } else {
         unlink_free(head, bucket);
     }
-    void *result =
-        create_allocation_header(head, 0, head->header.size, head->header.left);
+    return create_allocation_header(head, 0, head->header.size, head->header.left);
+}
+
+static void free_locked(header_t *header);
+
+#if CMPCT_CPU_CACHE_COUNT
+static struct cpu_cache *get_cpu_cache(spin_lock_saved_state_t *state)
+{
+    // If we migrate after reading the cpu number we just use the cache of the
+    // cpu we were on, the lock keeps that safe.
+    struct cpu_cache *cache = &cpu_cache[arch_curr_cpu_num()];
+    spin_lock_irqsave(&cache->lock, *state);
+    return cache;
+}
+
+// Frees a list of cached blocks to the free lists.
+static void cache_release_list(cache_obj_t *obj)
+{
+    if (obj == NULL) return;
+    lock();
+    while (obj != NULL) {
+        cache_obj_t *next = obj->next;
+        free_locked((header_t *)obj - 1);
+        obj = next;
+    }
+    unlock();
+}
+
+// Returns a block from the cache for cache_index, refilling the cache with a
+// batch from the free lists if it is empty.
+static void *cache_alloc(int cache_index, int start_bucket, size_t rounded_up)
+{
+    spin_lock_saved_state_t state;
+    struct cpu_cache *cache = get_cpu_cache(&state);
+    cache_obj_t *obj = cache->head[cache_index];
+    if (obj != NULL) {
+        cache->head[cache_index] = obj->next;
+        cache->count[cache_index]--;
+        spin_unlock_irqrestore(&cache->lock, state);
+        cache_obj_untag(obj);
+        return obj;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    cache_obj_t *batch = NULL;
+    cache_obj_t *tail = NULL;
+    uint count = 0;
+    size_t size = rounded_up - sizeof(header_t);
+    lock();
+    for (; count < CMPCT_CACHE_BATCH; count++) {
+        obj = alloc_locked(size, start_bucket, rounded_up);
+        if (obj == NULL) break;
+        cache_obj_tag(obj);
+        obj->next = batch;
+        batch = obj;
+        if (tail == NULL) tail = obj;
+    }
+    unlock();
+    if (batch == NULL) return NULL;
+
+    // Keep the first block for ourselves and cache the rest.
+    obj = batch;
+    batch = batch->next;
+    cache_obj_untag(obj);
+    if (batch != NULL) {
+        cache = get_cpu_cache(&state);
+        tail->next = cache->head[cache_index];
+        cache->head[cache_index] = batch;
+        cache->count[cache_index] += count - 1;
+        spin_unlock_irqrestore(&cache->lock, state);
+    }
+    return obj;
+}
+
+// Puts a small block in the cache, moving a batch of older blocks to the free
+// lists if the cache is full. Returns false if the block can't be cached.
+static bool cache_free(header_t *header)
+{
+    if (cache_disabled) return false;
+    // Check the size first, large allocations are outside the bucket range.
+    if (header->size - sizeof(header_t) > CMPCT_CACHE_MAX_SIZE) return false;
+
+    int cache_index = size_to_index_freeing(header->size - sizeof(header_t));
+    DEBUG_ASSERT(cache_index < CMPCT_CACHE_BUCKETS);
+
+    spin_lock_saved_state_t state;
+    cache_obj_t *release = NULL;
+    cache_obj_t *obj = (cache_obj_t *)(header + 1);
 #ifdef CMPCT_DEBUG
-    memset(result, ALLOC_FILL, size);
-    memset(((char *)result) + size, PADDING_FILL, rounded_up - size - sizeof(header_t));
+    DEBUG_ASSERT(obj->tag != CACHE_OBJ_TAG(obj));  // Double free!
+    memset(obj + 1, FREE_FILL, header->size - sizeof(header_t) - sizeof(*obj));
+#endif
+    cache_obj_tag(obj);
+    struct cpu_cache *cache = get_cpu_cache(&state);
+    if (cache->count[cache_index] >= CMPCT_CPU_CACHE_COUNT) {
+        release = cache->head[cache_index];
+        cache_obj_t *last = release;
+        for (uint i = 1; i < CMPCT_CACHE_BATCH; i++) last = last->next;
+        cache->head[cache_index] = last->next;
+        last->next = NULL;
+        cache->count[cache_index] -= CMPCT_CACHE_BATCH;
+    }
+    obj->next = cache->head[cache_index];
+    cache->head[cache_index] = obj;
+    cache->count[cache_index]++;
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    cache_release_list(release);
+    return true;
+}
+
+// Moves every cached block back to the free lists.
+static void cache_drain(void)
+{
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_saved_state_t state;
+        cache_obj_t *lists[CMPCT_CACHE_BUCKETS];
+        spin_lock_irqsave(&cpu_cache[cpu].lock, state);
+        for (int i = 0; i < CMPCT_CACHE_BUCKETS; i++) {
+            lists[i] = cpu_cache[cpu].head[i];
+            cpu_cache[cpu].head[i] = NULL;
+            cpu_cache[cpu].count[i] = 0;
+        }
+        spin_unlock_irqrestore(&cpu_cache[cpu].lock, state);
+        for (int i = 0; i < CMPCT_CACHE_BUCKETS; i++) {
+            cache_release_list(lists[i]);
+        }
+    }
+}
+#else
+static void cache_drain(void)
+{
+}
 #endif
+
+static void *alloc_from_heap(size_t size)
+{
+    if (size == 0u) return NULL;
+    // Leave room for the headers and rounding in heap_grow so they can't
+    // wrap around, no allocation this big can succeed anyway.
+    if (size > SIZE_MAX - PAGE_SIZE) return NULL;
+
+    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
+
+    size_t rounded_up;
+    int start_bucket = size_to_index_allocating(size, &rounded_up);
+    void *result;
+
+#if CMPCT_CPU_CACHE_COUNT
+    if (rounded_up <= CMPCT_CACHE_MAX_SIZE && !cache_disabled) {
+        // Blocks are cached by the bucket they are freed to, which for the
+        // smallest sizes is not the bucket they are allocated from.
+        int cache_index = size_to_index_freeing(rounded_up);
+        result = cache_alloc(cache_index, start_bucket, rounded_up + sizeof(header_t));
+        goto done;
+    }
+#endif
+
+    rounded_up += sizeof(header_t);
+
+    lock();
+    result = alloc_locked(size, start_bucket, rounded_up);
     unlock();
+
+#if CMPCT_CPU_CACHE_COUNT
+done:
+#endif
+#ifdef CMPCT_DEBUG
+    if (result != NULL) {
+        size_t block_size = ((header_t *)result - 1)->size - sizeof(header_t);
+        memset(result, ALLOC_FILL, size);
+        memset(((char *)result) + size, PADDING_FILL, block_size - size);
+    }
+#endif
     return result;
 }
 
+void *cmpct_alloc(size_t size)
+{
+#if CMPCT_GUARD
+    if (guard_sample(size)) {
+        void *result = guard_alloc(size);
+        if (result != NULL) return result;
+    }
+#endif
+    return alloc_from_heap(size);
+}
+
 void *cmpct_memalign(size_t size, size_t alignment)
 {
     if (alignment < 8) return cmpct_alloc(size);
-    size_t padded_size =
-        size + alignment + sizeof(free_t) + sizeof(header_t);
-    char *unaligned = (char *)cmpct_alloc(padded_size);
+    size_t padded_size;
+    if (__builtin_add_overflow(size, alignment + sizeof(free_t) + sizeof(header_t),
+                               &padded_size)) {
+        return NULL;
+    }
+    // The block is split below, so it has to come from the heap.
+    char *unaligned = (char *)alloc_from_heap(padded_size);
+    if (unaligned == NULL) return NULL;
     lock();
     size_t mask = alignment - 1;
     uintptr_t payload_int = (uintptr_t)unaligned + sizeof(free_t) +
@@ -818,8 +1372,40 @@ void cmpct_free(void *payload)
     if (payload == NULL) return;
     header_t *header = (header_t *)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
-    size_t size = header->size;
+#if CMPCT_GUARD
+    if (is_guarded(header)) {
+        guard_free(header);
+        return;
+    }
+#endif
+#if CMPCT_CPU_CACHE_COUNT
+    if (cache_free(header)) return;
+#endif
     lock();
+    free_locked(header);
+    unlock();
+}
+
+// The size is what the caller asked for, the block can be bigger, so the header
+// still decides where the block goes. The size does catch callers freeing
+// with the wrong type though.
+void cmpct_free_sized(void *payload, size_t size)
+{
+    if (payload == NULL) return;
+    header_t *header = (header_t *)payload - 1;
+    if (is_guarded(header)) {
+        DEBUG_ASSERT(size <= header->size);
+    } else {
+        DEBUG_ASSERT(size <= header->size - sizeof(header_t));
+    }
+    cmpct_free(payload);
+}
+
+// Returns a block to the free lists, coalescing it with free neighbours.
+// Called with the lock held.
+static void free_locked(header_t *header)
+{
+    size_t size = header->size;
     header_t *left = header->left;
     if (left != NULL && is_tagged_as_free(left)) {
         // Coalesce with left free object.
@@ -848,15 +1434,74 @@ void cmpct_free(void *payload)
             free_memory(header, left, size);
         }
     }
-    unlock();
+}
+
+// Resizes an allocated block in place so it is rounded_up bytes including the
+// header, growing into a free right neighbour if there is one and giving back
+// any tail that is big enough to be a free area. Returns false if there isn't
+// enough room. Called with the lock held.
+static bool realloc_in_place_locked(header_t *header, size_t rounded_up)
+{
+    header_t *right = right_header(header);
+    size_t available = header->size;
+    bool right_is_free = is_tagged_as_free(right);
+    if (right_is_free) available += right->size;
+    if (available < rounded_up) return false;
+
+    size_t left_over = available - rounded_up;
+    // Nothing to do if the block stays put and the tail is too small to free.
+    if (!right_is_free && left_over < sizeof(free_t)) return true;
+
+    header_t *next = (header_t *)((char *)header + available);
+    if (right_is_free) unlink_free_unknown_bucket((free_t *)right);
+    if (left_over >= sizeof(free_t)) {
+        header->size = rounded_up;
+        void *free = (char *)header + rounded_up;
+        create_free_area(free, header, left_over, NULL);
+        FixLeftPointer(next, (header_t *)free);
+    } else {
+        header->size = available;
+        FixLeftPointer(next, header);
+    }
+    return true;
 }
 
 void *cmpct_realloc(void *payload, size_t size)
 {
     if (payload == NULL) return cmpct_alloc(size);
+    if (size == 0u) {
+        cmpct_free(payload);
+        return NULL;
+    }
     header_t *header = (header_t *)payload - 1;
-    size_t old_size = header->size - sizeof(header_t);
+    bool guarded = is_guarded(header);
+    size_t old_size = guarded ? header->size : header->size - sizeof(header_t);
+
+    // Large allocations own their OS allocation, so they can't be resized in
+    // place and are not allowed to become free list entries either. Guarded
+    // blocks have no neighbours to grow into.
+    if (!guarded && size + sizeof(header_t) <= (1u << HEAP_ALLOC_VIRTUAL_BITS) &&
+            header->size <= (1u << HEAP_ALLOC_VIRTUAL_BITS)) {
+        size_t rounded_up;
+        size_to_index_allocating(size, &rounded_up);
+        rounded_up += sizeof(header_t);
+        lock();
+        bool resized = realloc_in_place_locked(header, rounded_up);
+        unlock();
+        if (resized) {
+#ifdef CMPCT_DEBUG
+            size_t block_size = header->size - sizeof(header_t);
+            if (size > old_size) {
+                memset((char *)payload + old_size, ALLOC_FILL, size - old_size);
+            }
+            memset((char *)payload + size, PADDING_FILL, block_size - size);
+#endif
+            return payload;
+        }
+    }
+
     void *new_payload = cmpct_alloc(size);
+    if (new_payload == NULL) return NULL;
     memcpy(new_payload, payload, MIN(size, old_size));
     cmpct_free(payload);
     return new_payload;
@@ -887,6 +1532,7 @@ static ssize_t heap_grow(size_t size, free_t **bucket)
     void *ptr = page_alloc(size >> PAGE_SIZE_SHIFT, PAGE_ALLOC_ANY_ARENA);
     if (ptr == NULL) return -1;
     theheap.size += size;
+    theheap.peak_size = MAX(theheap.peak_size, theheap.size);
     LTRACEF("growing heap by 0x%zx bytes, new ptr %p\n", size, ptr);
     add_to_heap(ptr, size, bucket);
     return size;
@@ -899,6 +1545,15 @@ void cmpct_init(void)
     // Create a mutex.
     mutex_init(&theheap.lock);
 
+#if CMPCT_CPU_CACHE_COUNT
+    size_t rounded_up;
+    size_to_index_allocating(CMPCT_CACHE_MAX_SIZE, &rounded_up);
+    ASSERT(size_to_index_freeing(rounded_up) == CMPCT_CACHE_BUCKETS - 1);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&cpu_cache[cpu].lock);
+    }
+#endif
+
     // Initialize the free list.
     for (int i = 0; i < NUMBER_OF_BUCKETS; i++) {
         theheap.free_lists[i] = NULL;
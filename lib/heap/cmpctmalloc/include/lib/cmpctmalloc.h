@@ -23,17 +23,27 @@
 #pragma once
 
 #include <compiler.h>
+#include <sys/types.h>
 
 __BEGIN_CDECLS;
 
 void *cmpct_alloc(size_t);
 void *cmpct_realloc(void *, size_t);
 void cmpct_free(void *);
+void cmpct_free_sized(void *, size_t);
 void *cmpct_memalign(size_t size, size_t alignment);
 
 void cmpct_init(void);
 void cmpct_dump(void);
 void cmpct_test(void);
-void cmpct_trim(void);
+/* Returns the number of bytes given back to the page allocator. */
+size_t cmpct_trim(void);
+
+/*
+ * Guard one in @rate allocations (on average) with unmapped pages and keep up
+ * to @quarantine freed guarded allocations unmapped. A @rate of 0 turns
+ * sampling off. Only available when built with CMPCT_GUARD.
+ */
+void cmpct_guard_config(uint rate, uint quarantine);
 
 __END_CDECLS;
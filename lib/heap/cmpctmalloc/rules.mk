@@ -5,4 +5,11 @@ MODULE := $(LOCAL_DIR)
 MODULE_SRCS += \
 	$(LOCAL_DIR)/cmpctmalloc.c
 
+# Sample allocations into guard paged regions to catch overflows and use after
+# free, see cmpct_guard_config(). Needs the kernel vm.
+LK_HEAP_GUARD ?= false
+ifeq (true,$(call TOBOOL,$(LK_HEAP_GUARD)))
+GLOBAL_DEFINES += CMPCT_GUARD=1
+endif
+
 include make/module.mk
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "heap_profile.h"
+
+#include <assert.h>
+#include <compiler.h>
+#include <debug.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef HEAP_PROFILE_SITES
+#define HEAP_PROFILE_SITES 256
+#endif
+
+/* Give up looking for a free slot after this many and use the overflow slot */
+#define HEAP_PROFILE_MAX_PROBE 16
+
+/* Bucket i counts allocations of up to 16 << i bytes, the last one the rest */
+#define HEAP_PROFILE_BUCKETS 14
+#define HEAP_PROFILE_MIN_BUCKET_SHIFT 4
+
+/* Callsites printed by one heap_profile_dump() call at most */
+#define HEAP_PROFILE_DUMP_MAX 32
+
+struct heap_profile_hdr {
+    size_t size;
+    uint32_t site;
+    uint32_t offset;
+};
+
+STATIC_ASSERT(sizeof(struct heap_profile_hdr) <= HEAP_PROFILE_HDR_SIZE);
+
+struct heap_profile_site {
+    uintptr_t caller;
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t live_count;
+    size_t allocs;
+    size_t frees;
+    uint32_t hist[HEAP_PROFILE_BUCKETS];
+};
+
+/* Slot 0 collects allocations from callsites that did not fit in the table */
+static struct heap_profile_site heap_profile_sites[HEAP_PROFILE_SITES];
+static size_t heap_profile_live_bytes;
+static size_t heap_profile_peak_bytes;
+static spin_lock_t heap_profile_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static struct heap_profile_site heap_profile_snapshot[HEAP_PROFILE_DUMP_MAX];
+static mutex_t heap_profile_dump_lock =
+        MUTEX_INITIAL_VALUE(heap_profile_dump_lock);
+
+static struct heap_profile_hdr *heap_profile_hdr(const void *ptr) {
+    return (struct heap_profile_hdr *)((uintptr_t)ptr - HEAP_PROFILE_HDR_SIZE);
+}
+
+static uint heap_profile_bucket(size_t size) {
+    if (size <= (1U << HEAP_PROFILE_MIN_BUCKET_SHIFT)) {
+        return 0;
+    }
+    uint bits = sizeof(unsigned long) * 8 -
+                __builtin_clzl((unsigned long)size - 1);
+    return MIN(bits - HEAP_PROFILE_MIN_BUCKET_SHIFT, HEAP_PROFILE_BUCKETS - 1);
+}
+
+/* Called with heap_profile_lock held */
+static uint32_t heap_profile_site_index(uintptr_t caller) {
+    uint hash = (uint)(caller >> 2) * 2654435761U;
+
+    for (uint i = 0; i < HEAP_PROFILE_MAX_PROBE; i++) {
+        uint32_t index = 1 + (hash + i) % (HEAP_PROFILE_SITES - 1);
+        struct heap_profile_site *site = &heap_profile_sites[index];
+
+        if (site->caller == caller) {
+            return index;
+        }
+        if (!site->caller) {
+            site->caller = caller;
+            return index;
+        }
+    }
+    return 0;
+}
+
+void *heap_profile_track(void *base, size_t pad, size_t size, void *caller) {
+    spin_lock_saved_state_t state;
+
+    if (!base) {
+        return NULL;
+    }
+
+    void *ptr = (uint8_t *)base + pad;
+    struct heap_profile_hdr *hdr = heap_profile_hdr(ptr);
+
+    spin_lock_irqsave(&heap_profile_lock, state);
+    uint32_t index = heap_profile_site_index((uintptr_t)caller);
+    struct heap_profile_site *site = &heap_profile_sites[index];
+
+    site->live_bytes += size;
+    site->peak_bytes = MAX(site->peak_bytes, site->live_bytes);
+    site->live_count++;
+    site->allocs++;
+    site->hist[heap_profile_bucket(size)]++;
+    heap_profile_live_bytes += size;
+    heap_profile_peak_bytes =
+            MAX(heap_profile_peak_bytes, heap_profile_live_bytes);
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+
+    hdr->size = size;
+    hdr->site = index;
+    hdr->offset = pad;
+    return ptr;
+}
+
+void *heap_profile_untrack(void *ptr) {
+    spin_lock_saved_state_t state;
+
+    if (!ptr) {
+        return NULL;
+    }
+
+    struct heap_profile_hdr *hdr = heap_profile_hdr(ptr);
+    DEBUG_ASSERT(hdr->site < HEAP_PROFILE_SITES);
+    struct heap_profile_site *site = &heap_profile_sites[hdr->site];
+
+    spin_lock_irqsave(&heap_profile_lock, state);
+    DEBUG_ASSERT(site->live_bytes >= hdr->size && site->live_count);
+    site->live_bytes -= hdr->size;
+    site->live_count--;
+    site->frees++;
+    heap_profile_live_bytes -= hdr->size;
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+
+    return (uint8_t *)ptr - hdr->offset;
+}
+
+size_t heap_profile_size(const void *ptr) {
+    return heap_profile_hdr(ptr)->size;
+}
+
+size_t heap_profile_offset(const void *ptr) {
+    return heap_profile_hdr(ptr)->offset;
+}
+
+void heap_profile_reset(void) {
+    spin_lock_saved_state_t state;
+
+    spin_lock_irqsave(&heap_profile_lock, state);
+    for (uint i = 0; i < HEAP_PROFILE_SITES; i++) {
+        struct heap_profile_site *site = &heap_profile_sites[i];
+
+        site->peak_bytes = site->live_bytes;
+        site->allocs = site->live_count;
+        site->frees = 0;
+        memset(site->hist, 0, sizeof(site->hist));
+    }
+    heap_profile_peak_bytes = heap_profile_live_bytes;
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+}
+
+static void heap_profile_print_size(size_t size) {
+    if (size >= 1024 * 1024) {
+        printf("%zuM", size / (1024 * 1024));
+    } else if (size >= 1024) {
+        printf("%zuK", size / 1024);
+    } else {
+        printf("%zu", size);
+    }
+}
+
+static void heap_profile_print_site(const struct heap_profile_site *site) {
+    if (site->caller) {
+        printf("%18p", (void *)site->caller);
+    } else {
+        printf("%18s", "(other)");
+    }
+    printf(" %10zu %10zu %8zu %10zu %10zu ", site->live_bytes,
+           site->peak_bytes, site->live_count, site->allocs, site->frees);
+    for (uint i = 0; i < HEAP_PROFILE_BUCKETS; i++) {
+        if (!site->hist[i]) {
+            continue;
+        }
+        size_t limit = (size_t)1 << (i + HEAP_PROFILE_MIN_BUCKET_SHIFT);
+        printf(" %s", i == HEAP_PROFILE_BUCKETS - 1 ? ">" : "<=");
+        heap_profile_print_size(i == HEAP_PROFILE_BUCKETS - 1 ? limit / 2
+                                                             : limit);
+        printf(":%u", site->hist[i]);
+    }
+    printf("\n");
+}
+
+void heap_profile_dump(uint count) {
+    spin_lock_saved_state_t state;
+    uint used = 0;
+    uint sites = 0;
+
+    count = MIN(count, HEAP_PROFILE_DUMP_MAX);
+
+    mutex_acquire(&heap_profile_dump_lock);
+
+    /* keep the @count sites with the most live bytes, sorted */
+    spin_lock_irqsave(&heap_profile_lock, state);
+    for (uint i = 0; i < HEAP_PROFILE_SITES; i++) {
+        const struct heap_profile_site *site = &heap_profile_sites[i];
+
+        if (!site->allocs && !site->live_count) {
+            continue;
+        }
+        sites++;
+
+        uint pos = used;
+        while (pos && heap_profile_snapshot[pos - 1].live_bytes <
+                              site->live_bytes) {
+            pos--;
+        }
+        if (pos >= count) {
+            continue;
+        }
+        if (used < count) {
+            used++;
+        }
+        memmove(&heap_profile_snapshot[pos + 1], &heap_profile_snapshot[pos],
+                (used - pos - 1) * sizeof(heap_profile_snapshot[0]));
+        heap_profile_snapshot[pos] = *site;
+    }
+    size_t live_bytes = heap_profile_live_bytes;
+    size_t peak_bytes = heap_profile_peak_bytes;
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+
+    printf("heap profile: %u callsites, %zu bytes live, %zu bytes peak\n",
+           sites, live_bytes, peak_bytes);
+    printf("%18s %10s %10s %8s %10s %10s  %s\n", "caller", "live", "peak",
+           "objs", "allocs", "frees", "sizes");
+    for (uint i = 0; i < used; i++) {
+        heap_profile_print_site(&heap_profile_snapshot[i]);
+    }
+
+    mutex_release(&heap_profile_dump_lock);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <compiler.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS;
+
+/*
+ * Allocation profiler used by heap_wrapper.c when the kernel is built with
+ * LK_HEAP_PROFILE=true.
+ *
+ * Every allocation gets a small header in front of the pointer returned to
+ * the caller. The header remembers the requested size and which callsite
+ * made the allocation, so free() can charge the bytes back to the right
+ * entry in a fixed size table of callsites.
+ */
+
+#if HEAP_PROFILE
+
+/* Bytes reserved in front of each allocation, keeps 16 byte alignment. */
+#define HEAP_PROFILE_HDR_SIZE 16
+
+/**
+ * heap_profile_pad() - Bytes to allocate in addition to the requested size.
+ * @boundary: Alignment requested by the caller, or 0.
+ *
+ * Return: The offset of the returned pointer from the heap block, large
+ * enough for the header and a multiple of @boundary.
+ */
+static inline size_t heap_profile_pad(size_t boundary) {
+    return boundary > HEAP_PROFILE_HDR_SIZE ? boundary : HEAP_PROFILE_HDR_SIZE;
+}
+
+/**
+ * heap_profile_track() - Record a new allocation.
+ * @base:   Heap block returned by the heap implementation, or %NULL.
+ * @pad:    Value returned by heap_profile_pad() for this allocation.
+ * @size:   Size requested by the caller.
+ * @caller: Return address of the allocating function.
+ *
+ * Return: The pointer to hand to the caller, or %NULL if @base is %NULL.
+ */
+void *heap_profile_track(void *base, size_t pad, size_t size, void *caller);
+
+/**
+ * heap_profile_untrack() - Record a free.
+ * @ptr: Pointer returned by heap_profile_track(), or %NULL.
+ *
+ * Return: The heap block to pass to the heap implementation.
+ */
+void *heap_profile_untrack(void *ptr);
+
+/**
+ * heap_profile_size() - Size requested for a tracked allocation.
+ * @ptr: Pointer returned by heap_profile_track().
+ */
+size_t heap_profile_size(const void *ptr);
+
+/**
+ * heap_profile_offset() - Offset of @ptr from the start of its heap block.
+ * @ptr: Pointer returned by heap_profile_track().
+ */
+size_t heap_profile_offset(const void *ptr);
+
+/**
+ * heap_profile_dump() - Print the callsites holding the most live bytes.
+ * @count: Maximum number of callsites to print.
+ */
+void heap_profile_dump(uint count);
+
+/**
+ * heap_profile_reset() - Clear the cumulative counters of all callsites.
+ *
+ * Live byte and object counts are kept, since the allocations they describe
+ * are still outstanding.
+ */
+void heap_profile_reset(void);
+
+#else
+
+static inline size_t heap_profile_pad(size_t boundary) {
+    return 0;
+}
+
+static inline void *heap_profile_track(void *base,
+                                       size_t pad,
+                                       size_t size,
+                                       void *caller) {
+    return base;
+}
+
+static inline void *heap_profile_untrack(void *ptr) {
+    return ptr;
+}
+
+#endif
+
+__END_CDECLS;
@@ -25,6 +25,7 @@
 #include <trace.h>
 #include <debug.h>
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
@@ -32,6 +33,14 @@
 #include <kernel/spinlock.h>
 #include <lib/console.h>
 #include <lib/page_alloc.h>
+#include <lib/slab.h>
+#include <lk/init.h>
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
+
+#include "heap_priv.h"
+#include "heap_profile.h"
 
 #define LOCAL_TRACE 0
 
@@ -78,6 +87,7 @@ static inline void HEAP_INIT(void)
 #define HEAP_MALLOC cmpct_alloc
 #define HEAP_REALLOC cmpct_realloc
 #define HEAP_FREE cmpct_free
+#define HEAP_FREE_SIZED cmpct_free_sized
 #define HEAP_INIT cmpct_init
 #define HEAP_DUMP cmpct_dump
 #define HEAP_TRIM cmpct_trim
@@ -124,48 +134,140 @@ static inline void HEAP_DUMP(void)
     dlmalloc_inspect_all(&dump_callback, NULL);
 }
 
-static inline void HEAP_TRIM(void) { dlmalloc_trim(0); }
+/* dlmalloc doesn't say how much it gave back */
+static inline size_t HEAP_TRIM(void) { dlmalloc_trim(0); return 0; }
 
 /* end dlmalloc implementation */
 #else
 #error need to select valid heap implementation or provide wrapper
 #endif
 
+#if !defined(HEAP_FREE_SIZED) || HEAP_PROFILE
+/* the profiler header makes the heap block bigger than the caller thinks */
+#undef HEAP_FREE_SIZED
+#define HEAP_FREE_SIZED(p, s) HEAP_FREE(p)
+#endif
+
 void heap_init(void)
 {
     HEAP_INIT();
 }
 
-void heap_trim(void)
+size_t heap_trim(void)
 {
-    HEAP_TRIM();
+    /* slab pages go back to the page allocator, not the heap */
+    size_t trimmed = kmem_trim();
+    trimmed += HEAP_TRIM();
+    LTRACEF("trimmed %zu bytes\n", trimmed);
+    return trimmed;
 }
 
-void *malloc(size_t size)
+#if WITH_KERNEL_VM
+/* give free heap pages back when the pmm runs low */
+static size_t heap_shrink(struct vm_shrinker *shrinker, size_t count)
+{
+    return heap_trim() >> PAGE_SIZE_SHIFT;
+}
+
+static struct vm_shrinker heap_shrinker =
+    VM_SHRINKER_INITIAL_VALUE("heap", heap_shrink);
+
+static void heap_shrinker_init(uint level)
+{
+    vm_register_shrinker(&heap_shrinker);
+}
+
+LK_INIT_HOOK(heap_shrinker, heap_shrinker_init, LK_INIT_LEVEL_VM);
+#endif
+
+#if HEAP_PROFILE
+static void *heap_profile_realloc(void *ptr, size_t size, void *caller)
+{
+    size_t pad = heap_profile_pad(0);
+
+    if (size > SIZE_MAX - pad)
+        return NULL;
+
+    if (!ptr)
+        return heap_profile_track(HEAP_MALLOC(size + pad), pad, size, caller);
+
+    if (!size) {
+        HEAP_FREE(heap_profile_untrack(ptr));
+        return NULL;
+    }
+
+    if (heap_profile_offset(ptr) == pad) {
+        /* the header moves along with the data, untrack it from the copy */
+        void *base = HEAP_REALLOC((uint8_t *)ptr - pad, size + pad);
+        if (!base)
+            return NULL;
+        heap_profile_untrack((uint8_t *)base + pad);
+        return heap_profile_track(base, pad, size, caller);
+    }
+
+    /* memalign() block, the padding in front of it can't be kept */
+    void *ptr2 = heap_profile_track(HEAP_MALLOC(size + pad), pad, size, caller);
+    if (!ptr2)
+        return NULL;
+    memcpy(ptr2, ptr, MIN(size, heap_profile_size(ptr)));
+    HEAP_FREE(heap_profile_untrack(ptr));
+    return ptr2;
+}
+#endif
+
+void *malloc_caller(size_t size, void *caller)
 {
     LTRACEF("size %zd\n", size);
 
-    void *ptr = HEAP_MALLOC(size);
+    size_t pad = heap_profile_pad(0);
+    if (size > SIZE_MAX - pad)
+        return NULL;
+
+    void *ptr = heap_profile_track(HEAP_MALLOC(size + pad), pad, size, caller);
     if (heap_trace)
-        printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
+        printf("caller %p malloc %zu -> %p\n", caller, size, ptr);
     return ptr;
 }
 
-void *memalign(size_t boundary, size_t size)
+void *malloc(size_t size)
+{
+    return malloc_caller(size, __GET_CALLER());
+}
+
+void *memalign_caller(size_t boundary, size_t size, void *caller)
 {
     LTRACEF("boundary %zu, size %zd\n", boundary, size);
 
-    void *ptr = HEAP_MEMALIGN(boundary, size);
+    size_t pad = heap_profile_pad(boundary);
+    if (size > SIZE_MAX - pad)
+        return NULL;
+
+    void *ptr = heap_profile_track(HEAP_MEMALIGN(boundary, size + pad), pad,
+                                   size, caller);
     if (heap_trace)
-        printf("caller %p memalign %zu, %zu -> %p\n", __GET_CALLER(), boundary, size, ptr);
+        printf("caller %p memalign %zu, %zu -> %p\n", caller, boundary, size, ptr);
     return ptr;
 }
 
+void *memalign(size_t boundary, size_t size)
+{
+    return memalign_caller(boundary, size, __GET_CALLER());
+}
+
 void *calloc(size_t count, size_t size)
 {
     LTRACEF("count %zu, size %zd\n", count, size);
 
-    void *ptr = HEAP_CALLOC(count, size);
+    void *ptr;
+    size_t pad = heap_profile_pad(0);
+    if (pad) {
+        if (size && count > (SIZE_MAX - pad) / size)
+            return NULL;
+        ptr = heap_profile_track(HEAP_CALLOC(1, count * size + pad), pad,
+                                 count * size, __GET_CALLER());
+    } else {
+        ptr = HEAP_CALLOC(count, size);
+    }
     if (heap_trace)
         printf("caller %p calloc %zu, %zu -> %p\n", __GET_CALLER(), count, size, ptr);
     return ptr;
@@ -175,7 +277,11 @@ void *realloc(void *ptr, size_t size)
 {
     LTRACEF("ptr %p, size %zd\n", ptr, size);
 
+#if HEAP_PROFILE
+    void *ptr2 = heap_profile_realloc(ptr, size, __GET_CALLER());
+#else
     void *ptr2 = HEAP_REALLOC(ptr, size);
+#endif
     if (heap_trace)
         printf("caller %p realloc %p, %zu -> %p\n", __GET_CALLER(), ptr, size, ptr2);
     return ptr2;
@@ -187,7 +293,16 @@ void free(void *ptr)
     if (heap_trace)
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
 
-    HEAP_FREE(ptr);
+    HEAP_FREE(heap_profile_untrack(ptr));
+}
+
+void free_sized(void *ptr, size_t size)
+{
+    LTRACEF("ptr %p, size %zu\n", ptr, size);
+    if (heap_trace)
+        printf("caller %p free_sized %p, %zu\n", __GET_CALLER(), ptr, size);
+
+    HEAP_FREE_SIZED(heap_profile_untrack(ptr), size);
 }
 
 static void heap_dump(void)
@@ -272,7 +387,14 @@ usage:
         printf("usage:\n");
         printf("\t%s info\n", argv[0].str);
         printf("\t%s trace\n", argv[0].str);
+#if HEAP_PROFILE
+        printf("\t%s profile [count]\n", argv[0].str);
+        printf("\t%s profile reset\n", argv[0].str);
+#endif
         printf("\t%s trim\n", argv[0].str);
+#if CMPCT_GUARD
+        printf("\t%s guard <rate> <quarantine>\n", argv[0].str);
+#endif
         printf("\t%s alloc <size> [alignment]\n", argv[0].str);
         printf("\t%s realloc <ptr> <size>\n", argv[0].str);
         printf("\t%s free <address>\n", argv[0].str);
@@ -286,8 +408,21 @@ usage:
     } else if (strcmp(argv[1].str, "trace") == 0) {
         heap_trace = !heap_trace;
         printf("heap trace is now %s\n", heap_trace ? "on" : "off");
+#if HEAP_PROFILE
+    } else if (strcmp(argv[1].str, "profile") == 0) {
+        if (argc >= 3 && strcmp(argv[2].str, "reset") == 0)
+            heap_profile_reset();
+        else
+            heap_profile_dump((argc >= 3) ? argv[2].u : 16);
+#endif
+#if CMPCT_GUARD
+    } else if (strcmp(argv[1].str, "guard") == 0) {
+        if (argc < 4) goto notenoughargs;
+
+        cmpct_guard_config(argv[2].u, argv[3].u);
+#endif
     } else if (strcmp(argv[1].str, "trim") == 0) {
-        heap_trim();
+        printf("trimmed %zu bytes\n", heap_trim());
     } else if (strcmp(argv[1].str, "alloc") == 0) {
         if (argc < 3) goto notenoughargs;
 
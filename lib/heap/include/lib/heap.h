@@ -35,9 +35,13 @@ void *calloc(size_t count, size_t size) __WARN_UNUSED_RESULT;
 void *realloc(void *ptr, size_t size) __WARN_UNUSED_RESULT;
 void free(void *ptr);
 
+/* free with the size that was allocated, as used by sized operator delete */
+void free_sized(void *ptr, size_t size);
+
 void heap_init(void);
 
-/* tell the heap to return any free pages it can find */
-void heap_trim(void);
+/* tell the heap to return any free pages it can find, returns how many bytes
+ * went back to the page allocator */
+size_t heap_trim(void);
 
 __END_CDECLS;
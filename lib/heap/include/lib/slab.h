@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <arch/ops.h>
+#include <compiler.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS;
+
+/*
+ * Object caches for fixed size kernel objects.
+ *
+ * Objects are carved out of page sized slabs obtained from page_alloc(), so a
+ * cache has no per-object header and returns whole pages once all objects in
+ * a slab are freed. Each cpu keeps a small magazine of free objects that
+ * kmem_cache_alloc() and kmem_cache_free() use without taking the cache lock.
+ */
+
+#ifndef KMEM_MAGAZINE_SIZE
+#define KMEM_MAGAZINE_SIZE 16
+#endif
+
+typedef void (*kmem_ctor_t)(void *obj);
+
+struct kmem_slab;
+
+struct kmem_magazine {
+    spin_lock_t lock;
+    uint count;
+    void *objs[KMEM_MAGAZINE_SIZE];
+} __CPU_ALIGN;
+
+struct kmem_cache {
+    const char *name;
+    size_t size;
+    size_t align;
+    kmem_ctor_t ctor;
+
+    /*
+     * Filled in by the first allocation under kmem_lock, read without it once
+     * @setup is set.
+     */
+    bool setup;
+    bool heap_backed;
+    size_t link;
+    size_t first;
+    size_t stride;
+    uint objs_per_slab;
+
+    mutex_t lock;
+    struct list_node partial;
+    struct list_node full;
+    struct kmem_slab *empty;
+    size_t slab_count;
+    size_t objs_out;
+    struct list_node node;
+
+    struct kmem_magazine mag[SMP_MAX_CPUS];
+};
+
+#define KMEM_CACHE_INITIAL_VALUE(c, _name, _size, _align, _ctor) \
+{ \
+    .name = (_name), \
+    .size = (_size), \
+    .align = (_align), \
+    .ctor = (_ctor), \
+    .lock = MUTEX_INITIAL_VALUE((c).lock), \
+    .partial = LIST_INITIAL_VALUE((c).partial), \
+    .full = LIST_INITIAL_VALUE((c).full), \
+    .node = LIST_INITIAL_CLEARED_VALUE, \
+}
+
+/**
+ * KMEM_CACHE_DEFINE - Statically define a cache for objects of a type.
+ * @var:    Name of the &struct kmem_cache variable.
+ * @type:   Type of the objects.
+ * @ctor:   Optional constructor, see kmem_cache_create().
+ *
+ * Caches defined this way can be used as soon as the heap is up, which avoids
+ * init ordering problems for objects that are allocated during early boot.
+ */
+#define KMEM_CACHE_DEFINE(var, type, ctor) \
+    struct kmem_cache var = KMEM_CACHE_INITIAL_VALUE(var, #type, \
+                                                     sizeof(type), \
+                                                     __alignof__(type), ctor)
+
+/**
+ * kmem_cache_create - Create a cache for objects of a fixed size.
+ * @name:   Name shown by the slab console command. Not copied.
+ * @size:   Size of each object.
+ * @align:  Minimum alignment of each object, or 0 for pointer alignment.
+ * @ctor:   Optional function called once for each object when its slab is
+ *          allocated. Objects must be returned to kmem_cache_free() in their
+ *          constructed state.
+ *
+ * Return: The new cache, or %NULL if out of memory.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, kmem_ctor_t ctor);
+
+/**
+ * kmem_cache_destroy - Destroy a cache created by kmem_cache_create().
+ * @cache:  Cache to destroy. All objects must have been freed.
+ */
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+/**
+ * kmem_cache_alloc - Allocate an object from a cache.
+ * @cache:  Cache to allocate from.
+ *
+ * Must be called from thread context.
+ *
+ * Return: An object of @cache->size bytes, or %NULL if out of memory.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache) __MALLOC __WARN_UNUSED_RESULT;
+
+/**
+ * kmem_cache_zalloc - Allocate a zeroed object from a cache.
+ * @cache:  Cache to allocate from. Must not have a constructor.
+ *
+ * Return: A zero filled object, or %NULL if out of memory.
+ */
+void *kmem_cache_zalloc(struct kmem_cache *cache) __MALLOC __WARN_UNUSED_RESULT;
+
+/**
+ * kmem_cache_free - Return an object to the cache it was allocated from.
+ * @cache:  Cache @obj was allocated from.
+ * @obj:    Object to free, or %NULL.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+/**
+ * kmem_cache_trim - Return cached objects and empty slabs to the page
+ *                   allocator.
+ * @cache:  Cache to trim.
+ *
+ * Return: the number of bytes given back to the page allocator.
+ */
+size_t kmem_cache_trim(struct kmem_cache *cache);
+
+/* trim every cache, called by heap_trim(), returns the bytes given back */
+size_t kmem_trim(void);
+
+__END_CDECLS;
@@ -43,6 +43,7 @@ void miniheap_free(void *);
 
 void miniheap_init(void *ptr, size_t len);
 void miniheap_dump(void);
-void miniheap_trim(void);
+/* returns the number of bytes given back to the page allocator */
+size_t miniheap_trim(void);
 
 __END_CDECLS;
@@ -321,9 +321,72 @@ retry:
     return ptr;
 }
 
+// try to resize an allocation in place, by growing into the free chunk right
+// after it or by giving back the unused tail. Returns false if it has to move.
+static bool heap_resize_in_place(struct alloc_struct_begin *as, void *ptr, size_t size)
+{
+    // the padding check would need to move too, just take the slow path
+    if (DEBUG_HEAP)
+        return false;
+
+    size_t new_len = round_up((addr_t)ptr - (addr_t)as->ptr + size, sizeof(void *));
+    new_len = MAX(new_len, sizeof(struct free_heap_chunk));
+
+    if (new_len <= as->size) {
+        size_t tail = as->size - new_len;
+        if (tail <= sizeof(struct free_heap_chunk))
+            return true;
+
+        as->size = new_len;
+        heap_insert_free_chunk(heap_create_free_chunk((uint8_t *)as->ptr + new_len, tail, true));
+        return true;
+    }
+
+    bool resized = false;
+    vaddr_t end = (vaddr_t)as->ptr + as->size;
+
+    mutex_acquire(&theheap.lock);
+
+    // the free list is sorted, so stop once we are past the end of the allocation
+    struct free_heap_chunk *chunk;
+    list_for_every_entry(&theheap.free_list, chunk, struct free_heap_chunk, node) {
+        if ((vaddr_t)chunk < end)
+            continue;
+        if ((vaddr_t)chunk > end || as->size + chunk->len < new_len)
+            break;
+
+        size_t grow = new_len - as->size;
+        struct list_node *next_node = list_next(&theheap.free_list, &chunk->node);
+        list_delete(&chunk->node);
+
+        if (chunk->len > grow + sizeof(struct free_heap_chunk)) {
+            // put what we don't need back where the chunk used to be
+            struct free_heap_chunk *newchunk =
+                heap_create_free_chunk((uint8_t *)chunk + grow, chunk->len - grow, false);
+            if (next_node)
+                list_add_before(next_node, &newchunk->node);
+            else
+                list_add_tail(&theheap.free_list, &newchunk->node);
+        } else {
+            grow = chunk->len;
+        }
+
+        as->size += grow;
+        theheap.remaining -= grow;
+        if (theheap.remaining < theheap.low_watermark) {
+            theheap.low_watermark = theheap.remaining;
+        }
+        resized = true;
+        break;
+    }
+
+    mutex_release(&theheap.lock);
+
+    return resized;
+}
+
 void *miniheap_realloc(void *ptr, size_t size)
 {
-    /* slow implementation */
     if (!ptr)
         return miniheap_malloc(size);
     if (size == 0) {
@@ -331,12 +394,21 @@ void *miniheap_realloc(void *ptr, size_t size)
         return NULL;
     }
 
-    // XXX better implementation
+    struct alloc_struct_begin *as = (struct alloc_struct_begin *)ptr;
+    as--;
+
+    DEBUG_ASSERT(as->magic == HEAP_MAGIC);
+
+    if (heap_resize_in_place(as, ptr, size))
+        return ptr;
+
     void *p = miniheap_malloc(size);
     if (!p)
         return NULL;
 
-    memcpy(p, ptr, size); // XXX wrong
+    // only copy what the old allocation could hold
+    size_t old_size = (addr_t)as->ptr + as->size - (addr_t)ptr;
+    memcpy(p, ptr, MIN(size, old_size));
     miniheap_free(ptr);
 
     return p;
@@ -380,10 +452,11 @@ void miniheap_free(void *ptr)
 #endif
 }
 
-void miniheap_trim(void)
+size_t miniheap_trim(void)
 {
     LTRACE_ENTRY;
 
+    size_t trimmed = 0;
     mutex_acquire(&theheap.lock);
 
     // walk through the list, finding free chunks that can be returned to the page allocator
@@ -467,10 +540,12 @@ free_chunk:
 
             // tweak accounting
             theheap.remaining -= end_page - start_page;
+            trimmed += end_page - start_page;
         }
     }
 
     mutex_release(&theheap.lock);
+    return trimmed;
 }
 
 void miniheap_get_stats(struct miniheap_stats *ptr)
@@ -24,28 +24,130 @@
 #include <debug.h>
 #include <lib/heap.h>
 
+#include "heap_priv.h"
+
+const std::nothrow_t std::nothrow{};
+
+/*
+ * Pass our own caller to the heap, so heap tracing and the heap profiler
+ * show where the object was allocated instead of this file.
+ */
+static void *alloc_aligned(size_t s, std::align_val_t align, void *caller)
+{
+    return memalign_caller(static_cast<size_t>(align), s, caller);
+}
+
 void *operator new(size_t s)
 {
-    return malloc(s);
+    return malloc_caller(s, __GET_CALLER());
+}
+
+void *operator new(size_t s, const std::nothrow_t &) noexcept
+{
+    return malloc_caller(s, __GET_CALLER());
+}
+
+void *operator new(size_t s, std::align_val_t align)
+{
+    return alloc_aligned(s, align, __GET_CALLER());
+}
+
+void *operator new(size_t s, std::align_val_t align,
+                   const std::nothrow_t &) noexcept
+{
+    return alloc_aligned(s, align, __GET_CALLER());
 }
 
 void *operator new[](size_t s)
 {
-    return malloc(s);
+    return malloc_caller(s, __GET_CALLER());
 }
 
-void *operator new(size_t , void *p)
+void *operator new[](size_t s, const std::nothrow_t &) noexcept
+{
+    return malloc_caller(s, __GET_CALLER());
+}
+
+void *operator new[](size_t s, std::align_val_t align)
+{
+    return alloc_aligned(s, align, __GET_CALLER());
+}
+
+void *operator new[](size_t s, std::align_val_t align,
+                     const std::nothrow_t &) noexcept
+{
+    return alloc_aligned(s, align, __GET_CALLER());
+}
+
+void *operator new(size_t , void *p) noexcept
+{
+    return p;
+}
+
+void *operator new[](size_t , void *p) noexcept
 {
     return p;
 }
 
-void operator delete(void *p)
+/* memalign allocations are freed with free, so alignment doesn't matter here */
+void operator delete(void *p) noexcept
+{
+    return free(p);
+}
+
+void operator delete(void *p, size_t s) noexcept
+{
+    return free_sized(p, s);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    return free(p);
+}
+
+void operator delete(void *p, size_t s, std::align_val_t) noexcept
+{
+    return free_sized(p, s);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    return free(p);
+}
+
+void operator delete(void *p, std::align_val_t,
+                     const std::nothrow_t &) noexcept
+{
+    return free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    return free(p);
+}
+
+void operator delete[](void *p, size_t s) noexcept
+{
+    return free_sized(p, s);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
 {
     return free(p);
 }
 
-void operator delete[](void *p)
+void operator delete[](void *p, size_t s, std::align_val_t) noexcept
+{
+    return free_sized(p, s);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
 {
     return free(p);
 }
 
+void operator delete[](void *p, std::align_val_t,
+                       const std::nothrow_t &) noexcept
+{
+    return free(p);
+}
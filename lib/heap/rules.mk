@@ -6,7 +6,16 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/heap_wrapper.c \
-	$(LOCAL_DIR)/page_alloc.c
+	$(LOCAL_DIR)/page_alloc.c \
+	$(LOCAL_DIR)/slab.c
+
+# record per-callsite allocation statistics, see "heap profile"
+LK_HEAP_PROFILE ?= false
+ifeq (true,$(call TOBOOL,$(LK_HEAP_PROFILE)))
+MODULE_SRCS += \
+	$(LOCAL_DIR)/heap_profile.c
+MODULE_DEFINES += HEAP_PROFILE=1
+endif
 
 ifeq ($(WITH_CPP_SUPPORT),true)
 MODULE_SRCS += \
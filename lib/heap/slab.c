@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2022 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <lib/slab.h>
+
+#include <assert.h>
+#include <debug.h>
+#include <lib/heap.h>
+#include <lib/page_alloc.h>
+#include <pow2.h>
+#include <string.h>
+#include <trace.h>
+
+#define LOCAL_TRACE 0
+
+/*
+ * Number of objects moved between a magazine and the slabs at a time. Half a
+ * magazine leaves room for both allocations and frees after a transfer.
+ */
+#define KMEM_BATCH ((KMEM_MAGAZINE_SIZE + 1) / 2)
+
+/* caches that can't fit this many objects in a page are backed by the heap */
+#define KMEM_MIN_OBJS_PER_SLAB 4
+
+/*
+ * A slab is a single page. The header lives at the start of the page so the
+ * slab of an object is found by rounding its address down.
+ */
+struct kmem_slab {
+    struct list_node node;
+    struct kmem_cache *cache;
+    void *free;
+    uint inuse;
+};
+
+/* protects kmem_caches, lock order is kmem_lock -> cache->lock */
+static mutex_t kmem_lock = MUTEX_INITIAL_VALUE(kmem_lock);
+static struct list_node kmem_caches = LIST_INITIAL_VALUE(kmem_caches);
+
+static inline void **kmem_link(struct kmem_cache *cache, void *obj)
+{
+    return (void **)((uint8_t *)obj + cache->link);
+}
+
+static void kmem_cache_setup(struct kmem_cache *cache)
+{
+    mutex_acquire(&kmem_lock);
+    if (cache->setup) {
+        mutex_release(&kmem_lock);
+        return;
+    }
+
+    size_t align = MAX(cache->align, sizeof(void *));
+    ASSERT(ispow2(align));
+    ASSERT(cache->size);
+
+    /*
+     * Free objects are linked through their first word, unless there is a
+     * constructor in which case the link goes after the object so the
+     * constructed state survives.
+     */
+    if (cache->ctor) {
+        cache->link = round_up(cache->size, sizeof(void *));
+        cache->stride = round_up(cache->link + sizeof(void *), align);
+    } else {
+        cache->link = 0;
+        cache->stride = round_up(MAX(cache->size, sizeof(void *)), align);
+    }
+    cache->first = round_up(sizeof(struct kmem_slab), align);
+    if (cache->first + cache->stride * KMEM_MIN_OBJS_PER_SLAB > PAGE_SIZE) {
+        cache->heap_backed = true;
+        cache->objs_per_slab = 0;
+    } else {
+        cache->objs_per_slab = (PAGE_SIZE - cache->first) / cache->stride;
+    }
+    LTRACEF("%s: size %zu stride %zu objs_per_slab %u\n", cache->name,
+            cache->size, cache->stride, cache->objs_per_slab);
+
+    list_add_tail(&kmem_caches, &cache->node);
+    smp_wmb();
+    cache->setup = true;
+    mutex_release(&kmem_lock);
+}
+
+static struct kmem_slab *kmem_slab_create(struct kmem_cache *cache)
+{
+    struct kmem_slab *slab = page_alloc(1, PAGE_ALLOC_ANY_ARENA);
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->cache = cache;
+    slab->free = NULL;
+    slab->inuse = 0;
+
+    /* build the free list backwards so objects are handed out in order */
+    uint8_t *obj = (uint8_t *)slab + cache->first +
+                   cache->stride * cache->objs_per_slab;
+    for (uint i = 0; i < cache->objs_per_slab; i++) {
+        obj -= cache->stride;
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        *kmem_link(cache, obj) = slab->free;
+        slab->free = obj;
+    }
+    return slab;
+}
+
+static uint kmem_slab_alloc_locked(struct kmem_cache *cache, void **objs,
+                                   uint count)
+{
+    uint n = 0;
+
+    DEBUG_ASSERT(is_mutex_held(&cache->lock));
+
+    while (n < count) {
+        struct kmem_slab *slab = list_peek_head_type(&cache->partial,
+                                                     struct kmem_slab, node);
+        if (!slab) {
+            slab = cache->empty;
+            if (!slab) {
+                break;
+            }
+            cache->empty = NULL;
+            list_add_head(&cache->partial, &slab->node);
+        }
+        while (n < count && slab->free) {
+            void *obj = slab->free;
+            slab->free = *kmem_link(cache, obj);
+            slab->inuse++;
+            objs[n++] = obj;
+        }
+        if (!slab->free) {
+            list_delete(&slab->node);
+            list_add_head(&cache->full, &slab->node);
+        }
+    }
+    cache->objs_out += n;
+    return n;
+}
+
+/*
+ * Returns @obj to its slab. If that empties a slab other than the one spare
+ * empty slab kept per cache, the slab is returned for the caller to free.
+ */
+static struct kmem_slab *kmem_slab_free_locked(struct kmem_cache *cache,
+                                               void *obj)
+{
+    struct kmem_slab *slab =
+            (struct kmem_slab *)round_down((uintptr_t)obj, PAGE_SIZE);
+
+    DEBUG_ASSERT(is_mutex_held(&cache->lock));
+    DEBUG_ASSERT(slab->cache == cache);
+    DEBUG_ASSERT(slab->inuse);
+
+    if (!slab->free) {
+        list_delete(&slab->node);
+        list_add_head(&cache->partial, &slab->node);
+    }
+    *kmem_link(cache, obj) = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->objs_out--;
+
+    if (slab->inuse) {
+        return NULL;
+    }
+    list_delete(&slab->node);
+    if (!cache->empty) {
+        cache->empty = slab;
+        return NULL;
+    }
+    cache->slab_count--;
+    return slab;
+}
+
+/* returns the number of slabs freed */
+static size_t kmem_slabs_free(struct list_node *list)
+{
+    struct kmem_slab *slab;
+    size_t count = 0;
+    while ((slab = list_remove_head_type(list, struct kmem_slab, node))) {
+        page_free(slab, 1);
+        count++;
+    }
+    return count;
+}
+
+/* gets up to @count objects from the slabs, allocating a new slab if needed */
+static uint kmem_cache_refill(struct kmem_cache *cache, void **objs,
+                              uint count)
+{
+    uint n;
+
+    if (cache->heap_backed) {
+        for (n = 0; n < count; n++) {
+            objs[n] = memalign(MAX(cache->align, sizeof(void *)), cache->size);
+            if (!objs[n]) {
+                break;
+            }
+            if (cache->ctor) {
+                cache->ctor(objs[n]);
+            }
+        }
+        mutex_acquire(&cache->lock);
+        cache->objs_out += n;
+        mutex_release(&cache->lock);
+        return n;
+    }
+
+    mutex_acquire(&cache->lock);
+    n = kmem_slab_alloc_locked(cache, objs, count);
+    if (!n) {
+        /* run the constructors without holding the lock */
+        mutex_release(&cache->lock);
+        struct kmem_slab *slab = kmem_slab_create(cache);
+        mutex_acquire(&cache->lock);
+        if (slab) {
+            cache->slab_count++;
+            list_add_head(&cache->partial, &slab->node);
+            n = kmem_slab_alloc_locked(cache, objs, count);
+        }
+    }
+    mutex_release(&cache->lock);
+    return n;
+}
+
+/*
+ * returns @count objects to the slabs and frees any slabs that became empty,
+ * returns the number of slabs freed
+ */
+static size_t kmem_cache_release(struct kmem_cache *cache, void **objs,
+                                 uint count)
+{
+    struct list_node empty = LIST_INITIAL_VALUE(empty);
+
+    if (!count) {
+        return 0;
+    }
+
+    if (cache->heap_backed) {
+        for (uint i = 0; i < count; i++) {
+            free(objs[i]);
+        }
+        mutex_acquire(&cache->lock);
+        cache->objs_out -= count;
+        mutex_release(&cache->lock);
+        return 0;
+    }
+
+    mutex_acquire(&cache->lock);
+    for (uint i = 0; i < count; i++) {
+        struct kmem_slab *slab = kmem_slab_free_locked(cache, objs[i]);
+        if (slab) {
+            list_add_tail(&empty, &slab->node);
+        }
+    }
+    mutex_release(&cache->lock);
+
+    return kmem_slabs_free(&empty);
+}
+
+static struct kmem_magazine *kmem_get_magazine(struct kmem_cache *cache,
+                                               spin_lock_saved_state_t *state)
+{
+    /*
+     * If we migrate after reading the cpu number we just use the magazine of
+     * the cpu we were on, the lock keeps that safe.
+     */
+    struct kmem_magazine *mag = &cache->mag[arch_curr_cpu_num()];
+    spin_lock_irqsave(&mag->lock, *state);
+    return mag;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    spin_lock_saved_state_t state;
+    struct kmem_magazine *mag;
+    void *objs[KMEM_BATCH];
+    void *obj;
+
+    DEBUG_ASSERT(cache);
+
+    mag = kmem_get_magazine(cache, &state);
+    if (mag->count) {
+        obj = mag->objs[--mag->count];
+        spin_unlock_irqrestore(&mag->lock, state);
+        return obj;
+    }
+    spin_unlock_irqrestore(&mag->lock, state);
+
+    if (!cache->setup) {
+        kmem_cache_setup(cache);
+    }
+    smp_rmb();
+
+    uint n = kmem_cache_refill(cache, objs, countof(objs));
+    if (!n) {
+        return NULL;
+    }
+
+    /* keep the last object for ourselves and load the rest */
+    obj = objs[--n];
+    if (n) {
+        mag = kmem_get_magazine(cache, &state);
+        uint take = MIN(n, KMEM_MAGAZINE_SIZE - mag->count);
+        memcpy(&mag->objs[mag->count], objs, take * sizeof(objs[0]));
+        mag->count += take;
+        spin_unlock_irqrestore(&mag->lock, state);
+        kmem_cache_release(cache, objs + take, n - take);
+    }
+    return obj;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cache)
+{
+    DEBUG_ASSERT(!cache->ctor);
+
+    void *obj = kmem_cache_alloc(cache);
+    if (obj) {
+        memset(obj, 0, cache->size);
+    }
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    spin_lock_saved_state_t state;
+    struct kmem_magazine *mag;
+    void *release[KMEM_BATCH];
+    uint n = 0;
+
+    DEBUG_ASSERT(cache);
+
+    if (!obj) {
+        return;
+    }
+    DEBUG_ASSERT(cache->setup);
+
+    mag = kmem_get_magazine(cache, &state);
+    if (mag->count == KMEM_MAGAZINE_SIZE) {
+        /* the oldest objects are the least likely to still be in the cache */
+        n = KMEM_BATCH;
+        memcpy(release, mag->objs, n * sizeof(release[0]));
+        mag->count -= n;
+        memmove(mag->objs, mag->objs + n, mag->count * sizeof(mag->objs[0]));
+    }
+    mag->objs[mag->count++] = obj;
+    spin_unlock_irqrestore(&mag->lock, state);
+
+    kmem_cache_release(cache, release, n);
+}
+
+size_t kmem_cache_trim(struct kmem_cache *cache)
+{
+    void *objs[KMEM_MAGAZINE_SIZE];
+    struct kmem_slab *slab;
+    size_t slabs = 0;
+
+    if (!cache->setup) {
+        return 0;
+    }
+    smp_rmb();
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_saved_state_t state;
+        struct kmem_magazine *mag = &cache->mag[cpu];
+        spin_lock_irqsave(&mag->lock, state);
+        uint n = mag->count;
+        memcpy(objs, mag->objs, n * sizeof(objs[0]));
+        mag->count = 0;
+        spin_unlock_irqrestore(&mag->lock, state);
+        slabs += kmem_cache_release(cache, objs, n);
+    }
+
+    mutex_acquire(&cache->lock);
+    slab = cache->empty;
+    cache->empty = NULL;
+    if (slab) {
+        cache->slab_count--;
+    }
+    mutex_release(&cache->lock);
+
+    if (slab) {
+        page_free(slab, 1);
+        slabs++;
+    }
+    return slabs * PAGE_SIZE;
+}
+
+size_t kmem_trim(void)
+{
+    struct kmem_cache *cache;
+    size_t trimmed = 0;
+
+    mutex_acquire(&kmem_lock);
+    list_for_every_entry(&kmem_caches, cache, struct kmem_cache, node) {
+        trimmed += kmem_cache_trim(cache);
+    }
+    mutex_release(&kmem_lock);
+    return trimmed;
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, kmem_ctor_t ctor)
+{
+    DEBUG_ASSERT(name);
+
+    if (!size) {
+        return NULL;
+    }
+
+    /* the magazines are cache line aligned */
+    struct kmem_cache *cache = memalign(CACHE_LINE, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(*cache));
+    cache->name = name;
+    cache->size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    mutex_init(&cache->lock);
+    list_initialize(&cache->partial);
+    list_initialize(&cache->full);
+
+    kmem_cache_setup(cache);
+    return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+    if (!cache) {
+        return;
+    }
+
+    mutex_acquire(&kmem_lock);
+    list_delete(&cache->node);
+    mutex_release(&kmem_lock);
+
+    kmem_cache_trim(cache);
+
+    ASSERT(!cache->objs_out);
+    ASSERT(list_is_empty(&cache->partial));
+    ASSERT(list_is_empty(&cache->full));
+    DEBUG_ASSERT(!cache->slab_count);
+
+    mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+#if LK_DEBUGLEVEL > 1
+#if WITH_LIB_CONSOLE
+
+#include <lib/console.h>
+
+static int cmd_slab(int argc, const cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("slab", "slab allocator info", &cmd_slab)
+STATIC_COMMAND_END(slab);
+
+static void kmem_cache_dump(struct kmem_cache *cache)
+{
+    uint cached = 0;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cached += cache->mag[cpu].count;
+    }
+
+    mutex_acquire(&cache->lock);
+    size_t objs_out = cache->objs_out;
+    size_t slab_count = cache->slab_count;
+    mutex_release(&cache->lock);
+
+    size_t inuse = objs_out - MIN(objs_out, cached);
+    size_t bytes = cache->heap_backed ? objs_out * cache->stride
+                                      : slab_count * PAGE_SIZE;
+    printf("%-20s %6zu %6zu %6zu %6zu %6u %8zu %3zu%%%s\n", cache->name,
+           cache->size, cache->stride, slab_count, inuse, cached, bytes,
+           bytes ? inuse * cache->size * 100 / bytes : 0,
+           cache->heap_backed ? " (heap)" : "");
+}
+
+static int cmd_slab(int argc, const cmd_args *argv)
+{
+    if (argc == 2 && !strcmp(argv[1].str, "trim")) {
+        kmem_trim();
+        return 0;
+    }
+    if (argc != 1) {
+        printf("usage:\n");
+        printf("\t%s\n", argv[0].str);
+        printf("\t%s trim\n", argv[0].str);
+        return -1;
+    }
+
+    printf("%-20s %6s %6s %6s %6s %6s %8s %4s\n", "name", "size", "stride",
+           "slabs", "inuse", "cached", "bytes", "util");
+
+    struct kmem_cache *cache;
+    mutex_acquire(&kmem_lock);
+    list_for_every_entry(&kmem_caches, cache, struct kmem_cache, node) {
+        kmem_cache_dump(cache);
+    }
+    mutex_release(&kmem_lock);
+    return 0;
+}
+
+#endif
+#endif
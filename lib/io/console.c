@@ -32,9 +32,12 @@
 #include <arch/ops.h>
 #include <platform.h>
 #include <platform/debug.h>
+#include <kernel/event.h>
 #include <kernel/mutex.h>
 #include <kernel/thread.h>
+#include <kernel/timer.h>
 #include <lk/init.h>
+#include <stdatomic.h>
 
 /* routines for dealing with main console io */
 
@@ -64,6 +67,55 @@ static spin_lock_saved_state_t print_saved_state = 0;
 static unsigned int lock_held_by = SMP_MAX_CPUS;
 static struct list_node print_callbacks = LIST_INITIAL_VALUE(print_callbacks);
 
+#if CONSOLE_ASYNC
+#ifndef CONSOLE_ASYNC_BUF_LEN
+#define CONSOLE_ASYNC_BUF_LEN 4096
+#endif
+#define CONSOLE_ASYNC_DEFER_NS 10000000ULL /* 10ms */
+#define CONSOLE_ASYNC_CHUNK 16
+
+STATIC_ASSERT(!(CONSOLE_ASYNC_BUF_LEN & (CONSOLE_ASYNC_BUF_LEN - 1)));
+
+/*
+ * With CONSOLE_ASYNC, serial output is copied into a ring for the current cpu
+ * and written out by the console thread. out_lock disables interrupts
+ * instead of taking print_mutex or print_spin_lock, which keeps the writer
+ * on one cpu so each ring has a single producer, and keeps a message in one
+ * ring. A message only becomes visible to the drain when out_unlock
+ * publishes it, and the drain finishes the published messages of a ring
+ * before it moves to the next one, so messages from different cpus do not
+ * interleave.
+ *
+ * Anything that drains holds print_spin_lock. A writer that finds its ring
+ * full helps drain, so output is delayed but never dropped. The console
+ * thread sleeps until a writer wakes it. Writers with interrupts disabled
+ * cannot signal its event directly, so they arm a timer on their cpu that
+ * does.
+ */
+struct console_ring {
+    atomic_uint head; /* end of the last published message */
+    atomic_uint tail; /* written with print_spin_lock held */
+    uint write_head;  /* end of the message being written */
+    char buf[CONSOLE_ASYNC_BUF_LEN];
+};
+
+static struct console_ring console_rings[SMP_MAX_CPUS];
+static spin_lock_saved_state_t console_async_state[SMP_MAX_CPUS];
+static bool console_async_held_by[SMP_MAX_CPUS];
+static bool console_async_enabled;
+static atomic_bool console_async_pending;
+static event_t console_async_event =
+    EVENT_INITIAL_VALUE(console_async_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+/* only set and fired on their own cpu, with interrupts disabled */
+static timer_t console_async_timer[SMP_MAX_CPUS];
+static bool console_async_timer_armed[SMP_MAX_CPUS];
+
+/* ring being written out and where to stop, protected by print_spin_lock */
+static struct console_ring *console_drain_ring;
+static uint console_drain_end;
+static uint console_drain_next;
+#endif // CONSOLE_ASYNC
+
 #if CONSOLE_HAS_INPUT_BUFFER
 #ifndef CONSOLE_BUF_LEN
 #define CONSOLE_BUF_LEN 256
@@ -74,12 +126,129 @@ cbuf_t console_input_cbuf;
 static uint8_t console_cbuf_buf[CONSOLE_BUF_LEN];
 #endif // CONSOLE_HAS_INPUT_BUFFER
 
+#if CONSOLE_ASYNC
+/* true if out_lock took the async path on this cpu */
+static bool console_async_held(void)
+{
+    return arch_ints_disabled() &&
+           console_async_held_by[arch_curr_cpu_num()];
+}
+
+/*
+ * Write out up to max buffered characters, print_spin_lock must be held.
+ * Returns false once there is nothing left to write.
+ */
+static bool console_drain(uint max)
+{
+    while (max) {
+        struct console_ring *ring = console_drain_ring;
+
+        if (!ring) {
+            for (uint i = 0; i < SMP_MAX_CPUS && !ring; i++) {
+                uint cpu = (console_drain_next + i) % SMP_MAX_CPUS;
+                struct console_ring *r = &console_rings[cpu];
+                uint head = atomic_load_explicit(&r->head,
+                                                 memory_order_acquire);
+                if (head != atomic_load_explicit(&r->tail,
+                                                 memory_order_relaxed)) {
+                    ring = r;
+                    console_drain_ring = r;
+                    console_drain_end = head;
+                    console_drain_next = cpu + 1;
+                }
+            }
+            if (!ring) {
+                return false;
+            }
+        }
+
+        uint tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        for (; tail != console_drain_end && max; tail++, max--) {
+            platform_dputc(ring->buf[tail & (CONSOLE_ASYNC_BUF_LEN - 1)]);
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        if (tail == console_drain_end) {
+            console_drain_ring = NULL;
+        }
+    }
+    return true;
+}
+
+static void console_async_write(const char *str, size_t len)
+{
+    struct console_ring *ring = &console_rings[arch_curr_cpu_num()];
+    uint head = ring->write_head;
+    spin_lock_saved_state_t state;
+
+    while (len) {
+        uint tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        size_t space = CONSOLE_ASYNC_BUF_LEN - (head - tail);
+
+        if (!space) {
+            /*
+             * The console thread is behind, help drain. If this message
+             * alone fills the ring, publish it so far and let it split.
+             * Interrupts stay disabled until out_unlock, so only drain a
+             * chunk before copying more of this write, dropping
+             * print_spin_lock in between.
+             */
+            if (atomic_load_explicit(&ring->head, memory_order_relaxed) ==
+                tail) {
+                atomic_store_explicit(&ring->head, head, memory_order_release);
+            }
+            spin_lock_save(&print_spin_lock, &state, PRINT_LOCK_FLAGS);
+            console_drain(CONSOLE_ASYNC_CHUNK);
+            spin_unlock_restore(&print_spin_lock, state, PRINT_LOCK_FLAGS);
+            continue;
+        }
+
+        size_t pos = head & (CONSOLE_ASYNC_BUF_LEN - 1);
+        size_t n = MIN(MIN(len, space), CONSOLE_ASYNC_BUF_LEN - pos);
+        memcpy(ring->buf + pos, str, n);
+        head += n;
+        str += n;
+        len -= n;
+    }
+    ring->write_head = head;
+}
+
+/* make the message written since out_lock visible to the drain */
+static void console_async_publish(void)
+{
+    struct console_ring *ring = &console_rings[arch_curr_cpu_num()];
+
+    atomic_store_explicit(&ring->head, ring->write_head, memory_order_release);
+}
+
+/* wake the console thread unless it has been woken and not yet drained */
+static void console_async_wake(void)
+{
+    if (!atomic_exchange(&console_async_pending, true)) {
+        event_signal(&console_async_event, false);
+    }
+}
+
+static enum handler_return console_async_timer_cb(timer_t *timer,
+                                                  lk_time_ns_t now,
+                                                  void *arg)
+{
+    console_async_timer_armed[(uintptr_t)arg] = false;
+    console_async_wake();
+    return INT_NO_RESCHEDULE;
+}
+#endif // CONSOLE_ASYNC
+
 /* print lock must be held when invoking out, outs, outc */
 static void out_count(const char *str, size_t len)
 {
     print_callback_t *cb;
     size_t i;
+#if CONSOLE_ASYNC
+    bool async = console_async_held();
+    int need_lock = async || !arch_ints_disabled();
+#else
     int need_lock = !arch_ints_disabled();
+#endif
     spin_lock_saved_state_t state = 0;
 
     DEBUG_ASSERT(need_lock || lock_held_by == arch_curr_cpu_num());
@@ -102,6 +271,13 @@ static void out_count(const char *str, size_t len)
 #endif
     }
 
+#if CONSOLE_ASYNC
+    if (async) {
+        console_async_write(str, len);
+        return;
+    }
+#endif
+
     /* write out the serial port */
     for (i = 0; i < len; i++) {
         if (need_lock) {
@@ -119,7 +295,11 @@ static void out_commit(void)
 {
     print_callback_t *cb;
 
+#if CONSOLE_ASYNC
+    int need_lock = console_async_held() || !arch_ints_disabled();
+#else
     int need_lock = !arch_ints_disabled();
+#endif
     spin_lock_saved_state_t state = 0;
 
     DEBUG_ASSERT(need_lock || lock_held_by == arch_curr_cpu_num());
@@ -142,6 +322,16 @@ static void out_commit(void)
 
 static void out_lock(void)
 {
+#if CONSOLE_ASYNC
+    if (console_async_enabled) {
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, PRINT_LOCK_FLAGS);
+        uint cpu = arch_curr_cpu_num();
+        console_async_state[cpu] = state;
+        console_async_held_by[cpu] = true;
+        return;
+    }
+#endif
     if (arch_ints_disabled()) {
         /*
          * Even though interupts are disabled, FIQs may not be. So save and
@@ -159,6 +349,27 @@ static void out_lock(void)
 
 static void out_unlock(void)
 {
+#if CONSOLE_ASYNC
+    if (console_async_held()) {
+        uint cpu = arch_curr_cpu_num();
+        console_async_publish();
+        console_async_held_by[cpu] = false;
+        arch_interrupt_restore(console_async_state[cpu], PRINT_LOCK_FLAGS);
+        if (!arch_ints_disabled()) {
+            console_async_wake();
+        } else if (!console_async_timer_armed[cpu]) {
+            /*
+             * The caller may hold the thread lock or a lock taken under it,
+             * so leave event_signal to the timer.
+             */
+            console_async_timer_armed[cpu] = true;
+            timer_set_oneshot_ns(&console_async_timer[cpu],
+                                 CONSOLE_ASYNC_DEFER_NS, console_async_timer_cb,
+                                 (void *)(uintptr_t)cpu);
+        }
+        return;
+    }
+#endif
     if (arch_ints_disabled()) {
         DEBUG_ASSERT(lock_held_by == arch_curr_cpu_num());
         lock_held_by = SMP_MAX_CPUS;
@@ -189,6 +400,88 @@ void unregister_print_callback(print_callback_t *cb)
     spin_unlock_restore(&print_spin_lock, state, PRINT_LOCK_FLAGS);
 }
 
+#if CONSOLE_ASYNC
+/* drain the rings, a few characters at a time so interrupts stay enabled */
+static void console_async_flush(void)
+{
+    spin_lock_saved_state_t state;
+    bool more;
+
+    do {
+        spin_lock_save(&print_spin_lock, &state, PRINT_LOCK_FLAGS);
+        more = console_drain(CONSOLE_ASYNC_CHUNK);
+        spin_unlock_restore(&print_spin_lock, state, PRINT_LOCK_FLAGS);
+    } while (more);
+}
+
+static int console_async_thread(void *arg)
+{
+    for (;;) {
+        event_wait(&console_async_event);
+        atomic_store(&console_async_pending, false);
+        console_async_flush();
+    }
+    return 0;
+}
+
+void console_set_async(bool async)
+{
+    console_async_enabled = async;
+    if (!async) {
+        /* writers that already took the async path finish into the rings */
+        console_async_flush();
+    }
+}
+
+bool console_get_async(void)
+{
+    return console_async_enabled;
+}
+
+/*
+ * Switch to synchronous output and flush the rings for panic. This cpu may
+ * already hold print_spin_lock, e.g. if the panic came from inside
+ * console_drain, so only try to take it. If that fails the rings are written
+ * out without it, which can repeat or interleave characters with a drain on
+ * another cpu but does not lose output or hang.
+ */
+void console_async_panic(void)
+{
+    spin_lock_saved_state_t state;
+    bool locked;
+
+    console_async_enabled = false;
+    arch_interrupt_save(&state, PRINT_LOCK_FLAGS);
+    if (console_async_held()) {
+        /* panicked in the middle of a message, show what it has so far */
+        console_async_publish();
+    }
+    locked = !spin_trylock(&print_spin_lock);
+    while (console_drain(CONSOLE_ASYNC_CHUNK)) {
+    }
+    if (locked) {
+        spin_unlock(&print_spin_lock);
+    }
+    arch_interrupt_restore(state, PRINT_LOCK_FLAGS);
+}
+
+static void console_async_init(uint level)
+{
+    thread_t *thread = thread_create("console", console_async_thread, NULL,
+                                     LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!thread) {
+        return;
+    }
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        timer_initialize(&console_async_timer[i]);
+    }
+    thread_detach_and_resume(thread);
+    console_set_async(true);
+}
+
+LK_INIT_HOOK(console_async, console_async_init, LK_INIT_LEVEL_THREADING);
+#endif // CONSOLE_ASYNC
+
 static ssize_t __debug_stdio_write(io_handle_t *io, const char *s, size_t len)
 {
     out_count(s, len);
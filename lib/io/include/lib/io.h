@@ -42,6 +42,22 @@ struct __print_callback {
 void register_print_callback(print_callback_t *cb);
 void unregister_print_callback(print_callback_t *cb);
 
+#if CONSOLE_ASYNC
+/*
+ * Buffer serial output in per-cpu rings drained by the console thread, or
+ * write it out synchronously. Switching to synchronous output flushes the
+ * rings first. console_async_panic does the same for panic without waiting
+ * for a drain that may never finish.
+ */
+void console_set_async(bool async);
+bool console_get_async(void);
+void console_async_panic(void);
+#else
+static inline void console_set_async(bool async) {}
+static inline bool console_get_async(void) { return false; }
+static inline void console_async_panic(void) {}
+#endif
+
 /* the underlying handle to talk to io devices */
 struct io_handle;
 typedef struct io_handle_hooks {
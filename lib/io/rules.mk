@@ -13,6 +13,12 @@ ifeq (true,$(call TOBOOL,$(CONSOLE_CALLBACK_DISABLES_SERIAL)))
 MODULE_DEFINES += CONSOLE_CALLBACK_DISABLES_SERIAL=1
 endif
 
+# buffer serial output per cpu and write it out from a thread
+CONSOLE_ASYNC ?= false
+ifeq (true,$(call TOBOOL,$(CONSOLE_ASYNC)))
+GLOBAL_DEFINES += CONSOLE_ASYNC=1
+endif
+
 endif
 
 MODULE_SRCS += \
@@ -22,4 +22,5 @@
 
 MODULES += \
 	$(GET_LOCAL_DIR)/binary_search_tree/hosttest \
+	$(GET_LOCAL_DIR)/libc/string/hosttest \
 
@@ -25,11 +25,40 @@
 
 #include <sys/types.h>
 
+/*
+ * The parts of <new> the kernel needs. Without exceptions the throwing
+ * versions of operator new return NULL on failure just like the nothrow ones.
+ */
+namespace std {
+enum class align_val_t : size_t {};
+struct nothrow_t {
+    explicit nothrow_t() = default;
+};
+extern const nothrow_t nothrow;
+}  // namespace std
+
 void *operator new(size_t);
-void *operator new(size_t, void *ptr);
+void *operator new(size_t, const std::nothrow_t &) noexcept;
+void *operator new(size_t, std::align_val_t);
+void *operator new(size_t, std::align_val_t, const std::nothrow_t &) noexcept;
+void *operator new(size_t, void *ptr) noexcept;
 void *operator new[](size_t);
-void *operator new[](size_t, void *ptr);
-void operator delete(void *p);
-void operator delete[](void *p);
+void *operator new[](size_t, const std::nothrow_t &) noexcept;
+void *operator new[](size_t, std::align_val_t);
+void *operator new[](size_t, std::align_val_t, const std::nothrow_t &) noexcept;
+void *operator new[](size_t, void *ptr) noexcept;
+
+void operator delete(void *p) noexcept;
+void operator delete(void *p, size_t) noexcept;
+void operator delete(void *p, std::align_val_t) noexcept;
+void operator delete(void *p, size_t, std::align_val_t) noexcept;
+void operator delete(void *p, const std::nothrow_t &) noexcept;
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept;
+void operator delete[](void *p) noexcept;
+void operator delete[](void *p, size_t) noexcept;
+void operator delete[](void *p, std::align_val_t) noexcept;
+void operator delete[](void *p, size_t, std::align_val_t) noexcept;
+void operator delete[](void *p, const std::nothrow_t &) noexcept;
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept;
 
 #endif
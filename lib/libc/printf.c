@@ -22,12 +22,17 @@
  */
 #include <assert.h>
 #include <limits.h>
+#include <lk/macros.h>
 #include <printf.h>
 #include <stdarg.h>
 #include <sys/types.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifndef PRINTF_BUFFER_LEN
+#define PRINTF_BUFFER_LEN 128
+#endif
+
 #if WITH_NO_FP
 #define FLOAT_PRINTF 0
 #else
@@ -73,17 +78,13 @@ static int _vsnprintf_output(const char *str, size_t len, void *state)
 {
     struct _output_args *args = state;
 
-    size_t count = 0;
-    while (count < len) {
-        if (args->pos < args->len) {
-            args->outstr[args->pos++] = *str;
-        }
-
-        str++;
-        count++;
+    if (args->pos < args->len) {
+        size_t count = MIN(len, args->len - args->pos);
+        memcpy(&args->outstr[args->pos], str, count);
+        args->pos += count;
     }
 
-    return count;
+    return len;
 }
 
 int vsnprintf(char *str, size_t len, const char *fmt, va_list ap)
@@ -118,6 +119,36 @@ int vsnprintf(char *str, size_t len, const char *fmt, va_list ap)
 #define LEADZEROFLAG   0x00001000
 #define BLANKPOSFLAG   0x00002000
 
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* write n backwards ending at &buf[pos], two digits at a time */
+static size_t uint_to_string(char *buf, size_t pos, unsigned long n)
+{
+    while (n >= 100) {
+        unsigned int pair = (n % 100) * 2;
+        n /= 100;
+        buf[--pos] = digit_pairs[pair + 1];
+        buf[--pos] = digit_pairs[pair];
+    }
+    if (n >= 10) {
+        buf[--pos] = digit_pairs[n * 2 + 1];
+        buf[--pos] = digit_pairs[n * 2];
+    } else {
+        buf[--pos] = n + '0';
+    }
+    return pos;
+}
+
 __NO_INLINE static char *longlong_to_string(char *buf, unsigned long long n, size_t len, uint flag, char *signchar)
 {
     size_t pos = len;
@@ -131,15 +162,19 @@ __NO_INLINE static char *longlong_to_string(char *buf, unsigned long long n, siz
 
     buf[--pos] = 0;
 
-    /* only do the math if the number is >= 10 */
-    while (n >= 10) {
-        int digit = n % 10;
-
-        n /= 10;
-
-        buf[--pos] = digit + '0';
+    /*
+     * peel off 8 digits at a time until the rest fits in a long, so 32 bit
+     * cpus only pay for a 64 bit divide on very large numbers
+     */
+    while (n > ULONG_MAX) {
+        unsigned long low = n % 100000000;
+        size_t end = pos - 8;
+        n /= 100000000;
+        pos = uint_to_string(buf, pos, low);
+        while (pos > end)
+            buf[--pos] = '0';
     }
-    buf[--pos] = n + '0';
+    pos = uint_to_string(buf, pos, n);
 
     if (negative)
         *signchar = '-';
@@ -416,9 +451,39 @@ int _printf_engine(_printf_engine_output_func out, void *state, const char *fmt,
     char signchar;
     size_t chars_written = 0;
     char num_buffer[32];
+    char out_buffer[PRINTF_BUFFER_LEN];
+    size_t out_pos = 0;
 
-#define OUTPUT_STRING(str, len) do { err = out(str, len, state); if (err < 0) { goto exit; } else { chars_written += err; } } while(0)
-#define OUTPUT_CHAR(c) do { char __temp[1] = { c }; OUTPUT_STRING(__temp, 1); } while (0)
+    /*
+     * Output is collected in out_buffer and handed to out in large chunks
+     * rather than a call per literal run, number and padding character.
+     * Strings that would not fit anyway are passed straight through.
+     */
+#define FLUSH_BUFFER() do { if (out_pos) { err = out(out_buffer, out_pos, state); if (err < 0) { goto exit; } else { chars_written += err; out_pos = 0; } } } while (0)
+#define OUTPUT_STRING(str, len) do { \
+        size_t __len = (len); \
+        if (__len > sizeof(out_buffer) - out_pos) { \
+            FLUSH_BUFFER(); \
+            if (__len >= sizeof(out_buffer)) { \
+                err = out(str, __len, state); \
+                if (err < 0) { goto exit; } else { chars_written += err; } \
+                break; \
+            } \
+        } \
+        memcpy(&out_buffer[out_pos], str, __len); \
+        out_pos += __len; \
+    } while (0)
+#define OUTPUT_CHAR(c) do { if (out_pos == sizeof(out_buffer)) FLUSH_BUFFER(); out_buffer[out_pos++] = (c); } while (0)
+#define OUTPUT_PAD(c, count) do { \
+        size_t __count = (count); \
+        while (__count) { \
+            if (out_pos == sizeof(out_buffer)) FLUSH_BUFFER(); \
+            size_t __n = MIN(__count, sizeof(out_buffer) - out_pos); \
+            memset(&out_buffer[out_pos], (c), __n); \
+            out_pos += __n; \
+            __count -= __n; \
+        } \
+    } while (0)
 
     for (;;) {
         /* reset the format state */
@@ -514,7 +579,7 @@ next_format:
                     va_arg(ap, int));
                 flags |= SIGNEDFLAG;
                 s = longlong_to_string(num_buffer, n, sizeof(num_buffer), flags, &signchar);
-                goto _output_string;
+                goto _output_number;
             case 'u':
                 n = (unsigned long long)((flags & LONGLONGFLAG) ? va_arg(ap, unsigned long long) :
                     (flags & LONGFLAG) ? va_arg(ap, unsigned long) :
@@ -525,7 +590,7 @@ next_format:
                     (flags & PTRDIFFFLAG) ? (uintptr_t)va_arg(ap, ptrdiff_t) :
                     va_arg(ap, unsigned int));
                 s = longlong_to_string(num_buffer, n, sizeof(num_buffer), flags, &signchar);
-                goto _output_string;
+                goto _output_number;
             case 'p':
                 flags |= LONGFLAG | ALTFLAG;
                 goto hex;
@@ -547,9 +612,10 @@ hex:
                     OUTPUT_CHAR('0');
                     OUTPUT_CHAR((flags & CAPSFLAG) ? 'X': 'x');
                 }
-                goto _output_string;
+                goto _output_number;
             case 'n':
                 ptr = va_arg(ap, void *);
+                chars_written += out_pos;
                 if (flags & LONGLONGFLAG)
                     *(long long *)ptr = chars_written;
                 else if (flags & LONGFLAG)
@@ -562,6 +628,7 @@ hex:
                     *(size_t *)ptr = chars_written;
                 else
                     *(int *)ptr = chars_written;
+                chars_written -= out_pos;
                 break;
 #if FLOAT_PRINTF
             case 'F':
@@ -593,15 +660,20 @@ hex:
         /* shared output code */
 _output_string:
         string_len = strlen(s);
+        goto _output_padded;
 
+        /* integers are converted to the end of num_buffer */
+_output_number:
+        string_len = &num_buffer[sizeof(num_buffer) - 1] - s;
+
+_output_padded:
         if (flags & LEFTFORMATFLAG) {
             /* left justify the text */
             OUTPUT_STRING(s, string_len);
-            uint written = err;
 
             /* pad to the right (if necessary) */
-            for (; format_num > written; format_num--)
-                OUTPUT_CHAR(' ');
+            if (format_num > string_len)
+                OUTPUT_PAD(' ', format_num - string_len);
         } else {
             /* right justify the text (digits) */
 
@@ -615,8 +687,8 @@ _output_string:
                 OUTPUT_CHAR(signchar);
 
             /* pad according to the format string */
-            for (; format_num > string_len; format_num--)
-                OUTPUT_CHAR(flags & LEADZEROFLAG ? '0' : ' ');
+            if (format_num > string_len)
+                OUTPUT_PAD(flags & LEADZEROFLAG ? '0' : ' ', format_num - string_len);
 
             /* if not leading zeros, output the sign char just before the number */
             if (!(flags & LEADZEROFLAG) && signchar != '\0')
@@ -628,8 +700,12 @@ _output_string:
         continue;
     }
 
+    FLUSH_BUFFER();
+
+#undef FLUSH_BUFFER
 #undef OUTPUT_STRING
 #undef OUTPUT_CHAR
+#undef OUTPUT_PAD
 
 exit:
     return (err < 0) ? err : (int)chars_written;
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2026 LK Trusty Authors. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+void* lk_memchr(const void* buf, int c, size_t len);
+char* lk_strchr(const char* s, int c);
+int lk_strcmp(const char* cs, const char* ct);
+size_t lk_strlen(const char* s);
+size_t lk_strnlen(const char* s, size_t count);
+}
+
+#define MAX_LEN 300
+#define FUZZ_ITER 20000
+
+static int sign(int v) {
+    return (v > 0) - (v < 0);
+}
+
+/*
+ * Two pages with the second one inaccessible. Strings are placed so that
+ * they end right before the guard page, which catches any read past the
+ * terminator that leaves the word holding it.
+ */
+class StringTest : public testing::Test {
+protected:
+    void SetUp() override {
+        page_size_ = sysconf(_SC_PAGESIZE);
+        map_ = (char*)mmap(NULL, page_size_ * 2, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        ASSERT_NE(map_, MAP_FAILED);
+        ASSERT_EQ(mprotect(map_ + page_size_, page_size_, PROT_NONE), 0);
+        srand(0);
+    }
+
+    void TearDown() override { munmap(map_, page_size_ * 2); }
+
+    /* random bytes without a terminator, a few of them set to c */
+    char* make_buf(size_t len, int c) {
+        char* buf = map_ + page_size_ - len;
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = rand() % 255 + 1;
+        }
+        if (len && rand() % 2) {
+            buf[rand() % len] = c;
+        }
+        return buf;
+    }
+
+    /* a string of len characters whose terminator is the last byte mapped */
+    char* make_str(size_t len, int c) {
+        char* s = make_buf(len + 1, c);
+        s[len] = '\0';
+        return s;
+    }
+
+    size_t page_size_;
+    char* map_;
+};
+
+TEST_F(StringTest, strlen) {
+    for (size_t len = 0; len < MAX_LEN; len++) {
+        const char* s = make_str(len, 'a');
+        ASSERT_EQ(lk_strlen(s), strlen(s)) << "len " << len;
+    }
+}
+
+TEST_F(StringTest, strnlen) {
+    for (int i = 0; i < FUZZ_ITER; i++) {
+        size_t len = rand() % MAX_LEN;
+        const char* s = make_str(len, 'a');
+        size_t count = rand() % (len + 2);
+        ASSERT_EQ(lk_strnlen(s, count), strnlen(s, count))
+                << "len " << len << " count " << count;
+    }
+    /* the count may reach past the end, the terminator stops the scan */
+    const char* s = make_str(17, 'a');
+    EXPECT_EQ(lk_strnlen(s, SIZE_MAX), 17U);
+}
+
+TEST_F(StringTest, strnlen_unterminated) {
+    /* no terminator at all, count has to keep the scan inside the buffer */
+    for (size_t len = 0; len < MAX_LEN; len++) {
+        const char* buf = make_buf(len, 'a');
+        ASSERT_EQ(lk_strnlen(buf, len), len);
+    }
+}
+
+TEST_F(StringTest, strchr) {
+    for (int i = 0; i < FUZZ_ITER; i++) {
+        size_t len = rand() % MAX_LEN;
+        int c = rand() % 256;
+        const char* s = make_str(len, c);
+        ASSERT_EQ(lk_strchr(s, c), strchr(s, c))
+                << "len " << len << " c " << c;
+    }
+    const char* s = make_str(40, 'a');
+    EXPECT_EQ(lk_strchr(s, '\0'), s + 40);
+    EXPECT_EQ(lk_strchr(s, 'a' | 0x100), strchr(s, 'a' | 0x100));
+}
+
+TEST_F(StringTest, memchr) {
+    for (int i = 0; i < FUZZ_ITER; i++) {
+        size_t len = rand() % MAX_LEN;
+        int c = rand() % 256;
+        const char* buf = make_buf(len, c);
+        size_t count = len ? rand() % (len + 1) : 0;
+        ASSERT_EQ(lk_memchr(buf, c, count), memchr(buf, c, count))
+                << "len " << len << " count " << count << " c " << c;
+    }
+    const char* buf = make_buf(64, 'x');
+    EXPECT_EQ(lk_memchr(buf, 'x' | 0x100, 64), memchr(buf, 'x', 64));
+}
+
+TEST_F(StringTest, strcmp) {
+    char* other = (char*)malloc(MAX_LEN + 16);
+    ASSERT_NE(other, nullptr);
+
+    for (int i = 0; i < FUZZ_ITER; i++) {
+        size_t len = rand() % MAX_LEN;
+        char* s = make_str(len, 'a');
+        /* the same string at a random alignment, then maybe change it */
+        char* t = other + rand() % 16;
+        memcpy(t, s, len + 1);
+        switch (rand() % 4) {
+        case 0:
+            break;
+        case 1:
+            if (len) {
+                t[rand() % len] = rand() % 256;
+            }
+            break;
+        case 2:
+            t[rand() % (len + 1)] = '\0';
+            break;
+        case 3:
+            if (len) {
+                t[len - 1] ^= 0x80;
+            }
+            break;
+        }
+        ASSERT_EQ(sign(lk_strcmp(s, t)), sign(strcmp(s, t))) << "len " << len;
+        ASSERT_EQ(sign(lk_strcmp(t, s)), sign(strcmp(t, s))) << "len " << len;
+    }
+    free(other);
+}
@@ -27,16 +27,27 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include "word.h"
+
 void *
 memchr(void const *buf, int c, size_t len)
 {
-    size_t i;
     unsigned char const *b= buf;
     unsigned char        x= (c&0xff);
+    word_t const        *w;
+    word_t               xw= word_repeat(x);
 
-    for (i= 0; i< len; i++) {
-        if (b[i]== x) {
-            return (void *)(b+i);
+    for (; len && !word_aligned(b); b++, len--) {
+        if (*b== x) {
+            return (void *)b;
+        }
+    }
+    for (w= (word_t const *)b; len >= WORD_SIZE && !word_has_zero(*w ^ xw);
+         w++, len-= WORD_SIZE)
+        ;
+    for (b= (unsigned char const *)w; len; b++, len--) {
+        if (*b== x) {
+            return (void *)b;
         }
     }
 
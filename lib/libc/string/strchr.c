@@ -27,10 +27,25 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include "word.h"
+
 char *
 strchr(const char *s, int c)
 {
-    for (; *s != (char) c; ++s)
+    const word_t *w;
+    word_t cw = word_repeat((unsigned char)c);
+
+    for (; !word_aligned(s); ++s) {
+        if (*s == (char) c)
+            return (char *) s;
+        if (*s == '\0')
+            return NULL;
+    }
+    // skip words that hold neither c nor the terminator
+    for (w = (const word_t *)s; !word_has_zero(*w) && !word_has_zero(*w ^ cw);
+         w++)
+        ;
+    for (s = (const char *)w; *s != (char) c; ++s)
         if (*s == '\0')
             return NULL;
     return (char *) s;
@@ -27,6 +27,8 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include "word.h"
+
 int
 strcmp(char const *cs, char const *ct)
 {
@@ -34,6 +36,21 @@ strcmp(char const *cs, char const *ct)
     const unsigned char *su1 = (const unsigned char *)cs;
     const unsigned char *su2 = (const unsigned char *)ct;
 
+    // compare a word at a time while both strings are equally aligned
+    if (!(((uintptr_t)su1 ^ (uintptr_t)su2) & WORD_MASK)) {
+        const word_t *w1, *w2;
+
+        for (; !word_aligned(su1); su1++, su2++) {
+            if (*su1 != *su2 || !*su1)
+                return *su1 - *su2;
+        }
+        for (w1 = (const word_t *)su1, w2 = (const word_t *)su2;
+             *w1 == *w2 && !word_has_zero(*w1); w1++, w2++)
+            ;
+        su1 = (const unsigned char *)w1;
+        su2 = (const unsigned char *)w2;
+    }
+
     while (1) {
         if ((res = *su1 - *su2++) != 0 || !*su1++)
             break;
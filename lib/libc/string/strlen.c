@@ -27,15 +27,22 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include "word.h"
+
 size_t
 strlen(char const *s)
 {
-    size_t i;
+    const char *p = s;
+    const word_t *w;
 
-    i= 0;
-    while (s[i]) {
-        i+= 1;
+    for (; !word_aligned(p); p++) {
+        if (!*p)
+            return p - s;
     }
+    for (w = (const word_t *)p; !word_has_zero(*w); w++)
+        ;
+    for (p = (const char *)w; *p; p++)
+        ;
 
-    return i;
+    return p - s;
 }
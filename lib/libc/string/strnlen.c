@@ -27,12 +27,22 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include "word.h"
+
 size_t
 strnlen(char const *s, size_t count)
 {
-    const char *sc;
+    const char *sc = s;
+    const word_t *w;
 
-    for (sc = s; count && *sc != '\0'; ++sc, count--)
+    for (; count && !word_aligned(sc); ++sc, count--) {
+        if (*sc == '\0')
+            return sc - s;
+    }
+    for (w = (const word_t *)sc; count >= WORD_SIZE && !word_has_zero(*w);
+         w++, count -= WORD_SIZE)
+        ;
+    for (sc = (const char *)w; count && *sc != '\0'; ++sc, count--)
         ;
     return sc - s;
 }
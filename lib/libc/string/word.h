@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2026, Google Inc. All rights reserved
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Helpers for the word-at-a-time string routines. Callers only dereference
+ * word aligned pointers, so a word read past the end of a string never
+ * crosses into the next page.
+ */
+typedef unsigned long __attribute__((may_alias)) word_t;
+
+#define WORD_SIZE sizeof(word_t)
+#define WORD_MASK (WORD_SIZE - 1)
+#define WORD_ONES ((word_t)-1 / 0xff)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+
+/* nonzero if any byte of w is zero */
+__attribute__((no_sanitize("unsigned-integer-overflow")))
+static inline word_t word_has_zero(word_t w) {
+    return (w - WORD_ONES) & ~w & WORD_HIGHS;
+}
+
+/* c in every byte of a word */
+static inline word_t word_repeat(unsigned char c) {
+    return WORD_ONES * c;
+}
+
+static inline bool word_aligned(const void *p) {
+    return !((uintptr_t)p & WORD_MASK);
+}
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+# vim: set expandtab ts=4 sw=4 tw=100:
+"""Decode the output of the "binlog dump" console command.
+
+The kernel records the address of each format string plus its raw arguments
+(see lib/binlog). This reads the dump lines out of a console log, looks the
+format strings up in the kernel ELF file and prints the formatted messages
+from all cpus in timestamp order.
+
+usage: binlog_decode.py lk.elf console.log
+"""
+
+import re
+import struct
+import sys
+from optparse import OptionParser
+
+BINLOG_FLAG_PAD = 0x1
+BINLOG_FLAG_TRUNCATED = 0x2
+
+RECORD_HEADER = struct.Struct("<HBBIQQ")
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_ALLOC = 0x2
+
+
+class Elf(object):
+    """Just enough of an ELF reader to find strings and symbols."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError("%s is not an ELF file" % path)
+        if self.data[5] != 1:
+            raise ValueError("only little endian ELF files are supported")
+        self.is64 = self.data[4] == 2
+
+        if self.is64:
+            (shoff,) = struct.unpack_from("<Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x3a)
+            shdr = struct.Struct("<IIQQQQIIQQ")
+        else:
+            (shoff,) = struct.unpack_from("<I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2e)
+            shdr = struct.Struct("<IIIIIIIIII")
+
+        self.sections = []
+        for i in range(shnum):
+            (name, stype, flags, addr, offset, size, link, info, align,
+             entsize) = shdr.unpack_from(self.data, shoff + i * shentsize)
+            self.sections.append((stype, flags, addr, offset, size, link, entsize))
+
+    def read_string(self, addr):
+        for stype, flags, saddr, offset, size, _, _ in self.sections:
+            if not flags & SHF_ALLOC or stype == SHT_NOBITS:
+                continue
+            if saddr <= addr < saddr + size:
+                start = offset + addr - saddr
+                end = self.data.index(b"\0", start, offset + size)
+                return self.data[start:end].decode("latin-1")
+        return None
+
+    def symbol(self, wanted):
+        if self.is64:
+            sym = struct.Struct("<IBBHQQ")
+        else:
+            sym = struct.Struct("<IIIBBH")
+        for stype, _, _, offset, size, link, entsize in self.sections:
+            if stype != SHT_SYMTAB:
+                continue
+            strtab = self.sections[link][3]
+            for pos in range(offset, offset + size, entsize):
+                fields = sym.unpack_from(self.data, pos)
+                name = fields[0]
+                value = fields[4] if self.is64 else fields[1]
+                end = self.data.index(b"\0", strtab + name)
+                if self.data[strtab + name:end].decode("latin-1") == wanted:
+                    return value
+        return None
+
+
+CONVERSION = re.compile(r"%([-+ #0-9.]*)(hh|h|ll|l|z|j|t)?(.)")
+
+
+def format_record(fmt, args, flags):
+    """Format args the way _printf_engine would have."""
+    out = []
+    pos = 0
+    args = iter(args)
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        spec, size, conv = m.group(1), m.group(2), m.group(3)
+        spec = spec.replace(".", "")
+        if conv == "%":
+            out.append("%")
+            continue
+        if conv == "n":
+            continue
+        if conv not in "cdiuxXps":
+            if conv in "fFaA":
+                break
+            out.append("%" + conv)
+            continue
+        try:
+            val = next(args)
+        except StopIteration:
+            break
+        if conv in "di":
+            if val >= 1 << 63:
+                val -= 1 << 64
+            out.append(("%" + spec + "d") % val)
+        elif conv == "u":
+            out.append(("%" + spec + "d") % val)
+        elif conv == "p":
+            out.append(("%" + spec + "s") % ("0x%x" % val))
+        elif conv == "c":
+            out.append(("%" + spec + "c") % (val & 0xff))
+        else:
+            out.append(("%" + spec + conv) % val)
+    else:
+        out.append(fmt[pos:])
+    if flags & BINLOG_FLAG_TRUNCATED:
+        out.append("<truncated>")
+    return "".join(out)
+
+
+def parse_args(fmt, data):
+    """Split the argument words of a record, using the format for %s."""
+    args = []
+    pos = 0
+    for m in CONVERSION.finditer(fmt):
+        conv = m.group(3)
+        if conv in "%n" or conv not in "cdiuxXps":
+            continue
+        if pos + 8 > len(data):
+            break
+        (val,) = struct.unpack_from("<Q", data, pos)
+        pos += 8
+        if conv == "s":
+            args.append(data[pos:pos + val].decode("latin-1"))
+            pos += (val + 7) // 8 * 8
+        else:
+            args.append(val)
+    return args
+
+
+def main():
+    parser = OptionParser(usage="usage: %prog [options] lk.elf [console.log]")
+    parser.add_option("-r", "--raw", action="store_true", default=False,
+                      help="also print the sequence number and format address")
+    (options, args) = parser.parse_args()
+    if len(args) < 1:
+        parser.error("need the kernel ELF file")
+
+    elf = Elf(args[0])
+    log = open(args[1], "r", errors="replace") if len(args) > 1 else sys.stdin
+
+    slide = 0
+    records = []
+    for line in log:
+        m = re.search(r"binlog: anchor (?:0x)?([0-9a-fA-F]+)", line)
+        if m:
+            anchor = elf.symbol("binlog_anchor")
+            if anchor is None:
+                sys.stderr.write("binlog_anchor not found, assuming no relocation\n")
+            else:
+                slide = int(m.group(1), 16) - anchor
+            continue
+        m = re.search(r"binlog: cpu (\d+) ([0-9a-f]+)", line)
+        if not m:
+            continue
+        data = bytes.fromhex(m.group(2))
+        size, flags, nargs, seq, time, fmt = RECORD_HEADER.unpack_from(data)
+        records.append((time, int(m.group(1)), seq, flags, fmt,
+                        data[RECORD_HEADER.size:size]))
+
+    records.sort()
+    for time, cpu, seq, flags, fmt_addr, data in records:
+        fmt = elf.read_string(fmt_addr - slide)
+        if fmt is None:
+            text = "<unknown format %#x>\n" % fmt_addr
+        else:
+            text = format_record(fmt, parse_args(fmt, data), flags)
+        prefix = "[%u.%09u] cpu %u: " % (time // 1000000000, time % 1000000000, cpu)
+        if options.raw:
+            prefix += "seq %u fmt %#x: " % (seq, fmt_addr)
+        sys.stdout.write(prefix + text)
+        if not text.endswith("\n"):
+            sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()